@@ -0,0 +1,1014 @@
+/**
+ * Hacker News Logs Parser. Micro-benchmarks.
+ * Measure the throughput of the hot paths of the parser, against a given (or generated) log file
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "yrequest.hpp"
+#include "yprocessing.hpp"
+#include "yindex.hpp"
+#include "synthlog.hpp"
+#include "chunkreader.hpp"
+#include "simdscan.hpp"
+#include "hashing.hpp"
+#include "refstringmap.hpp"
+#include "chrono.hpp"
+
+#define VERSION "1.0"
+
+// Default number of iterations; the best one is kept
+#define DEFAULT_ITERATIONS 5
+
+// Number of queries inserted at once in the hashtable (as when scanning)
+#define INSERT_BATCH 32
+
+// Number of random lookups of the locate benchmark
+#define LOCATE_LOOKUPS 10000
+
+static const struct option long_options[] = {
+  {"help", no_argument, 0, 'h'},
+  {"iterations", required_argument, 0, 'n'},
+  {"json", no_argument, 0, 'j'},
+
+  {"size", required_argument, 0, 's'},
+  {"queries", required_argument, 0, 'q'},
+  {"skew", required_argument, 0, 'k'},
+  {"length", required_argument, 0, 'l'},
+  {"rate", required_argument, 0, 'r'},
+  {"jitter", required_argument, 0, 't'},
+  {"seed", required_argument, 0, 'e'},
+
+  {},
+};
+#define GETOPT_NON_OPTION_TYPE 1
+
+// Results are printed as a JSON document (see report)
+static bool json_output = false;
+
+// Number of JSON results printed so far
+static size_t json_results = 0;
+
+/** Named values of a result, printed after the common ones. **/
+typedef std::vector<std::pair<std::string, double>> ResultFields;
+
+// print program usage
+static void usage(const char *prog) {
+  std::cout
+  << prog << " tokenize input_file [iterations]\n"
+  << "\tMeasure the records tokenizer throughput, for each available scanning implementation\n"
+  << prog << " hash input_file [iterations]\n"
+  << "\tMeasure the hash throughput and the hashtable collision rate on the file queries, for each hash policy\n"
+  << prog << " mapping input_file [iterations]\n"
+  << "\tMeasure the records scan throughput with a cold, then a warm page cache, for each mapping policy\n"
+  << prog << " read input_file [iterations]\n"
+  << "\tMeasure the records scan throughput with a cold, then a warm page cache, for each read mode (mapping, pread, O_DIRECT)\n"
+  << prog << " insert input_file [iterations]\n"
+  << "\tMeasure the hashtable insertion throughput of the file queries, one at a time, and by batches\n"
+  << prog << " topk input_file [iterations]\n"
+  << "\tMeasure the top-k selection over the distinct queries of the file, for several k\n"
+  << prog << " locate input_file [iterations]\n"
+  << "\tMeasure random timestamp lookups, by binary search over the mapping, and through a timestamp index\n"
+  << prog << " run input_file [iterations]\n"
+  << "\tMeasure end-to-end distinct and top queries, over the whole file and over a range (sidecars unused)\n"
+  << prog << " all input_file [iterations]\n"
+  << "\tRun all the above benchmarks\n"
+  << prog << " generate output_file\n"
+  << "\tWrite deterministic synthetic logs\n"
+  << "Options:\n"
+  << "\t--iterations=N\tnumber of iterations, the best one being kept (default: " << DEFAULT_ITERATIONS << ")\n"
+  << "\t--json\tprint the results as a JSON document\n"
+  << "\t--size=SIZE\tgenerated logs size, with an optional K, M or G suffix (default: 64M)\n"
+  << "\t--queries=N\tnumber of distinct generated queries (default: " << SYNTH_DEFAULT_QUERIES << ")\n"
+  << "\t--skew=S\tZipf exponent of the generated queries popularity, 0 being uniform (default: " << SYNTH_DEFAULT_SKEW << ")\n"
+  << "\t--length=MIN:MAX\tgenerated queries length range (default: " << SYNTH_DEFAULT_MIN_LENGTH << ":" << SYNTH_DEFAULT_MAX_LENGTH << ")\n"
+  << "\t--rate=N\tgenerated records per second (default: " << SYNTH_DEFAULT_RATE << ")\n"
+  << "\t--jitter=SECONDS\tmaximum lag of generated timestamps (out of order span) (default: " << SYNTH_DEFAULT_JITTER << ")\n"
+  << "\t--seed=N\trandom seed of the generated logs (default: " << SYNTH_DEFAULT_SEED << ")\n";
+}
+
+/**
+ * Parse a size, with an optional K, M or G suffix.
+ *
+ * @param s The string to be parsed.
+ * @return The size, or 0 upon error.
+**/
+static size_t parse_size(const char *s) {
+  char *end = NULL;
+  const unsigned long long value = strtoull(s, &end, 10);
+  if (end == NULL || end == s) {
+    return 0;
+  }
+  unsigned shift = 0;
+  switch(*end) {
+  case '\0':
+    return static_cast<size_t>(value);
+  case 'k':
+  case 'K':
+    shift = 10;
+    break;
+  case 'm':
+  case 'M':
+    shift = 20;
+    break;
+  case 'g':
+  case 'G':
+    shift = 30;
+    break;
+  default:
+    return 0;
+  }
+  return end[1] == '\0' ? static_cast<size_t>(value << shift) : 0;
+}
+
+/**
+ * Parse a number.
+ *
+ * @param s The string to be parsed.
+ * @param value The value to be filled.
+ * @return @c true upon success
+**/
+static bool parse_number(const char *s, double &value) {
+  char *end = NULL;
+  value = strtod(s, &end);
+  return end != NULL && end != s && *end == '\0' && value >= 0;
+}
+
+/**
+ * Quote a JSON string.
+ **/
+static std::string json_string(const std::string &s) {
+  std::ostringstream quoted;
+  quoted << '"';
+  for(const char c : s) {
+    if (c == '"' || c == '\\') {
+      quoted << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static const char hex[] = "0123456789abcdef";
+      quoted << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+    } else {
+      quoted << c;
+    }
+  }
+  quoted << '"';
+  return quoted.str();
+}
+
+/**
+ * Print a JSON result object.
+ *
+ * @param name The benchmark name
+ * @param supported If @c false, the benchmark could not be run
+ * @param fields The result values
+ **/
+static void print_json(const std::string &name, bool supported, const ResultFields &fields) {
+  std::ostringstream object;
+  object.precision(15);
+  object << (json_results++ != 0 ? ",\n" : "") << "    {\"name\": " << json_string(name)
+         << ", \"supported\": " << (supported ? "true" : "false");
+  for(const auto &field : fields) {
+    object << ", " << json_string(field.first) << ": " << field.second;
+  }
+  object << "}";
+  std::cout << object.str();
+}
+
+/**
+ * Print named values of a benchmark.
+ *
+ * @param name The benchmark name
+ * @param fields The values
+ **/
+static void report_fields(const std::string &name, const ResultFields &fields) {
+  if (json_output) {
+    print_json(name, true, fields);
+    return;
+  }
+  std::cout << name << ":";
+  for(size_t i = 0; i < fields.size(); i++) {
+    std::cout << (i != 0 ? ", " : " ") << fields[i].second << " " << fields[i].first;
+  }
+  std::cout << "\n";
+}
+
+/**
+ * Print an unsupported benchmark.
+ *
+ * @param name The benchmark name
+ * @param reason The reason, or @c NULL
+ **/
+static void report_unsupported(const std::string &name, const char *reason = NULL) {
+  if (json_output) {
+    print_json(name, false, ResultFields());
+    return;
+  }
+  std::cout << name << ": not supported";
+  if (reason != NULL) {
+    std::cout << " (" << reason << ")";
+  }
+  std::cout << "\n";
+}
+
+/**
+ * Print a benchmark result line.
+ *
+ * @param name The benchmark name
+ * @param bytes The number of bytes processed
+ * @param items The number of items processed
+ * @param ns The elapsed time, in nanoseconds
+ * @param extra Additional values
+ **/
+static void report(const std::string &name, size_t bytes, size_t items, uint64_t ns,
+                   const ResultFields &extra = ResultFields()) {
+  const double seconds = ns != 0 ? ns / 1e9 : 1e-9;
+  if (json_output) {
+    ResultFields fields = {
+      { "items", items },
+      { "bytes", bytes },
+      { "ns", ns },
+      { "mb_per_s", bytes / seconds / 1e6 },
+      { "items_per_s", items / seconds },
+    };
+    fields.insert(fields.end(), extra.begin(), extra.end());
+    print_json(name, true, fields);
+    return;
+  }
+  std::cout << name << ": " << items << " items, " << bytes << " bytes, "
+            << (ns / 1000) << "us, "
+            << static_cast<uint64_t>(bytes / seconds / 1e6) << " MB/s, "
+            << static_cast<uint64_t>(items / seconds) << " items/s";
+  for(const auto &field : extra) {
+    std::cout << ", " << field.second << " " << field.first;
+  }
+  std::cout << "\n";
+}
+
+/**
+ * Run a benchmark function several times, and keep the best time.
+ *
+ * @param iterations The number of iterations
+ * @param fun The function, returning a checksum
+ * @param checksum The checksum of the last iteration
+ * @return The best time, in nanoseconds
+ **/
+template<typename Function>
+static uint64_t best_of(unsigned iterations, Function fun, uint64_t &checksum) {
+  uint64_t best = 0;
+  checksum = 0;
+  for(unsigned i = 0; i < iterations; i++) {
+    ChronoTimer timer;
+    checksum = fun();
+    const uint64_t elapsed = timer.tick_ns();
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+/**
+ * Tokenizer benchmark:
+ * - line scanning only, for each available scanning implementation
+ * - line scanning then query hashing (two passes), vs. fused scanning and hashing
+ * - full records tokenizing with WhyRequest::get_record
+ **/
+static int bench_tokenize(const char *filename, unsigned iterations) {
+  MappedRecords<WhyRequest> records(filename);
+  if (!records.is_valid()) {
+    std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+    return EXIT_FAILURE;
+  }
+  const unsigned char *const begin = records.get_data();
+  const unsigned char *const end = begin + records.get_size();
+  uint64_t checksum;
+  size_t lines = 0;
+
+  const enum simd_scan_impl impls[] = { simd_scan_scalar, simd_scan_sse2, simd_scan_avx2 };
+  for(const enum simd_scan_impl impl : impls) {
+    if (!simd_scan_select(impl)) {
+      report_unsupported(std::string("scan/") + simd_scan_name(impl));
+      continue;
+    }
+    const uint64_t ns = best_of(iterations, [begin, end]() {
+        uint64_t count = 0;
+        for(const unsigned char *p = begin; p != end; count++) {
+          p = simd_find_byte(p, end, '\n');
+          p += p != end;
+        }
+        return count;
+      }, checksum);
+    lines = checksum;
+    report(std::string("scan/") + simd_scan_name(impl), records.get_size(), lines, ns);
+  }
+  simd_scan_select(simd_scan_avx2) || simd_scan_select(simd_scan_sse2);
+
+  // Scanning, then hashing: each line is read twice
+  uint64_t reference;
+  uint64_t ns = best_of(iterations, [begin, end]() {
+      uint64_t sum = 0;
+      for(const unsigned char *p = begin; p != end; ) {
+        const unsigned char *const found = simd_find_byte(p, end, '\n');
+        sum += rxhash(p, found - p);
+        p = found + (found != end);
+      }
+      return sum;
+    }, reference);
+  report("tokenize/two-pass", records.get_size(), lines, ns);
+
+  // Fused scanning and hashing
+  ns = best_of(iterations, [begin, end]() {
+      uint64_t sum = 0;
+      for(const unsigned char *p = begin; p != end; ) {
+        uint64_t hash;
+        const unsigned char *const found = simd_find_byte_rxhash(p, end, '\n', hash);
+        sum += hash;
+        p = found + (found != end);
+      }
+      return sum;
+    }, checksum);
+  if (checksum != reference) {
+    std::cerr << "tokenize/fused: checksum mismatch\n";
+    return EXIT_FAILURE;
+  }
+  report("tokenize/fused", records.get_size(), lines, ns);
+
+  // Full records
+  ns = best_of(iterations, [&records]() {
+      uint64_t sum = 0;
+      for(const auto &record : records.begin()) {
+        sum += record.get_raw_query().hash() + record.get_timestamp();
+      }
+      return sum;
+    }, checksum);
+  report("tokenize/get_record", records.get_size(), lines, ns);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Hash policy benchmark: throughput over all queries, 64-bit collisions and
+ * hashtable probe lengths over distinct queries.
+ **/
+template<typename Policy>
+static void bench_hash_policy(const std::vector<RefString> &queries, size_t bytes, unsigned iterations) {
+  const std::string name = std::string("hash/") + Policy::name();
+
+  uint64_t best = 0;
+  uint64_t checksum = 0;
+  for(unsigned i = 0; i < iterations; i++) {
+    ChronoTimer timer;
+    for(const RefString &query : queries) {
+      checksum += query.hash<Policy>();
+    }
+    const uint64_t elapsed = timer.tick_ns();
+    if (i == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  report(name, bytes, queries.size(), best);
+
+  // Distinct queries, through a table using this policy
+  RefStringUnorderedHashMap<unsigned, RefStringPolicyHash<Policy>> map;
+  for(const RefString &query : queries) {
+    map[query]++;
+  }
+
+  // Full 64-bit hash collisions between distinct queries
+  std::vector<uint64_t> hashes;
+  for(const auto element : map) {
+    hashes.push_back(element.first.template hash<Policy>());
+  }
+  std::sort(hashes.begin(), hashes.end());
+  const size_t collisions = hashes.size()
+    - (std::unique(hashes.begin(), hashes.end()) - hashes.begin());
+
+  // Probe lengths
+  std::vector<size_t> histogram;
+  map.get_probe_histogram(histogram);
+  size_t probes = 0;
+  for(size_t i = 0; i < histogram.size(); i++) {
+    probes += histogram[i]*(i + 1);
+  }
+
+  report_fields(name + "/table", {
+      { "distinct", map.size() },
+      { "collisions", collisions },
+      { "mean_probe_groups", map.size() != 0 ? static_cast<double>(probes) / map.size() : 0 },
+      { "max_probe_groups", histogram.size() },
+      { "checksum", checksum & 0xff },
+    });
+}
+
+/**
+ * Get the queries of all valid records.
+ *
+ * @param records The mapped records
+ * @param queries The queries to be filled
+ * @return The queries size, in bytes
+ **/
+static size_t get_queries(const MappedRecords<WhyRequest> &records, std::vector<RefString> &queries) {
+  size_t bytes = 0;
+  for(const auto &record : records.begin()) {
+    if (record.is_valid()) {
+      queries.push_back(record.get_raw_query());
+      bytes += queries.back().len;
+    }
+  }
+  return bytes;
+}
+
+/**
+ * Hash benchmark.
+ **/
+static int bench_hash(const char *filename, unsigned iterations) {
+  MappedRecords<WhyRequest> records(filename);
+  if (!records.is_valid()) {
+    std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+    return EXIT_FAILURE;
+  }
+
+  // The real queries distribution
+  std::vector<RefString> queries;
+  const size_t bytes = get_queries(records, queries);
+
+  bench_hash_policy<Fnv1aHashPolicy>(queries, bytes, iterations);
+  bench_hash_policy<RxHashPolicy>(queries, bytes, iterations);
+  if (!aes_hash_supported()) {
+    report_unsupported("hash/aes", "rxhash fallback");
+  }
+  bench_hash_policy<AesHashPolicy>(queries, bytes, iterations);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Drop the cached pages of a file; best effort, as pages mapped or dirty
+ * elsewhere are kept.
+ *
+ * @return @c true upon success
+ **/
+static bool drop_cache(const char *filename) {
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return false;
+  }
+  const bool success = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(fd);
+  return success;
+}
+
+/**
+ * Map a file with a given policy, and scan all its records.
+ *
+ * @return The checksum of the records, or 0 if the policy is not supported
+ **/
+static uint64_t scan_mapped(const char *filename, enum map_policy policy) {
+  MappedRecords<WhyRequest> records(filename);
+  if (!records.is_valid() || !records.set_policy(policy)) {
+    return 0;
+  }
+  uint64_t sum = 1;
+  for(const auto &record : records.begin()) {
+    sum += record.get_raw_query().hash() + record.get_timestamp();
+  }
+  return sum;
+}
+
+/**
+ * Mapping policies benchmark: the whole scan (mapping included), with a
+ * cold page cache (dropped before each iteration), then a warm one.
+ **/
+static int bench_mapping(const char *filename, unsigned iterations) {
+  size_t size;
+  size_t lines = 0;
+  {
+    MappedRecords<WhyRequest> records(filename);
+    if (!records.is_valid()) {
+      std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    size = records.get_size();
+    for(const auto &record : records.begin()) {
+      lines += record.is_valid();
+    }
+  }
+
+  const enum map_policy policies[] = { map_policy_default, map_policy_populate, map_policy_hugepage,
+                                       map_policy_willneed, map_policy_prefetch };
+  for(const enum map_policy policy : policies) {
+    const std::string name = std::string("mapping/") + ReadOnlyMemoryMap::get_policy_name(policy);
+    uint64_t reference = 0;
+    uint64_t cold = 0;
+    for(unsigned i = 0; i < iterations; i++) {
+      if (!drop_cache(filename)) {
+        std::cerr << "could not drop cached pages: " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+      }
+      ChronoTimer timer;
+      reference = scan_mapped(filename, policy);
+      const uint64_t elapsed = timer.tick_ns();
+      if (i == 0 || elapsed < cold) {
+        cold = elapsed;
+      }
+    }
+    if (reference == 0) {
+      report_unsupported(name);
+      continue;
+    }
+    report(name + "/cold", size, lines, cold);
+
+    uint64_t checksum;
+    const uint64_t warm = best_of(iterations, [filename, policy]() {
+        return scan_mapped(filename, policy);
+      }, checksum);
+    if (checksum != reference) {
+      std::cerr << name << ": checksum mismatch\n";
+      return EXIT_FAILURE;
+    }
+    report(name + "/warm", size, lines, warm);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Scan all the records of a file with a given read mode.
+ *
+ * @return The checksum of the records
+ **/
+static uint64_t scan_read(const char *filename, size_t size, enum read_mode mode) {
+  uint64_t sum = 1;
+  if (mode == read_mode_map) {
+    return scan_mapped(filename, map_policy_default);
+  }
+  const ChunkedRecords<WhyRequest> records(filename, 0, size, mode == read_mode_direct);
+  for(const auto &record : records) {
+    sum += record.get_raw_query().hash() + record.get_timestamp();
+  }
+  return sum;
+}
+
+/**
+ * Read modes benchmark: the whole scan, with a cold page cache (dropped
+ * before each iteration), then a warm one; O_DIRECT reads never use the cache.
+ **/
+static int bench_read(const char *filename, unsigned iterations) {
+  size_t size;
+  size_t lines = 0;
+  {
+    MappedRecords<WhyRequest> records(filename);
+    if (!records.is_valid()) {
+      std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    size = records.get_size();
+    for(const auto &record : records.begin()) {
+      lines += record.is_valid();
+    }
+  }
+
+  const uint64_t reference = scan_read(filename, size, read_mode_map);
+  const enum read_mode modes[] = { read_mode_map, read_mode_pread, read_mode_direct };
+  for(const enum read_mode mode : modes) {
+    const std::string name = std::string("read/") + ChunkedReader::get_read_mode_name(mode);
+    if (mode == read_mode_direct && !ChunkedReader::is_direct_supported(filename)) {
+      report_unsupported(name, strerror(errno));
+      continue;
+    }
+    uint64_t checksum = 0;
+    uint64_t cold = 0;
+    for(unsigned i = 0; i < iterations; i++) {
+      if (!drop_cache(filename)) {
+        std::cerr << "could not drop cached pages: " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+      }
+      ChronoTimer timer;
+      checksum = scan_read(filename, size, mode);
+      const uint64_t elapsed = timer.tick_ns();
+      if (i == 0 || elapsed < cold) {
+        cold = elapsed;
+      }
+    }
+    if (checksum != reference) {
+      std::cerr << name << ": checksum mismatch\n";
+      return EXIT_FAILURE;
+    }
+    report(name + "/cold", size, lines, cold);
+
+    const uint64_t warm = best_of(iterations, [filename, size, mode]() {
+        return scan_read(filename, size, mode);
+      }, checksum);
+    report(name + "/warm", size, lines, warm);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Hashtable insertion benchmark: one query at a time (lookup, then
+ * insertion), and by batches, with prefetched slots (as when scanning).
+ **/
+static int bench_insert(const char *filename, unsigned iterations) {
+  MappedRecords<WhyRequest> records(filename);
+  if (!records.is_valid()) {
+    std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+    return EXIT_FAILURE;
+  }
+  std::vector<RefString> queries;
+  const size_t bytes = get_queries(records, queries);
+
+  uint64_t distinct;
+  uint64_t ns = best_of(iterations, [&queries]() {
+      RefStringUnorderedHashMap<unsigned> map;
+      for(const RefString &query : queries) {
+        map[query]++;
+      }
+      return static_cast<uint64_t>(map.size());
+    }, distinct);
+  report("insert/single", bytes, queries.size(), ns, { { "distinct", distinct } });
+
+  // The tables are accounted, to report their peak footprint (the old and
+  // the new tables coexist while growing)
+  uint64_t checksum;
+  size_t peak = 0;
+  ns = best_of(iterations, [&queries, &peak]() {
+      MemoryAccount account;
+      RefStringUnorderedHashMap<unsigned> map(&account);
+      for(size_t i = 0; i < queries.size(); i += INSERT_BATCH) {
+        map.add_batch(&queries[i], std::min<size_t>(INSERT_BATCH, queries.size() - i));
+      }
+      peak = account.get_peak();
+      return static_cast<uint64_t>(map.size());
+    }, checksum);
+  if (checksum != distinct) {
+    std::cerr << "insert/batch: checksum mismatch\n";
+    return EXIT_FAILURE;
+  }
+  report("insert/batch", bytes, queries.size(), ns, { { "distinct", distinct }, { "peak_kb", peak >> 10 },
+        { "bytes_per_query", distinct != 0 ? static_cast<double>(peak) / distinct : 0 } });
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Top-k selection benchmark, over the distinct queries of the file.
+ **/
+static int bench_topk(const char *filename, unsigned iterations) {
+  MappedRecords<WhyRequest> records(filename);
+  if (!records.is_valid()) {
+    std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+    return EXIT_FAILURE;
+  }
+  std::vector<RefString> queries;
+  get_queries(records, queries);
+  RefStringUnorderedHashMap<unsigned> map;
+  for(size_t i = 0; i < queries.size(); i += INSERT_BATCH) {
+    map.add_batch(&queries[i], std::min<size_t>(INSERT_BATCH, queries.size() - i));
+  }
+
+  const size_t counts[] = { 10, 100, 1000, 10000 };
+  for(const size_t k : counts) {
+    uint64_t checksum;
+    const uint64_t ns = best_of(iterations, [&map, k]() {
+        uint64_t sum = 0;
+        for(const auto &element : YParser::get_top_queries(map, k)) {
+          sum += element.second;
+        }
+        return sum;
+      }, checksum);
+    report("topk/" + std::to_string(k), 0, map.size(), ns, { { "checksum", checksum } });
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Locate benchmark: random timestamps (with a fixed seed), looked up by
+ * binary search over the mapping, and through a timestamp index.
+ **/
+static int bench_locate(const char *filename, unsigned iterations) {
+  MappedRecords<WhyRequest> records(filename);
+  struct stat st;
+  if (!records.is_valid() || !records.get_stat(st)) {
+    std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+    return EXIT_FAILURE;
+  }
+
+  // Timestamps span
+  time_t first = std::numeric_limits<time_t>::max();
+  time_t last = 0;
+  for(const auto &record : records.begin()) {
+    if (record.is_valid()) {
+      first = std::min(first, record.get_timestamp());
+      last = std::max(last, record.get_timestamp());
+    }
+  }
+  if (first > last) {
+    std::cerr << "no valid records\n";
+    return EXIT_FAILURE;
+  }
+  SynthRandom random(SYNTH_DEFAULT_SEED);
+  std::vector<time_t> stamps(LOCATE_LOOKUPS);
+  for(time_t &stamp : stamps) {
+    stamp = first + static_cast<time_t>(random.below(last - first + 1));
+  }
+
+  uint64_t checksum;
+  uint64_t ns = best_of(iterations, [&records, &stamps]() {
+      uint64_t sum = 0;
+      for(const time_t stamp : stamps) {
+        sum += records.locate(WhyRequest(stamp)).get_offset();
+      }
+      return sum;
+    }, checksum);
+  report("locate/binary", 0, stamps.size(), ns);
+
+  ChronoTimer timer;
+  TimestampIndex index;
+  index.build(records, st);
+  report("locate/index-build", records.get_size(), index.get_blocks(), timer.tick_ns());
+
+  ns = best_of(iterations, [&index, &stamps]() {
+      uint64_t sum = 0;
+      for(const time_t stamp : stamps) {
+        size_t begin;
+        size_t end;
+        index.locate(stamp, stamp, begin, end);
+        sum += begin;
+      }
+      return sum;
+    }, checksum);
+  report("locate/index", 0, stamps.size(), ns);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * End-to-end benchmark: distinct and top queries through the parser, over
+ * the whole file and over its middle third, without sidecars, with one
+ * thread, and with one per CPU.
+ **/
+static int bench_run(const char *filename, unsigned iterations) {
+  size_t size;
+  size_t lines = 0;
+  time_t first = std::numeric_limits<time_t>::max();
+  time_t last = 0;
+  {
+    MappedRecords<WhyRequest> records(filename);
+    if (!records.is_valid()) {
+      std::cerr << "could not map file: " << strerror(records.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    size = records.get_size();
+    for(const auto &record : records.begin()) {
+      if (record.is_valid()) {
+        lines++;
+        first = std::min(first, record.get_timestamp());
+        last = std::max(last, record.get_timestamp());
+      }
+    }
+  }
+  const time_t from = first + (last - first) / 3;
+  const time_t to = from + (last - first) / 3;
+  size_t range_lines = 0;
+  {
+    MappedRecords<WhyRequest> records(filename);
+    for(const auto &record : records.begin()) {
+      range_lines += record.is_valid() && record.get_timestamp() >= from && record.get_timestamp() <= to;
+    }
+  }
+
+  const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+  const unsigned thread_counts[] = { 1, cpus };
+  for(size_t i = 0; i < (cpus > 1 ? 2u : 1u); i++) {
+    const unsigned threads = thread_counts[i];
+    for(const bool ranged : { false, true }) {
+      for(const bool top : { false, true }) {
+        const std::string name = std::string("run/") + (top ? "top10" : "distinct") + (ranged ? "/range" : "")
+          + "/threads=" + std::to_string(threads);
+        uint64_t checksum;
+        const uint64_t ns = best_of(iterations, [&]() {
+            YParser parser(filename);
+            parser.set_index(false);
+            parser.set_rollup(false);
+            parser.set_threads(threads);
+            if (ranged) {
+              parser.set_start(from);
+              parser.set_end(to);
+            }
+            parser.parse_records();
+            if (!top) {
+              return static_cast<uint64_t>(parser.get_distinct_queries());
+            }
+            uint64_t sum = 0;
+            for(const auto &element : parser.get_top_queries(10)) {
+              sum += element.second;
+            }
+            return sum;
+          }, checksum);
+        report(name, ranged ? 0 : size, ranged ? range_lines : lines, ns, { { "checksum", checksum } });
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Generate synthetic logs.
+ **/
+static int generate(const char *filename, const SynthLogSettings &settings) {
+  ChronoTimer timer;
+  SynthLogGenerator generator(settings);
+  if (!generator.write(filename)) {
+    std::cerr << "could not write " << filename << ": " << strerror(generator.get_error()) << "\n";
+    return EXIT_FAILURE;
+  }
+  report("generate", settings.size, generator.get_records(), timer.tick_ns(), {
+      { "queries", settings.queries },
+      { "skew", settings.skew },
+      { "min_length", settings.min_length },
+      { "max_length", settings.max_length },
+      { "rate", settings.rate },
+      { "jitter", settings.jitter },
+      { "seed", settings.seed },
+    });
+  return EXIT_SUCCESS;
+}
+
+/** main(). **/
+int main(int argc, char **argv) {
+  std::vector<const char*> tokens;
+  unsigned iterations = DEFAULT_ITERATIONS;
+  SynthLogSettings settings;
+
+  // Parse args with getopt
+  int c;
+  int index;
+  while ((c = getopt_long(argc, argv, "-h", long_options, &index)) != -1) {
+    double value;
+    switch (c) {
+    case 'h':
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+
+    case 'n':
+      iterations = static_cast<unsigned>(atoi(optarg));
+      if (iterations == 0) {
+        std::cerr << "bad iterations value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'j':
+      json_output = true;
+      break;
+
+    case 's':
+      settings.size = parse_size(optarg);
+      if (settings.size == 0) {
+        std::cerr << "bad size value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'q':
+      if (!parse_number(optarg, value) || value < 1) {
+        std::cerr << "bad queries value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      settings.queries = static_cast<size_t>(value);
+      break;
+
+    case 'k':
+      if (!parse_number(optarg, settings.skew)) {
+        std::cerr << "bad skew value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'l':
+      {
+        unsigned min_length;
+        unsigned max_length;
+        char end;
+        if (sscanf(optarg, "%u:%u%c", &min_length, &max_length, &end) != 2
+            || min_length == 0 || min_length > max_length) {
+          std::cerr << "bad length range: " << optarg << "\n";
+          return EXIT_FAILURE;
+        }
+        settings.min_length = min_length;
+        settings.max_length = max_length;
+      }
+      break;
+
+    case 'r':
+      if (!parse_number(optarg, value) || value < 1) {
+        std::cerr << "bad rate value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      settings.rate = static_cast<unsigned>(value);
+      break;
+
+    case 't':
+      if (!parse_number(optarg, value)) {
+        std::cerr << "bad jitter value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      settings.jitter = static_cast<time_t>(value);
+      break;
+
+    case 'e':
+      if (!parse_number(optarg, value)) {
+        std::cerr << "bad seed value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      settings.seed = static_cast<uint64_t>(value);
+      break;
+
+    case GETOPT_NON_OPTION_TYPE:
+      assert(optarg != NULL);
+      tokens.push_back(optarg);
+      break;
+
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (tokens.size() < 2) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *mode = tokens[0];
+  const char *filename = tokens[1];
+  if (tokens.size() > 2) {
+    iterations = static_cast<unsigned>(atoi(tokens[2]));
+    if (iterations == 0) {
+      std::cerr << "bad iterations value: " << tokens[2] << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Benchmarks of a mode
+  typedef int (*Benchmark)(const char *filename, unsigned iterations);
+  static const std::pair<const char*, Benchmark> benchmarks[] = {
+    { "tokenize", bench_tokenize },
+    { "hash", bench_hash },
+    { "insert", bench_insert },
+    { "topk", bench_topk },
+    { "locate", bench_locate },
+    { "run", bench_run },
+    { "mapping", bench_mapping },
+    { "read", bench_read },
+  };
+  const bool all = strcasecmp(mode, "all") == 0;
+  const bool generating = strcasecmp(mode, "generate") == 0;
+  std::vector<Benchmark> selected;
+  for(const auto &benchmark : benchmarks) {
+    if (all || strcasecmp(mode, benchmark.first) == 0) {
+      selected.push_back(benchmark.second);
+    }
+  }
+  if (selected.empty() && !generating) {
+    std::cerr << "invalid mode '" << mode << "'\n";
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (json_output) {
+    std::cout << "{\n  \"version\": " << json_string(VERSION)
+              << ",\n  \"mode\": " << json_string(mode)
+              << ",\n  \"file\": " << json_string(filename)
+              << ",\n  \"iterations\": " << iterations
+              << ",\n  \"results\": [\n";
+  }
+  int status = EXIT_SUCCESS;
+  if (generating) {
+    status = generate(filename, settings);
+  }
+  for(size_t i = 0; i < selected.size() && status == EXIT_SUCCESS; i++) {
+    status = selected[i](filename, iterations);
+  }
+  if (json_output) {
+    std::cout << "\n  ],\n  \"success\": " << (status == EXIT_SUCCESS ? "true" : "false") << "\n}\n";
+  }
+  return status;
+}
@@ -0,0 +1,207 @@
+/**
+ * Query canonicalization.
+ * Vectorized URL-decoding and case folding of queries into a reusable scratch buffer
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <string.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "canonical.hpp"
+
+/**
+ * Hexadecimal digit value, or -1.
+ **/
+static inline int hex_digit(unsigned char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * Fold an ASCII uppercase letter.
+ **/
+static inline unsigned char fold(unsigned char c, bool casefold) {
+  return casefold && c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+}
+
+#ifdef __SSE2__
+
+/**
+ * Bitmask of the bytes of a block to be rewritten: escapes (when decoding),
+ * and ASCII uppercase letters (when folding).
+ **/
+static inline unsigned block_special(__m128i block, bool decode, bool casefold, __m128i &upper) {
+  __m128i special = _mm_setzero_si128();
+  if (decode) {
+    special = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('%')),
+                           _mm_cmpeq_epi8(block, _mm_set1_epi8('+')));
+  }
+  if (casefold) {
+    // Signed comparisons: bytes above 0x7f are negative, and never folded
+    upper = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)),
+                          _mm_cmplt_epi8(block, _mm_set1_epi8('Z' + 1)));
+  } else {
+    upper = _mm_setzero_si128();
+  }
+  return static_cast<unsigned>(_mm_movemask_epi8(special));
+}
+
+#endif
+
+const unsigned char* canonical_find(const unsigned char *begin, const unsigned char *end, unsigned flags) {
+  const bool decode = (flags & canonical_decode) != 0;
+  const bool casefold = (flags & canonical_casefold) != 0;
+#ifdef __SSE2__
+  for(; end - begin >= 16; begin += 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    __m128i upper;
+    const unsigned mask = block_special(block, decode, casefold, upper)
+      | static_cast<unsigned>(_mm_movemask_epi8(upper));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for(; begin != end; begin++) {
+    const unsigned char c = *begin;
+    if ((decode && (c == '%' || c == '+')) || fold(c, casefold) != c) {
+      break;
+    }
+  }
+  return begin;
+}
+
+/**
+ * Does a decoded query still hold a valid (non-null) escape ?
+ **/
+static bool has_escape(const unsigned char *src, size_t len) {
+  for(const unsigned char *p = src, *const end = src + len;
+      (p = static_cast<const unsigned char*>(memchr(p, '%', end - p))) != NULL; p++) {
+    if (end - p >= 3 && hex_digit(p[1]) != -1 && hex_digit(p[2]) != -1 && (p[1] != '0' || p[2] != '0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * A single canonicalization pass.
+ *
+ * @param first If @c true, the pass decodes '+' and drops invalid escapes;
+ *        otherwise, only valid escapes revealed by a previous pass are decoded,
+ *        other bytes being literal ones
+ * @return The canonical length
+ **/
+static size_t canonicalize_pass(const unsigned char *src, size_t len, unsigned char *dst, unsigned flags, bool first) {
+  const bool decode = (flags & canonical_decode) != 0;
+  const bool casefold = (flags & canonical_casefold) != 0;
+  const unsigned char *p = src;
+  const unsigned char *const end = src + len;
+  unsigned char *out = dst;
+  while(p != end) {
+#ifdef __SSE2__
+    // Blocks free of escapes are copied (and folded) at once; when
+    // rewriting in place, a block is loaded before being stored, and the
+    // output never gets ahead of the input
+    for(; end - p >= 16; p += 16, out += 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i upper;
+      if (block_special(block, decode, casefold, upper) != 0) {
+        break;
+      }
+      block = _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+    }
+    if (p == end) {
+      break;
+    }
+#endif
+
+    // Bytes are then rewritten one by one, until the next block boundary
+    const unsigned char *const stop = end - p > 16 ? p + 16 : end;
+    while(p < stop) {
+      const unsigned char c = *p++;
+      if (decode && first && c == '+') {
+        *out++ = ' ';
+      } else if (decode && c == '%') {
+        // Expecting two hexadecimal digits; invalid escapes and \0 are
+        // dropped by the first pass, and kept as literal bytes afterwards
+        const int high = p != end ? hex_digit(*p) : -1;
+        const int low = end - p >= 2 ? hex_digit(p[1]) : -1;
+        const bool valid = high != -1 && low != -1 && (high != 0 || low != 0);
+        if (valid) {
+          *out++ = fold(static_cast<unsigned char>(high*16 + low), casefold);
+          p += 2;
+        } else if (first) {
+          p += end - p >= 2 ? 2 : end - p;
+        } else {
+          *out++ = c;
+        }
+      } else {
+        *out++ = fold(c, casefold);
+      }
+    }
+  }
+  return out - dst;
+}
+
+size_t canonicalize(const unsigned char *src, size_t len, unsigned char *dst, unsigned flags) {
+  len = canonicalize_pass(src, len, dst, flags, true);
+
+  // Decoded escapes may reveal other valid escapes ("%2520" is "%20", then
+  // " "); literal percent signs ("50%25" is "50%") are kept
+  while((flags & canonical_decode) != 0 && has_escape(dst, len)) {
+    len = canonicalize_pass(dst, len, dst, flags, false);
+  }
+  return len;
+}
+
+Canonicalizer::Canonicalizer(unsigned flags, size_t capacity): flags(flags), scratch(capacity), used(0)
+{
+}
+
+bool Canonicalizer::get(const RefString &key, RefString &canonical) {
+  const unsigned char *const begin = reinterpret_cast<const unsigned char*>(key.str);
+  const unsigned char *const end = begin + key.len;
+  const unsigned char *const first = (flags & (canonical_decode | canonical_casefold)) != 0
+    ? canonical_find(begin, end, flags) : end;
+  if (first == end && (flags & canonical_transient) == 0) {
+    canonical = key;
+    return true;
+  }
+
+  // Room for the whole query (canonicalization never grows it)
+  if (key.len > scratch.size() - used) {
+    if (used != 0) {
+      return false;
+    }
+    scratch.resize(key.len);
+  }
+
+  // The canonical prefix is copied as is
+  unsigned char *const dst = &scratch[used];
+  const size_t prefix = first - begin;
+  memcpy(dst, begin, prefix);
+  if (first == end) {
+    // Copied as is: the hash is kept
+    canonical = RefString(reinterpret_cast<const char*>(dst), key.len, key.hash());
+    used += key.len;
+    return true;
+  }
+  const size_t len = prefix + canonicalize(first, end - first, dst + prefix, flags);
+  canonical = RefString(reinterpret_cast<const char*>(dst), len);
+  used += len;
+  return true;
+}
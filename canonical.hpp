@@ -0,0 +1,107 @@
+/**
+ * Query canonicalization.
+ * Vectorized URL-decoding and case folding of queries into a reusable scratch buffer
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_CANONICAL_HPP
+#define RX_CANONICAL_HPP
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "refstringmap.hpp"
+
+// Default scratch buffer size of a canonicalizer
+#define CANONICAL_SCRATCH_SIZE ((size_t) 64 << 10)
+
+/**
+ * Canonicalization flags.
+ **/
+enum canonical_flags {
+  // URL-decoding (RFC 3986, '+' being a space), repeated until stable, so
+  // that double-encoded queries are merged with their plain form
+  canonical_decode = 1,
+
+  // ASCII case folding
+  canonical_casefold = 2,
+
+  // Queries referencing transient (recycled) buffers: always copied into the
+  // scratch buffer, so that they remain valid until the batch is consumed
+  canonical_transient = 4,
+};
+
+/**
+ * Find the first byte of a query which is not canonical, 16 bytes at a time.
+ *
+ * @param begin The beginning of the query
+ * @param end The end of the query (exclusive)
+ * @param flags The canonicalization flags
+ * @return The position of the first byte to be rewritten, or @c end if the query is canonical
+ **/
+const unsigned char* canonical_find(const unsigned char *begin, const unsigned char *end, unsigned flags);
+
+/**
+ * Canonicalize a query. Runs free of escapes are copied (and folded) 16
+ * bytes at a time; escapes are decoded one by one, as by WhyRequest::get_query.
+ *
+ * @param src The query
+ * @param len The query length
+ * @param dst The destination, of at least @c len bytes (may be @c src)
+ * @param flags The canonicalization flags
+ * @return The canonical length (at most @c len)
+ **/
+size_t canonicalize(const unsigned char *src, size_t len, unsigned char *dst, unsigned flags);
+
+/**
+ * Canonicalizer of a batch of queries: rewritten queries are written to a
+ * scratch buffer, reused once the batch is consumed, so that no allocation
+ * is done per record. Queries which are already canonical are returned as is.
+ **/
+class Canonicalizer {
+public:
+  /**
+   * Constructor.
+   *
+   * @param flags The canonicalization flags
+   * @param capacity The scratch buffer size (grown for longer queries)
+   **/
+  explicit Canonicalizer(unsigned flags, size_t capacity = CANONICAL_SCRATCH_SIZE);
+
+  /**
+   * Get the canonical form of a query.
+   *
+   * @param key The query
+   * @param canonical The canonical query, valid until @c reset if rewritten
+   * @return @c false if the scratch buffer is full: the batch must be consumed, and @c reset called
+   **/
+  bool get(const RefString &key, RefString &canonical);
+
+  /**
+   * Was a canonical query rewritten in the scratch buffer ?
+   **/
+  bool is_rewritten(const RefString &canonical) const {
+    const unsigned char *const str = reinterpret_cast<const unsigned char*>(canonical.str);
+    return !scratch.empty() && str >= &scratch[0] && str < &scratch[0] + scratch.size();
+  }
+
+  /**
+   * Reuse the scratch buffer, once the batch of canonical queries was consumed.
+   **/
+  void reset() {
+    used = 0;
+  }
+
+protected:
+  // Canonicalization flags
+  unsigned flags;
+
+  // Scratch buffer, and its used bytes
+  std::vector<unsigned char> scratch;
+  size_t used;
+};
+
+#endif
@@ -0,0 +1,264 @@
+/**
+ * Chunked file reader.
+ * Bounded-memory reading of a file range with large aligned reads (optionally O_DIRECT), and its records
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "chunkreader.hpp"
+
+/**
+ * Round up to the alignment.
+ **/
+static inline size_t align_up(size_t size) {
+  return (size + CHUNK_ALIGN - 1) / CHUNK_ALIGN*CHUNK_ALIGN;
+}
+
+/**
+ * Allocate aligned memory; failures are fatal.
+ **/
+static unsigned char* allocate(size_t size) {
+  void *memory = NULL;
+  if (posix_memalign(&memory, CHUNK_ALIGN, size) != 0) {
+    std::cerr << "could not allocate read buffer\n";
+    abort();
+  }
+  return static_cast<unsigned char*>(memory);
+}
+
+ChunkedReader::ChunkedReader(const char *filename, size_t offset, size_t end, bool direct, size_t drop,
+                             size_t buffers, size_t size):
+  fd(open(filename, O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0), 0)),
+  offset(offset),
+  end(end),
+  size(align_up(size != 0 ? size : CHUNK_ALIGN)),
+  drop(direct ? 0 : drop),
+  buffers(buffers < 2 ? 2 : buffers),
+  free_buffers(),
+  filled_buffers(),
+  held(this->buffers.size()),
+  lock(),
+  cond(),
+  finished(false),
+  stopped(false),
+  worker()
+{
+  assert(offset <= end);
+  if (fd == -1) {
+    perror("unexpected open error");
+    abort();
+  }
+  if (!direct) {
+    posix_fadvise(fd, offset, end - offset, POSIX_FADV_SEQUENTIAL);
+  }
+
+  for(size_t i = 0; i < this->buffers.size(); i++) {
+    Buffer &buffer = this->buffers[i];
+    buffer.carry_size = CHUNK_ALIGN;
+    buffer.memory = allocate(buffer.carry_size + this->size);
+    buffer.start = buffer.length = 0;
+    free_buffers.push_back(i);
+  }
+
+  worker = std::thread([this]() {
+      read_chunks();
+    });
+}
+
+ChunkedReader::~ChunkedReader() {
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    stopped = true;
+  }
+  cond.notify_all();
+  worker.join();
+
+  for(const Buffer &buffer : buffers) {
+    free(buffer.memory);
+  }
+  if (close(fd) != 0) {
+    perror("unexpected close error");
+    abort();
+  }
+}
+
+bool ChunkedReader::acquire_free(size_t &index) {
+  std::unique_lock<std::mutex> guard(lock);
+  cond.wait(guard, [this]() {
+      return !free_buffers.empty() || stopped;
+    });
+  if (stopped) {
+    return false;
+  }
+  index = free_buffers.front();
+  free_buffers.pop_front();
+  return true;
+}
+
+void ChunkedReader::release(size_t index) {
+  std::unique_lock<std::mutex> guard(lock);
+  free_buffers.push_back(index);
+}
+
+void ChunkedReader::publish(size_t index, size_t start, size_t length) {
+  std::unique_lock<std::mutex> guard(lock);
+  buffers[index].start = start;
+  buffers[index].length = length;
+  filled_buffers.push_back(index);
+  cond.notify_all();
+}
+
+void ChunkedReader::reserve_carry(Buffer &buffer, size_t carry) {
+  if (carry > buffer.carry_size) {
+    free(buffer.memory);
+    buffer.carry_size = align_up(carry*2);
+    buffer.memory = allocate(buffer.carry_size + size);
+  }
+}
+
+void ChunkedReader::read_chunks() {
+  // Reads start on an aligned position; the bytes before the range are skipped
+  size_t position = offset / CHUNK_ALIGN*CHUNK_ALIGN;
+  size_t skip = offset - position;
+  size_t carry = 0;
+  size_t dropped = position;
+  size_t current;
+  if (!acquire_free(current)) {
+    return;
+  }
+
+  for(;;) {
+    // Read the next chunk after the carried-over bytes
+    Buffer &buffer = buffers[current];
+    unsigned char *const area = buffer.memory + buffer.carry_size;
+    const size_t want = position < end ? std::min(size, align_up(end - position)) : 0;
+    ssize_t length = 0;
+    if (want != 0) {
+      do {
+        length = pread(fd, area, want, position);
+      } while(length == -1 && errno == EINTR);
+      if (length == -1) {
+        perror("unexpected read error");
+        abort();
+      }
+    }
+    size_t available = static_cast<size_t>(length);
+    if (available > end - position) {
+      available = end - position;
+    }
+    position += static_cast<size_t>(length);
+
+    // Read bytes are copied: drop them from the page cache
+    if (drop != 0 && (position - dropped >= drop || static_cast<size_t>(length) < want || position >= end)) {
+      posix_fadvise(fd, dropped, position - dropped, POSIX_FADV_DONTNEED);
+      dropped = position;
+    }
+
+    // The span holds the carried-over bytes, and the bytes read within the range
+    size_t first = buffer.carry_size - carry;
+    const size_t last = buffer.carry_size + available;
+    if (skip != 0) {
+      const size_t skipped = std::min(skip, available);
+      first += skipped;
+      skip -= skipped;
+    }
+
+    // End of range (or of file): the last line may lack its line feed
+    if (static_cast<size_t>(length) < want || position >= end) {
+      if (last > first) {
+        publish(current, first, last - first);
+      } else {
+        release(current);
+      }
+      break;
+    }
+
+    // Carry the trailing partial line (or a line longer than the chunk) over to the next buffer
+    const unsigned char *const newline = static_cast<const unsigned char*>(memrchr(&buffer.memory[first], '\n', last - first));
+    const size_t complete = newline != NULL ? newline - buffer.memory + 1 : first;
+    size_t next;
+    if (!acquire_free(next)) {
+      return;
+    }
+    carry = last - complete;
+    reserve_carry(buffers[next], carry);
+    memcpy(buffers[next].memory + buffers[next].carry_size - carry, &buffer.memory[complete], carry);
+    if (complete > first) {
+      publish(current, first, complete - first);
+    } else {
+      release(current);
+    }
+    current = next;
+  }
+
+  std::unique_lock<std::mutex> guard(lock);
+  finished = true;
+  cond.notify_all();
+}
+
+bool ChunkedReader::next(unsigned char *&data, size_t &length) {
+  std::unique_lock<std::mutex> guard(lock);
+
+  // Give the previous span back
+  if (held != buffers.size()) {
+    free_buffers.push_back(held);
+    held = buffers.size();
+    cond.notify_all();
+  }
+
+  cond.wait(guard, [this]() {
+      return !filled_buffers.empty() || finished;
+    });
+  if (filled_buffers.empty()) {
+    return false;
+  }
+  held = filled_buffers.front();
+  filled_buffers.pop_front();
+  data = buffers[held].memory + buffers[held].start;
+  length = buffers[held].length;
+  return true;
+}
+
+bool ChunkedReader::is_direct_supported(const char *filename) {
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC | O_DIRECT, 0);
+  if (fd == -1) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+const char* ChunkedReader::get_read_mode_name(enum read_mode mode) {
+  switch(mode) {
+  case read_mode_map:
+    return "map";
+  case read_mode_pread:
+    return "pread";
+  case read_mode_direct:
+    return "direct";
+  }
+  return "unknown";
+}
+
+bool ChunkedReader::parse_read_mode(const char *name, enum read_mode &mode) {
+  const enum read_mode modes[] = { read_mode_map, read_mode_pread, read_mode_direct };
+  for(const enum read_mode candidate : modes) {
+    if (strcasecmp(name, get_read_mode_name(candidate)) == 0) {
+      mode = candidate;
+      return true;
+    }
+  }
+  return false;
+}
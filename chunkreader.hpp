@@ -0,0 +1,263 @@
+/**
+ * Chunked file reader.
+ * Bounded-memory reading of a file range with large aligned reads (optionally O_DIRECT), and its records
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_CHUNKREADER_HPP
+#define RX_CHUNKREADER_HPP
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Default number of buffers of the ring, and their size
+#define CHUNK_BUFFERS 4
+#define CHUNK_SIZE ((size_t) 4 << 20)
+
+// Alignment of reads, and of buffers (O_DIRECT requirement)
+#define CHUNK_ALIGN ((size_t) 4096)
+
+/**
+ * How records are read.
+ **/
+enum read_mode {
+  // From the mapping
+  read_mode_map,
+
+  // With pread(2) into a ring of buffers
+  read_mode_pread,
+
+  // With pread(2), bypassing the page cache (O_DIRECT)
+  read_mode_direct,
+};
+
+/**
+ * Reader of a range of a file (on line frontiers): a reader thread fills a
+ * small ring of aligned buffers with large aligned reads, carrying the
+ * partial line ending a buffer over to the next one, while the consumer
+ * gets the complete lines of filled buffers. The memory footprint is the
+ * ring, whatever the range size; with O_DIRECT, the page cache is not used.
+ * Read errors are fatal, as they would be with a mapping (SIGBUS).
+ **/
+class ChunkedReader {
+public:
+  /**
+   * Start reading a range.
+   *
+   * @param filename The file path
+   * @param offset The starting offset, on a line frontier
+   * @param end The ending offset (exclusive), on a line frontier (or the file size)
+   * @param direct If @c true, bypass the page cache (O_DIRECT)
+   * @param drop If not 0, read bytes are dropped from the page cache by windows of this size
+   * @param buffers The number of buffers of the ring (at least 2)
+   * @param size The read size (a multiple of CHUNK_ALIGN)
+   **/
+  ChunkedReader(const char *filename, size_t offset, size_t end, bool direct, size_t drop = 0,
+                size_t buffers = CHUNK_BUFFERS, size_t size = CHUNK_SIZE);
+
+  /**
+   * Destructor; stop the reader thread.
+   **/
+  ~ChunkedReader();
+
+  /**
+   * Get the next span of complete lines; the previous span is given back.
+   *
+   * @param data The span bytes, valid until the next call
+   * @param length The span length
+   * @return @c false at the end of the range
+   **/
+  bool next(unsigned char *&data, size_t &length);
+
+  /**
+   * Can a file be read bypassing the page cache (O_DIRECT) ?
+   *
+   * @param filename The file path
+   * @return @c true if supported; errno is set otherwise
+   **/
+  static bool is_direct_supported(const char *filename);
+
+  /**
+   * Get the name of a read mode.
+   **/
+  static const char* get_read_mode_name(enum read_mode mode);
+
+  /**
+   * Parse a read mode name.
+   *
+   * @param name The read mode name
+   * @param mode The mode to be filled
+   * @return @c true if the name is known
+   **/
+  static bool parse_read_mode(const char *name, enum read_mode &mode);
+
+protected:
+  /**
+   * Aligned buffer: a carry-over area, followed by the read area.
+   **/
+  struct Buffer {
+    // Aligned memory
+    unsigned char *memory;
+
+    // Size of the carry-over area (aligned)
+    size_t carry_size;
+
+    // Published span
+    size_t start;
+    size_t length;
+  };
+
+  /** Reader thread: fill buffers with complete lines. **/
+  void read_chunks();
+
+  /** Get a free buffer (reader side); returns @c false if the reader was stopped. **/
+  bool acquire_free(size_t &index);
+
+  /** Give a buffer back, unpublished (reader side). **/
+  void release(size_t index);
+
+  /** Publish a filled span (reader side). **/
+  void publish(size_t index, size_t start, size_t length);
+
+  /** Make room for a carry-over of a given size. **/
+  void reserve_carry(Buffer &buffer, size_t size);
+
+protected:
+  // File descriptor
+  int fd;
+
+  // Range
+  const size_t offset;
+  const size_t end;
+
+  // Read size
+  const size_t size;
+
+  // Page cache drop window (0: disabled)
+  const size_t drop;
+
+  // Ring buffers
+  std::vector<Buffer> buffers;
+
+  // Free, and filled buffers (in file order), and the buffer held by the consumer
+  std::deque<size_t> free_buffers;
+  std::deque<size_t> filled_buffers;
+  size_t held;
+
+  // Reader thread synchronization
+  std::mutex lock;
+  std::condition_variable cond;
+
+  // Reader end of range, and consumer end of scan
+  bool finished;
+  bool stopped;
+
+  // Reader thread
+  std::thread worker;
+
+private:
+  /* Forbidden foes */
+  ChunkedReader(const ChunkedReader&) = delete;
+  ChunkedReader& operator=(const ChunkedReader&) = delete;
+};
+
+/** Forward declaration **/
+template <typename T>
+class ChunkedIterator;
+
+/**
+ * Records of a file range read by a ChunkedReader; iterated once, with the
+ * same interface as RecordLocation<T>. Records reference recycled buffers,
+ * and are only valid until the next one.
+ **/
+template <typename T>
+class ChunkedRecords {
+public:
+  /**
+   * Create the records of a range (see ChunkedReader).
+   **/
+  ChunkedRecords(const char *filename, size_t offset, size_t end, bool direct, size_t drop = 0):
+    reader(offset < end ? new ChunkedReader(filename, offset, end, direct, drop) : NULL)
+  {
+  }
+
+  /** Standard iterator begin(); can only be called once. **/
+  ChunkedIterator<T> begin() const {
+    return ChunkedIterator<T>(reader.get());
+  }
+
+  /** Standard iterator end(). **/
+  ChunkedIterator<T> end() const {
+    return ChunkedIterator<T>(NULL);
+  }
+
+protected:
+  // The reader, if the range is not empty
+  std::unique_ptr<ChunkedReader> reader;
+};
+
+/**
+ * Records iterator of ChunkedRecords<T>.
+ **/
+template <typename T>
+class ChunkedIterator: public std::iterator<std::input_iterator_tag, T> {
+public:
+  explicit ChunkedIterator(ChunkedReader *reader): reader(reader), data(NULL), length(0), offset(0), done(reader == NULL) {
+    if (!done) {
+      ++(*this);
+    }
+  }
+
+  /** Standard iterator operator++. **/
+  ChunkedIterator& operator++() {
+    // Get the next span once the current one is consumed
+    while(offset == length) {
+      if (!reader->next(data, length)) {
+        done = true;
+        return *this;
+      }
+      offset = 0;
+    }
+    record.get_record(data, length, offset);
+    return *this;
+  }
+
+  /** Standard iterator operator!=. **/
+  bool operator != (const ChunkedIterator<T> &other) const {
+    return done != other.done;
+  }
+
+  /** Standard iterator operator*. **/
+  const T& operator * () const {
+    return record;
+  }
+
+protected:
+  // The reader (NULL for the end iterator)
+  ChunkedReader *const reader;
+
+  // Current span
+  unsigned char *data;
+  size_t length;
+
+  // Next offset within the span
+  size_t offset;
+
+  // End reached
+  bool done;
+
+  // Temporary object placeholder
+  T record;
+};
+
+#endif
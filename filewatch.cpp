@@ -0,0 +1,97 @@
+/**
+ * File watcher.
+ * Wait for a file to be modified, or replaced, using inotify
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/inotify.h>
+
+#include "filewatch.hpp"
+
+// Events of the file itself
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+// Events of the parent directory (a file created, or moved, at the path)
+#define DIRECTORY_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+FileWatcher::FileWatcher(const char *filename): filename(filename), fd(-1), file_watch(-1), directory_watch(-1), error(0)
+{
+  const size_t slash = this->filename.rfind('/');
+  directory = slash != std::string::npos ? this->filename.substr(0, slash + 1) : ".";
+  name = slash != std::string::npos ? this->filename.substr(slash + 1) : this->filename;
+
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd == -1) {
+    error = errno;
+    return;
+  }
+  directory_watch = inotify_add_watch(fd, directory.c_str(), DIRECTORY_EVENTS);
+  watch_file();
+  if (directory_watch == -1 && file_watch == -1) {
+    error = errno;
+    close(fd);
+    fd = -1;
+  }
+}
+
+FileWatcher::~FileWatcher() {
+  if (fd != -1 && close(fd) != 0) {
+    perror("unexpected close error");
+    abort();
+  }
+}
+
+void FileWatcher::watch_file() {
+  // Adding a watch on the same inode again returns the same descriptor
+  file_watch = inotify_add_watch(fd, filename.c_str(), FILE_EVENTS);
+}
+
+bool FileWatcher::wait(int timeout_ms) {
+  // Polling
+  if (fd == -1) {
+    usleep(static_cast<useconds_t>(timeout_ms)*1000);
+    return true;
+  }
+
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  const int ready = poll(&pfd, 1, timeout_ms);
+  if (ready <= 0) {
+    if (ready == -1 && errno != EINTR) {
+      error = errno;
+    }
+    return false;
+  }
+
+  // Drain events; only those about the file path matter
+  bool changed = false;
+  bool replaced = false;
+  char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t length;
+  while((length = read(fd, buffer, sizeof(buffer))) > 0) {
+    for(ssize_t offset = 0; offset < length; ) {
+      const struct inotify_event *const event = reinterpret_cast<const struct inotify_event*>(&buffer[offset]);
+      if (event->wd == file_watch) {
+        changed = true;
+        replaced = replaced || (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) != 0;
+      } else if (event->wd == directory_watch && event->len != 0 && name == event->name) {
+        changed = replaced = true;
+      }
+      offset += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  // Follow the new file at the path, if any
+  if (replaced) {
+    watch_file();
+  }
+
+  return changed;
+}
@@ -0,0 +1,80 @@
+/**
+ * File watcher.
+ * Wait for a file to be modified, or replaced, using inotify
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_FILEWATCH_HPP
+#define RX_FILEWATCH_HPP
+
+#include <string>
+
+/**
+ * Watch a file path for modifications (appended data), and replacement
+ * (rotation: the path is renamed, deleted, or created again). The parent
+ * directory is watched too, so that a new file created at the same path is
+ * noticed. If inotify is not available, @c wait simply sleeps (polling).
+ **/
+class FileWatcher {
+public:
+  /**
+   * Watch a file path.
+   *
+   * @param filename The file path
+   **/
+  explicit FileWatcher(const char *filename);
+
+  /**
+   * Destructor; release the inotify descriptor.
+   **/
+  ~FileWatcher();
+
+  /**
+   * Wait for the file to change.
+   *
+   * @param timeout_ms The maximum time to wait, in milliseconds
+   * @return @c true if a change was notified (always @c true when polling)
+   **/
+  bool wait(int timeout_ms);
+
+  /**
+   * Is inotify used (otherwise, @c wait is polling) ?
+   **/
+  bool is_valid() const {
+    return fd != -1;
+  }
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+protected:
+  /** (Re-)add the watch of the file itself. **/
+  void watch_file();
+
+protected:
+  // Watched path, its parent directory, and its name within
+  const std::string filename;
+  std::string directory;
+  std::string name;
+
+  // inotify descriptor, and watches
+  int fd;
+  int file_watch;
+  int directory_watch;
+
+  // Last error
+  int error;
+
+private:
+  /* Forbidden foes */
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+};
+
+#endif
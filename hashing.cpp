@@ -0,0 +1,99 @@
+/**
+ * Hacker News Logs Parser. Hash functions.
+ * Hash policies for reference strings: FNV-1a, a wyhash-style multiply-mix hash, and an AES-NI based one
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#define RX_HASH_X86
+#include <immintrin.h>
+#endif
+
+#include "hashing.hpp"
+
+/**
+ * Implementation signature.
+ **/
+typedef uint64_t (*hash_fn)(const unsigned char *str, size_t size);
+
+#ifdef RX_HASH_X86
+
+/**
+ * AES-NI hash. Two 16-byte lanes are fed by 32-byte blocks (one AES round
+ * each, independent chains), the tail is zero-padded, and the lanes are
+ * folded with the length through two more rounds.
+ **/
+__attribute__((target("aes,sse4.1")))
+static uint64_t aes_hash_ni(const unsigned char *str, size_t size) {
+  const __m128i key0 = _mm_set_epi64x(RXHASH_S0, RXHASH_S1);
+  const __m128i key1 = _mm_set_epi64x(RXHASH_S2, RXHASH_S3);
+  __m128i lane0 = key0;
+  __m128i lane1 = key1;
+
+  size_t i;
+  for(i = 0; size - i >= 32; i += 32) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&str[i]));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&str[i + 16]));
+    lane0 = _mm_aesenc_si128(_mm_xor_si128(lane0, a), key1);
+    lane1 = _mm_aesenc_si128(_mm_xor_si128(lane1, b), key0);
+  }
+
+  // Tail (less than 32 bytes), zero-padded
+  const size_t remain = size - i;
+  if (remain != 0) {
+    unsigned char buffer[32];
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, &str[i], remain);
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&buffer[0]));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&buffer[16]));
+    lane0 = _mm_aesenc_si128(_mm_xor_si128(lane0, a), key1);
+    lane1 = _mm_aesenc_si128(_mm_xor_si128(lane1, b), key0);
+  }
+
+  // Fold lanes and length
+  __m128i h = _mm_xor_si128(lane0, _mm_set_epi64x(0, static_cast<int64_t>(size)));
+  h = _mm_aesenc_si128(h, lane1);
+  h = _mm_aesenc_si128(h, key0);
+  h = _mm_aesdec_si128(h, key1);
+  return static_cast<uint64_t>(_mm_extract_epi64(h, 0)) ^ static_cast<uint64_t>(_mm_extract_epi64(h, 1));
+}
+
+#endif
+
+/**
+ * Portable fallback.
+ **/
+static uint64_t aes_hash_fallback(const unsigned char *str, size_t size) {
+  return rxhash(str, size);
+}
+
+bool aes_hash_supported() {
+#ifdef RX_HASH_X86
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse4.1");
+#else
+  return false;
+#endif
+}
+
+/**
+ * Select the implementation, once, at startup.
+ **/
+static hash_fn aes_hash_resolve() {
+#ifdef RX_HASH_X86
+  if (aes_hash_supported()) {
+    return aes_hash_ni;
+  }
+#endif
+  return aes_hash_fallback;
+}
+
+static const hash_fn aes_hash_impl = aes_hash_resolve();
+
+uint64_t aes_hash(const unsigned char *str, size_t size) {
+  return aes_hash_impl(str, size);
+}
@@ -0,0 +1,195 @@
+/**
+ * Hacker News Logs Parser. Hash functions.
+ * Hash policies for reference strings: FNV-1a, a wyhash-style multiply-mix hash, and an AES-NI based one
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_HASHING_HPP
+#define RX_HASHING_HPP
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Simple FNV1-a hash function
+ * See <https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function>
+ **/
+static inline uint64_t fnv1a_hash(const unsigned char *str, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for(size_t i = 0; i < size; i++) {
+    hash ^= str[i];
+    hash *= 1099511628211;
+  }
+  return hash;
+}
+
+/**
+ * Unaligned 64-bit load. memcpy() is the alias-safe way, and compiles to a single load.
+ **/
+static inline uint64_t rx_load64(const unsigned char *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/**
+ * Unaligned 32-bit load.
+ **/
+static inline uint64_t rx_load32(const unsigned char *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/**
+ * Multiply-mix: 64x64->128 multiplication, folded (see wyhash).
+ **/
+static inline uint64_t rx_mum(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  const __uint128_t r = static_cast<__uint128_t>(a)*b;
+  return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+  const uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+  const uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+  const uint64_t t = rl + (rm0 << 32);
+  const uint64_t lo = t + (rm1 << 32);
+  const uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+  return lo ^ hi;
+#endif
+}
+
+// rxhash secrets (odd, balanced bit patterns)
+#define RXHASH_S0 UINT64_C(0xa0761d6478bd642f)
+#define RXHASH_S1 UINT64_C(0xe7037ed1a0b428db)
+#define RXHASH_S2 UINT64_C(0x8ebc6af09c88c6e3)
+#define RXHASH_S3 UINT64_C(0x589965cc75374cc3)
+#define RXHASH_S4 UINT64_C(0x1d8e4e27c47d124f)
+
+// rxhash block size, in bytes
+#define RXHASH_BLOCK 32
+
+/**
+ * rxhash: a wyhash-style multiply-mix hash.
+ * Input is consumed by 32-byte blocks feeding two independent multiply
+ * chains (so that long keys are not bound by the multiplication latency),
+ * then by a tail of less than 32 bytes. The length is only mixed at the end,
+ * so that the hash can be computed while the key end is still unknown (see
+ * @c rxhash_init, @c rxhash_block, @c rxhash_tail and @c rxhash_final).
+ **/
+struct RxHashState {
+  uint64_t s0;
+  uint64_t s1;
+};
+
+/** Initialize a rxhash state. **/
+static inline void rxhash_init(RxHashState &state) {
+  state.s0 = RXHASH_S0;
+  state.s1 = RXHASH_S1;
+}
+
+/** Consume a 32-byte block. **/
+static inline void rxhash_block(RxHashState &state, const unsigned char *p) {
+  state.s0 = rx_mum(rx_load64(p) ^ RXHASH_S1, rx_load64(p + 8) ^ state.s0);
+  state.s1 = rx_mum(rx_load64(p + 16) ^ RXHASH_S2, rx_load64(p + 24) ^ state.s1);
+}
+
+/** Consume the last (less than 32) bytes. **/
+static inline void rxhash_tail(RxHashState &state, const unsigned char *p, size_t size) {
+  if (size >= 16) {
+    state.s0 = rx_mum(rx_load64(p) ^ RXHASH_S1, rx_load64(p + 8) ^ state.s0);
+    p += 16;
+    size -= 16;
+  }
+  uint64_t a, b;
+  if (size >= 8) {
+    /* Overlapping reads, within [p, p + size) */
+    a = rx_load64(p);
+    b = rx_load64(p + size - 8);
+  } else if (size >= 4) {
+    a = rx_load32(p);
+    b = rx_load32(p + size - 4);
+  } else if (size != 0) {
+    a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[size >> 1]) << 8) | p[size - 1];
+    b = 0;
+  } else {
+    a = b = 0;
+  }
+  state.s1 = rx_mum(a ^ RXHASH_S3, b ^ state.s1);
+}
+
+/** Finalize a rxhash state, given the total size. **/
+static inline uint64_t rxhash_final(const RxHashState &state, size_t size) {
+  return rx_mum(RXHASH_S4 ^ size, rx_mum(state.s0 ^ RXHASH_S2, state.s1 ^ RXHASH_S0));
+}
+
+/**
+ * rxhash of a buffer.
+ **/
+static inline uint64_t rxhash(const unsigned char *str, size_t size) {
+  RxHashState state;
+  rxhash_init(state);
+  size_t i;
+  for(i = 0; size - i >= RXHASH_BLOCK; i += RXHASH_BLOCK) {
+    rxhash_block(state, &str[i]);
+  }
+  rxhash_tail(state, &str[i], size - i);
+  return rxhash_final(state, size);
+}
+
+/**
+ * Is the AES-NI hash implementation available on this CPU ?
+ **/
+bool aes_hash_supported();
+
+/**
+ * AES-NI based hash (16-byte lanes, two AES rounds per block).
+ * Falls back to @c rxhash if AES-NI is not available; the choice is done once at startup.
+ **/
+uint64_t aes_hash(const unsigned char *str, size_t size);
+
+/**
+ * Hash policies. A policy implements:
+ *
+ * static uint64_t hash(const unsigned char *str, size_t size);
+ *   Hash a buffer
+ * static const char* name();
+ *   Return the policy name
+ **/
+
+/** FNV-1a policy (byte-wise, serial; the historical one). **/
+struct Fnv1aHashPolicy {
+  static uint64_t hash(const unsigned char *str, size_t size) {
+    return fnv1a_hash(str, size);
+  }
+  static const char* name() {
+    return "fnv1a";
+  }
+};
+
+/** rxhash policy (portable, and identical on all hosts). **/
+struct RxHashPolicy {
+  static uint64_t hash(const unsigned char *str, size_t size) {
+    return rxhash(str, size);
+  }
+  static const char* name() {
+    return "rxhash";
+  }
+};
+
+/** AES-NI policy (hash values depend on the host CPU features). **/
+struct AesHashPolicy {
+  static uint64_t hash(const unsigned char *str, size_t size) {
+    return aes_hash(str, size);
+  }
+  static const char* name() {
+    return "aes";
+  }
+};
+
+/** Default hash policy. **/
+typedef RxHashPolicy DefaultHashPolicy;
+
+#endif
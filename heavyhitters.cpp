@@ -0,0 +1,236 @@
+/**
+ * Hacker News Logs Parser. Approximate heavy hitters.
+ * Bounded-memory top queries estimation: Space-Saving summary, with an optional Count-Min sketch
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <assert.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "heavyhitters.hpp"
+
+/* SpaceSaving */
+
+SpaceSaving::SpaceSaving(size_t capacity): capacity(capacity != 0 ? capacity : 1) {
+  index.reserve(this->capacity);
+}
+
+size_t SpaceSaving::bytes_per_counter() {
+  // Heap counter, and index node (key, position, next pointer, cached hash, bucket, allocator overhead)
+  return sizeof(Counter) + sizeof(std::pair<const RefString, size_t>) + 4*sizeof(void*);
+}
+
+void SpaceSaving::exchange(size_t a, size_t b) {
+  std::swap(heap[a], heap[b]);
+  index[heap[a].key] = a;
+  index[heap[b].key] = b;
+}
+
+void SpaceSaving::sift_up(size_t position) {
+  while(position != 0) {
+    const size_t parent = (position - 1) / 2;
+    if (heap[parent].count <= heap[position].count) {
+      break;
+    }
+    exchange(parent, position);
+    position = parent;
+  }
+}
+
+void SpaceSaving::sift_down(size_t position) {
+  for(;;) {
+    const size_t left = 2*position + 1;
+    const size_t right = left + 1;
+    size_t smallest = position;
+    if (left < heap.size() && heap[left].count < heap[smallest].count) {
+      smallest = left;
+    }
+    if (right < heap.size() && heap[right].count < heap[smallest].count) {
+      smallest = right;
+    }
+    if (smallest == position) {
+      break;
+    }
+    exchange(smallest, position);
+    position = smallest;
+  }
+}
+
+void SpaceSaving::add(const RefString &key, uint64_t value) {
+  const auto it = index.find(key);
+  if (it != index.end()) {
+    // Monitored key
+    const size_t position = it->second;
+    heap[position].count += value;
+    sift_down(position);
+  } else if (heap.size() < capacity) {
+    // Free counter
+    Counter counter = { key, value, 0 };
+    heap.push_back(counter);
+    index[key] = heap.size() - 1;
+    sift_up(heap.size() - 1);
+  } else {
+    // Replace the smallest counter, which count becomes the error
+    Counter &smallest = heap[0];
+    index.erase(smallest.key);
+    const uint64_t min = smallest.count;
+    smallest.key = key;
+    smallest.count = min + value;
+    smallest.error = min;
+    index[key] = 0;
+    sift_down(0);
+  }
+}
+
+void SpaceSaving::merge(const SpaceSaving &other) {
+  const uint64_t min = get_min();
+  const uint64_t other_min = other.get_min();
+
+  // Combined counters
+  std::vector<Counter> combined;
+  combined.reserve(heap.size() + other.heap.size());
+  for(const Counter &counter : heap) {
+    const auto it = other.index.find(counter.key);
+    Counter merged = counter;
+    if (it != other.index.end()) {
+      merged.count += other.heap[it->second].count;
+      merged.error += other.heap[it->second].error;
+    } else {
+      merged.count += other_min;
+      merged.error += other_min;
+    }
+    combined.push_back(merged);
+  }
+  for(const Counter &counter : other.heap) {
+    if (index.find(counter.key) == index.end()) {
+      Counter merged = counter;
+      merged.count += min;
+      merged.error += min;
+      combined.push_back(merged);
+    }
+  }
+
+  // Keep the largest ones
+  if (combined.size() > capacity) {
+    std::nth_element(combined.begin(), combined.begin() + capacity, combined.end(),
+                     [](const Counter &a, const Counter &b) {
+                       return a.count > b.count;
+                     });
+    combined.resize(capacity);
+  }
+
+  // Rebuild heap and index
+  heap.swap(combined);
+  std::make_heap(heap.begin(), heap.end(), [](const Counter &a, const Counter &b) {
+      return a.count > b.count;
+    });
+  index.clear();
+  for(size_t i = 0; i < heap.size(); i++) {
+    index[heap[i].key] = i;
+  }
+}
+
+/* CountMinSketch */
+
+CountMinSketch::CountMinSketch(size_t width, size_t depth):
+  width(width), depth(depth), counters(width*depth)
+{
+}
+
+void CountMinSketch::add(uint64_t hash, uint32_t value) {
+  for(size_t row = 0; row < depth; row++) {
+    uint32_t &counter = counters[position(hash, row)];
+    counter = counter <= std::numeric_limits<uint32_t>::max() - value
+      ? counter + value : std::numeric_limits<uint32_t>::max();
+  }
+}
+
+uint64_t CountMinSketch::estimate(uint64_t hash) const {
+  uint64_t estimate = std::numeric_limits<uint64_t>::max();
+  for(size_t row = 0; row < depth; row++) {
+    const uint32_t counter = counters[position(hash, row)];
+    if (counter < estimate) {
+      estimate = counter;
+    }
+  }
+  // A saturated counter is meaningless
+  return estimate != std::numeric_limits<uint32_t>::max() ? estimate : std::numeric_limits<uint64_t>::max();
+}
+
+void CountMinSketch::merge(const CountMinSketch &other) {
+  assert(width == other.width && depth == other.depth);
+  for(size_t i = 0; i < counters.size(); i++) {
+    const uint32_t value = other.counters[i];
+    counters[i] = counters[i] <= std::numeric_limits<uint32_t>::max() - value
+      ? counters[i] + value : std::numeric_limits<uint32_t>::max();
+  }
+}
+
+/* HeavyHitters */
+
+// Count-Min sketch depth
+#define COUNT_MIN_DEPTH 4
+
+HeavyHitters::HeavyHitters(size_t memory, bool count_min):
+  summary((count_min ? memory / 2 : memory) / SpaceSaving::bytes_per_counter()),
+  sketch(count_min ? memory / 2 / (COUNT_MIN_DEPTH*sizeof(uint32_t)) : 0, COUNT_MIN_DEPTH),
+  total(0), memory(memory)
+{
+}
+
+void HeavyHitters::add_batch(const RefString *keys, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    summary.add(keys[i]);
+    if (sketch.is_enabled()) {
+      sketch.add(keys[i].hash());
+    }
+  }
+  total += count;
+}
+
+void HeavyHitters::merge(const HeavyHitters &other) {
+  summary.merge(other.summary);
+  if (sketch.is_enabled()) {
+    sketch.merge(other.sketch);
+  }
+  total += other.total;
+}
+
+void HeavyHitters::swap(HeavyHitters &other) {
+  std::swap(summary, other.summary);
+  std::swap(sketch, other.sketch);
+  std::swap(total, other.total);
+  std::swap(memory, other.memory);
+}
+
+void HeavyHitters::get_top(size_t top, std::vector<Entry> &list) const {
+  list.clear();
+  for(const SpaceSaving::Counter &counter : summary.get_counters()) {
+    Entry entry;
+    entry.key = counter.key;
+    entry.lower = counter.count - counter.error;
+    entry.upper = counter.count;
+    if (sketch.is_enabled()) {
+      const uint64_t estimate = sketch.estimate(counter.key.hash());
+      if (estimate < entry.upper) {
+        entry.upper = estimate >= entry.lower ? estimate : entry.lower;
+      }
+    }
+    list.push_back(entry);
+  }
+
+  // Descending estimate; ties are broken on the query itself
+  const auto compare = [](const Entry &a, const Entry &b) {
+    return a.upper > b.upper || (a.upper == b.upper && b.key < a.key);
+  };
+  if (list.size() > top) {
+    std::partial_sort(list.begin(), list.begin() + top, list.end(), compare);
+    list.resize(top);
+  } else {
+    std::sort(list.begin(), list.end(), compare);
+  }
+}
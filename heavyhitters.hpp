@@ -0,0 +1,264 @@
+/**
+ * Hacker News Logs Parser. Approximate heavy hitters.
+ * Bounded-memory top queries estimation: Space-Saving summary, with an optional Count-Min sketch
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_HEAVY_HITTERS_HPP
+#define RX_HEAVY_HITTERS_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "refstringmap.hpp"
+
+/**
+ * Space-Saving summary (Metwally, Agrawal, El Abbadi, 2005).
+ * At most @c capacity counters are kept; an unknown key replaces the
+ * smallest counter, inheriting its count as error. Every key whose true count
+ * is higher than N/capacity (N being the number of additions) is guaranteed
+ * to be monitored, and each count overestimates the true one by at most its
+ * error.
+ *
+ * Counters are kept in a min-heap, indexed by key.
+ **/
+class SpaceSaving {
+public:
+  /**
+   * A monitored key.
+   **/
+  struct Counter {
+    // The key
+    RefString key;
+
+    // The estimated count (upper bound of the true count)
+    uint64_t count;
+
+    // The maximum overestimation
+    uint64_t error;
+  };
+
+  /**
+   * Create an empty summary.
+   *
+   * @param capacity The maximum number of counters
+   **/
+  explicit SpaceSaving(size_t capacity = 1);
+
+  /**
+   * Add a value to a key.
+   *
+   * @param key The key
+   * @param value The value to be added
+   **/
+  void add(const RefString &key, uint64_t value = 1);
+
+  /**
+   * Merge another summary (Agarwal et al., "Mergeable summaries", 2012):
+   * keys missing in one summary are credited with its smallest count, and
+   * the largest counters are kept.
+   *
+   * @param other The other summary
+   **/
+  void merge(const SpaceSaving &other);
+
+  /**
+   * Return the smallest count if all counters are used (the maximum count of
+   * an unmonitored key), 0 otherwise.
+   **/
+  uint64_t get_min() const {
+    return heap.size() == capacity && !heap.empty() ? heap[0].count : 0;
+  }
+
+  /**
+   * Return the counters (in no particular order).
+   **/
+  const std::vector<Counter>& get_counters() const {
+    return heap;
+  }
+
+  /**
+   * Return the maximum number of counters.
+   **/
+  size_t get_capacity() const {
+    return capacity;
+  }
+
+  /**
+   * Return the approximate memory used by a counter, in bytes.
+   **/
+  static size_t bytes_per_counter();
+
+protected:
+  /** Move a counter up to its heap position. **/
+  void sift_up(size_t position);
+
+  /** Move a counter down to its heap position. **/
+  void sift_down(size_t position);
+
+  /** Swap two counters, updating the index. **/
+  void exchange(size_t a, size_t b);
+
+protected:
+  // Counters, as a min-heap on count
+  std::vector<Counter> heap;
+
+  // Key to heap position
+  std::unordered_map<RefString, size_t, RefStringHash> index;
+
+  // Maximum number of counters
+  size_t capacity;
+};
+
+/**
+ * Count-Min sketch (Cormode, Muthukrishnan, 2005), with 32-bit saturating
+ * counters. Estimates never underestimate; the overestimation is at most
+ * e*N/width with probability 1-exp(-depth).
+ **/
+class CountMinSketch {
+public:
+  /**
+   * Create an empty sketch.
+   *
+   * @param width The number of counters per row
+   * @param depth The number of rows
+   **/
+  CountMinSketch(size_t width = 0, size_t depth = 4);
+
+  /**
+   * Add a value to a key hash.
+   **/
+  void add(uint64_t hash, uint32_t value = 1);
+
+  /**
+   * Estimate the count of a key hash.
+   **/
+  uint64_t estimate(uint64_t hash) const;
+
+  /**
+   * Merge a sketch of the same dimensions.
+   **/
+  void merge(const CountMinSketch &other);
+
+  /**
+   * Is the sketch enabled (non-zero width) ?
+   **/
+  bool is_enabled() const {
+    return width != 0;
+  }
+
+protected:
+  /** Counter position of a hash on a given row (double hashing). **/
+  size_t position(uint64_t hash, size_t row) const {
+    const uint64_t h1 = hash & 0xffffffff;
+    const uint64_t h2 = (hash >> 32) | 1;
+    return row*width + static_cast<size_t>((h1 + row*h2) % width);
+  }
+
+protected:
+  // Counters per row
+  size_t width;
+
+  // Number of rows
+  size_t depth;
+
+  // Counters (depth rows of width counters)
+  std::vector<uint32_t> counters;
+};
+
+/**
+ * Bounded-memory top queries estimation: a Space-Saving summary, and an
+ * optional Count-Min sketch to tighten the upper bounds.
+ **/
+class HeavyHitters {
+public:
+  /**
+   * An estimated top query.
+   **/
+  struct Entry {
+    // The query
+    RefString key;
+
+    // Lowest possible count
+    uint64_t lower;
+
+    // Highest possible count (the reported estimate)
+    uint64_t upper;
+  };
+
+  /**
+   * Create an empty estimator.
+   *
+   * @param memory The memory budget, in bytes (0 for a minimal, placeholder, estimator)
+   * @param count_min If @c true, half of the budget is used by a Count-Min sketch
+   **/
+  HeavyHitters(size_t memory = 0, bool count_min = false);
+
+  /**
+   * Create an empty estimator of the same configuration, with a share of the
+   * memory budget (the estimators of several chunks of a scan).
+   *
+   * @param parts The number of shares of the budget
+   * @return The empty estimator
+   **/
+  HeavyHitters share(size_t parts) const {
+    return HeavyHitters(memory / parts, sketch.is_enabled());
+  }
+
+  /**
+   * Add a batch of keys (same interface as RefStringUnorderedHashMap::add_batch).
+   **/
+  void add_batch(const RefString *keys, size_t count);
+
+  /**
+   * Merge another estimator of the same configuration.
+   **/
+  void merge(const HeavyHitters &other);
+
+  /**
+   * Swap with another estimator.
+   **/
+  void swap(HeavyHitters &other);
+
+  /**
+   * Get the top queries, with their error bounds.
+   *
+   * @param top The maximum number of queries
+   * @param list The list to be filled, sorted by descending estimate
+   **/
+  void get_top(size_t top, std::vector<Entry> &list) const;
+
+  /**
+   * Return the total number of additions.
+   **/
+  uint64_t get_total() const {
+    return total;
+  }
+
+  /**
+   * Return the number of Space-Saving counters.
+   **/
+  size_t get_capacity() const {
+    return summary.get_capacity();
+  }
+
+protected:
+  // The Space-Saving summary
+  SpaceSaving summary;
+
+  // The Count-Min sketch (possibly disabled)
+  CountMinSketch sketch;
+
+  // Total number of additions
+  uint64_t total;
+
+  // The memory budget, in bytes
+  size_t memory;
+};
+
+#endif
@@ -0,0 +1,249 @@
+/**
+ * Hacker News Logs Parser. Approximate distinct counting.
+ * HyperLogLog++ cardinality sketch, fed with the 64-bit query hashes
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "hyperloglog.hpp"
+
+// Sparse representation precision (HLL++ uses p' = 25)
+#define SPARSE_PRECISION 25
+
+// Sparse entry rank bits
+#define SPARSE_RANK_BITS 6
+
+/**
+ * Final mixer (MurmurHash3 fmix64): registers use both the highest and the
+ * lowest hash bits, which must not depend on the hash policy quality.
+ **/
+static inline uint64_t hll_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * Rank of a hash given a precision: the position of the first set bit after
+ * the @c precision index bits (1 to 65 - precision).
+ **/
+static inline uint8_t hll_rank(uint64_t hash, unsigned precision) {
+  const uint64_t rest = hash << precision;
+  return static_cast<uint8_t>(rest != 0 ? __builtin_clzll(rest) + 1 : 64 - precision + 1);
+}
+
+/** Sparse entry encoding: 25-bit index, 6-bit rank; sorts by index, then rank. **/
+static inline uint32_t sparse_encode(uint64_t hash) {
+  const uint32_t index = static_cast<uint32_t>(hash >> (64 - SPARSE_PRECISION));
+  return (index << SPARSE_RANK_BITS) | hll_rank(hash, SPARSE_PRECISION);
+}
+
+static inline uint32_t sparse_index(uint32_t entry) {
+  return entry >> SPARSE_RANK_BITS;
+}
+
+static inline uint8_t sparse_rank(uint32_t entry) {
+  return static_cast<uint8_t>(entry & ((1 << SPARSE_RANK_BITS) - 1));
+}
+
+HyperLogLog::HyperLogLog(unsigned precision): precision(precision) {
+  assert(precision >= HLL_MIN_PRECISION && precision <= HLL_MAX_PRECISION);
+}
+
+void HyperLogLog::add(uint64_t hash) {
+  hash = hll_mix(hash);
+  if (!is_sparse()) {
+    update_register(static_cast<size_t>(hash >> (64 - precision)), hll_rank(hash, precision));
+    return;
+  }
+
+  // Buffer sparse entries, and merge them by batches
+  buffer.push_back(sparse_encode(hash));
+  if (buffer.size() >= (static_cast<size_t>(1) << precision) / (4*sizeof(uint32_t))) {
+    flush_buffer();
+  }
+}
+
+void HyperLogLog::add_batch(const RefString *keys, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    add(keys[i].hash());
+  }
+}
+
+void HyperLogLog::flush_buffer() {
+  if (buffer.empty()) {
+    return;
+  }
+
+  // Sorted union, keeping the highest rank of each index (the last one)
+  std::sort(buffer.begin(), buffer.end());
+  std::vector<uint32_t> merged;
+  merged.reserve(sparse.size() + buffer.size());
+  std::merge(sparse.begin(), sparse.end(), buffer.begin(), buffer.end(), std::back_inserter(merged));
+  buffer.clear();
+  sparse.clear();
+  for(size_t i = 0; i < merged.size(); i++) {
+    if (i + 1 == merged.size() || sparse_index(merged[i]) != sparse_index(merged[i + 1])) {
+      sparse.push_back(merged[i]);
+    }
+  }
+
+  // The sparse list must stay smaller than the dense registers
+  if (sparse.size()*sizeof(uint32_t) > (static_cast<size_t>(1) << precision)) {
+    to_dense();
+  }
+}
+
+void HyperLogLog::to_dense() {
+  std::vector<uint32_t> entries;
+  entries.swap(sparse);
+  entries.insert(entries.end(), buffer.begin(), buffer.end());
+  buffer.clear();
+
+  // The dense index is the sparse index prefix; the dense rank is the number of
+  // leading zeros of the remaining sparse index bits, or beyond them the sparse rank
+  registers.assign(static_cast<size_t>(1) << precision, 0);
+  const unsigned extra = SPARSE_PRECISION - precision;
+  for(const uint32_t entry : entries) {
+    const uint32_t index = sparse_index(entry);
+    const uint32_t rest = index & ((1u << extra) - 1);
+    const uint8_t rank = rest != 0
+      ? static_cast<uint8_t>(__builtin_clz(rest) - (32 - extra) + 1)
+      : static_cast<uint8_t>(extra + sparse_rank(entry));
+    update_register(index >> extra, rank);
+  }
+}
+
+void HyperLogLog::merge(const HyperLogLog &other) {
+  assert(precision == other.precision);
+  if (is_sparse() && other.is_sparse()) {
+    buffer.insert(buffer.end(), other.sparse.begin(), other.sparse.end());
+    buffer.insert(buffer.end(), other.buffer.begin(), other.buffer.end());
+    flush_buffer();
+    return;
+  }
+
+  if (is_sparse()) {
+    to_dense();
+  }
+  if (other.is_sparse()) {
+    HyperLogLog copy(other);
+    copy.to_dense();
+    merge(copy);
+    return;
+  }
+  for(size_t i = 0; i < registers.size(); i++) {
+    update_register(i, other.registers[i]);
+  }
+}
+
+void HyperLogLog::merge_registers(const uint8_t *dense) {
+  if (is_sparse()) {
+    to_dense();
+  }
+  for(size_t i = 0; i < registers.size(); i++) {
+    update_register(i, dense[i]);
+  }
+}
+
+void HyperLogLog::get_registers(std::vector<uint8_t> &dense) const {
+  if (is_sparse()) {
+    HyperLogLog copy(*this);
+    copy.to_dense();
+    dense = copy.registers;
+  } else {
+    dense = registers;
+  }
+}
+
+void HyperLogLog::swap(HyperLogLog &other) {
+  std::swap(precision, other.precision);
+  registers.swap(other.registers);
+  sparse.swap(other.sparse);
+  buffer.swap(other.buffer);
+}
+
+/** Ertl's sigma function (small range correction). **/
+static double hll_sigma(double x) {
+  if (x == 1) {
+    return INFINITY;
+  }
+  double y = 1;
+  double z = x;
+  double previous;
+  do {
+    x *= x;
+    previous = z;
+    z += x*y;
+    y += y;
+  } while(z != previous);
+  return z;
+}
+
+/** Ertl's tau function (large range correction). **/
+static double hll_tau(double x) {
+  if (x == 0 || x == 1) {
+    return 0;
+  }
+  double y = 1;
+  double z = 1 - x;
+  double previous;
+  do {
+    x = sqrt(x);
+    previous = z;
+    y *= 0.5;
+    z -= (1 - x)*(1 - x)*y;
+  } while(z != previous);
+  return z / 3;
+}
+
+uint64_t HyperLogLog::estimate() const {
+  if (is_sparse()) {
+    // Linear counting over the 2^25 sparse registers
+    HyperLogLog copy(*this);
+    copy.flush_buffer();
+    if (copy.is_sparse()) {
+      const double m = static_cast<double>(1 << SPARSE_PRECISION);
+      return static_cast<uint64_t>(llround(m*log(m / (m - copy.sparse.size()))));
+    }
+    return copy.estimate();
+  }
+
+  // Registers histogram
+  const unsigned q = 64 - precision;
+  std::vector<size_t> histogram(q + 2, 0);
+  for(const uint8_t value : registers) {
+    histogram[value]++;
+  }
+
+  // Improved raw estimator
+  const double m = static_cast<double>(registers.size());
+  double z = m*hll_tau(1 - histogram[q + 1] / m);
+  for(unsigned k = q; k >= 1; k--) {
+    z += histogram[k];
+    z *= 0.5;
+  }
+  z += m*hll_sigma(histogram[0] / m);
+  return static_cast<uint64_t>(llround(m*m / (2*log(2)) / z));
+}
+
+double HyperLogLog::get_standard_error() const {
+  if (is_sparse() && !buffer.empty()) {
+    // Buffered entries may not fit in the sparse representation
+    HyperLogLog copy(*this);
+    copy.flush_buffer();
+    return copy.get_standard_error();
+  }
+  const unsigned bits = is_sparse() ? SPARSE_PRECISION : precision;
+  return 1.04 / sqrt(static_cast<double>(static_cast<uint64_t>(1) << bits));
+}
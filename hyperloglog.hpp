@@ -0,0 +1,143 @@
+/**
+ * Hacker News Logs Parser. Approximate distinct counting.
+ * HyperLogLog++ cardinality sketch, fed with the 64-bit query hashes
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_HYPERLOGLOG_HPP
+#define RX_HYPERLOGLOG_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "refstringmap.hpp"
+
+// Precision bounds, and default precision (4KiB of registers, 1.6% standard error)
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+#define HLL_DEFAULT_PRECISION 12
+
+/**
+ * HyperLogLog++ sketch (Heule, Nunkesser, Hall, 2013): 64-bit hashes, and a
+ * sparse representation (precision 25 linear counting) for small
+ * cardinalities, converted to 2^precision one-byte registers once it would
+ * become larger than them.
+ *
+ * Instead of the empirical bias correction tables of HLL++, the dense
+ * estimate uses Ertl's improved estimator ("New cardinality estimation
+ * algorithms for HyperLogLog sketches", 2017), which is unbiased over the
+ * whole range.
+ *
+ * Sketches of the same precision can be merged.
+ **/
+class HyperLogLog {
+public:
+  /**
+   * Create an empty sketch.
+   *
+   * @param precision The number of index bits (HLL_MIN_PRECISION to HLL_MAX_PRECISION)
+   **/
+  explicit HyperLogLog(unsigned precision = HLL_DEFAULT_PRECISION);
+
+  /**
+   * Add a hash.
+   *
+   * @param hash The 64-bit hash of the element
+   **/
+  void add(uint64_t hash);
+
+  /**
+   * Add a batch of keys, through their cached hash (same interface as
+   * RefStringUnorderedHashMap::add_batch).
+   **/
+  void add_batch(const RefString *keys, size_t count);
+
+  /**
+   * Merge another sketch of the same precision.
+   **/
+  void merge(const HyperLogLog &other);
+
+  /**
+   * Merge dense registers of a sketch of the same precision.
+   *
+   * @param dense The 2^precision registers
+   **/
+  void merge_registers(const uint8_t *dense);
+
+  /**
+   * Get the dense registers of the sketch (a sparse sketch is converted).
+   *
+   * @param dense The 2^precision registers to be filled
+   **/
+  void get_registers(std::vector<uint8_t> &dense) const;
+
+  /**
+   * Swap with another sketch.
+   **/
+  void swap(HyperLogLog &other);
+
+  /**
+   * Return the estimated number of distinct elements.
+   **/
+  uint64_t estimate() const;
+
+  /**
+   * Return the relative standard error of the estimate (1.04/sqrt(m),
+   * m being the number of registers of the current representation).
+   **/
+  double get_standard_error() const;
+
+  /**
+   * Return the precision.
+   **/
+  unsigned get_precision() const {
+    return precision;
+  }
+
+  /**
+   * Is the sketch still using the sparse representation ?
+   **/
+  bool is_sparse() const {
+    return registers.empty();
+  }
+
+  /**
+   * Return the memory used by the sketch data, in bytes.
+   **/
+  size_t get_memory() const {
+    return registers.size() + (sparse.size() + buffer.size())*sizeof(uint32_t);
+  }
+
+protected:
+  /** Set a dense register to the maximum of its value and the given rank. **/
+  void update_register(size_t index, uint8_t rank) {
+    if (rank > registers[index]) {
+      registers[index] = rank;
+    }
+  }
+
+  /** Merge the buffered sparse entries into the sorted sparse list. **/
+  void flush_buffer();
+
+  /** Convert the sparse representation to dense registers. **/
+  void to_dense();
+
+protected:
+  // Number of index bits
+  unsigned precision;
+
+  // Dense registers (empty while sparse)
+  std::vector<uint8_t> registers;
+
+  // Sparse entries (25-bit index, 6-bit rank), sorted, one per index
+  std::vector<uint32_t> sparse;
+
+  // Sparse entries not yet merged into the sorted list
+  std::vector<uint32_t> buffer;
+};
+
+#endif
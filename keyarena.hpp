@@ -0,0 +1,274 @@
+/**
+ * Key arena.
+ * Bump-pointer storage of the keys copied out of transient buffers, and their interning
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_KEYARENA_HPP
+#define RX_KEYARENA_HPP
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "refstringmap.hpp"
+
+// Default address space reserved for keys (pages are only committed when written)
+#define KEYARENA_RESERVE ((size_t) 1 << 36)
+
+// Smallest reservation attempted if the address space is constrained
+#define KEYARENA_MIN_RESERVE ((size_t) 1 << 26)
+
+/**
+ * Storage of keys whose bytes do not live in a stable mapping (such as
+ * streamed input buffers): keys are copied contiguously in large regions,
+ * reserved at once and never moved, so that RefString objects may point to
+ * them, and keys may be designated by handles. A region too small for a key
+ * is followed by another one, large enough.
+ **/
+class KeyArena {
+public:
+  /**
+   * Key handle: the stored bytes, and their 32-bit length.
+   **/
+  struct Handle {
+    const char *str;
+    uint32_t length;
+  };
+
+  /**
+   * Create an empty arena, reserving the address space of its first region.
+   *
+   * @param reserve The address space of regions (halved until the reservation succeeds)
+   **/
+  explicit KeyArena(size_t reserve = KEYARENA_RESERVE): reserve_size(reserve), base(NULL), used(0), capacity(0), total(0)
+  {
+    add_region(0);
+  }
+
+  /**
+   * Destructor; release the regions.
+   **/
+  ~KeyArena() {
+    for(const auto &region : regions) {
+      if (munmap(region.first, region.second) != 0) {
+        perror("unexpected munmap error");
+        abort();
+      }
+    }
+  }
+
+  /**
+   * Copy a key.
+   *
+   * @param key The key
+   * @return The stored bytes, valid until destruction
+   **/
+  const char* copy(const RefString &key) {
+    if (key.len > capacity - used) {
+      add_region(key.len);
+    }
+    char *const str = base + used;
+    memcpy(str, key.str, key.len);
+    used += key.len;
+    total += key.len;
+    return str;
+  }
+
+  /**
+   * Get the handle of stored key bytes.
+   *
+   * @param str The stored bytes (see @c copy)
+   * @param len The key length
+   * @return The handle
+   **/
+  static Handle get_handle(const char *str, size_t len) {
+    if (len > UINT32_MAX) {
+      std::cerr << "key too large\n";
+      abort();
+    }
+    Handle handle;
+    handle.str = str;
+    handle.length = static_cast<uint32_t>(len);
+    return handle;
+  }
+
+  /**
+   * Get the key of a handle.
+   **/
+  static RefString get(Handle handle) {
+    return RefString(handle.str, handle.length);
+  }
+
+  /**
+   * Functor copying keys into the arena (see RefStringUnorderedHashMap::insert).
+   **/
+  struct Copier {
+    explicit Copier(KeyArena &arena): arena(arena)
+    {
+    }
+
+    const char* operator()(const RefString &key) const {
+      return arena.copy(key);
+    }
+
+    KeyArena &arena;
+  };
+
+  /**
+   * Return a copier functor.
+   **/
+  Copier copier() {
+    return Copier(*this);
+  }
+
+  /**
+   * Return the number of bytes of stored keys.
+   **/
+  size_t get_size() const {
+    return total;
+  }
+
+protected:
+  /**
+   * Reserve a new region, which becomes the current one (the remaining bytes
+   * of the previous one are left unused).
+   *
+   * @param min_size The minimum region size
+   **/
+  void add_region(size_t min_size) {
+    // Halved until the reservation succeeds, but never below the smallest
+    // reservation, nor below the key size
+    const size_t floor = std::max(min_size, static_cast<size_t>(KEYARENA_MIN_RESERVE));
+    for(size_t reserve = std::max(reserve_size, floor); ; reserve = std::max(reserve / 2, floor)) {
+      void *const region = mmap(NULL, reserve, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (region != MAP_FAILED) {
+        base = static_cast<char*>(region);
+        used = 0;
+        capacity = reserve;
+        regions.push_back(std::make_pair(base, capacity));
+        // Later regions are no larger than a constrained reservation
+        reserve_size = std::min(reserve_size, reserve);
+        return;
+      } else if (reserve == floor) {
+        break;
+      }
+    }
+    perror("could not reserve key arena");
+    abort();
+  }
+
+protected:
+  // Reserved regions
+  std::vector<std::pair<char*, size_t>> regions;
+
+  // Address space of regions
+  size_t reserve_size;
+
+  // Current region, its bytes used, and reserved
+  char *base;
+  size_t used;
+  size_t capacity;
+
+  // Bytes of stored keys
+  size_t total;
+
+private:
+  /* Forbidden foes */
+  KeyArena(const KeyArena&) = delete;
+  KeyArena& operator=(const KeyArena&) = delete;
+};
+
+/**
+ * Interned keys: each distinct key is stored once in an arena, deduplicated
+ * through a hashtable, and gets a dense identifier designating its handle.
+ * Identifiers can then be counted in flat arrays, whose walk reads keys
+ * contiguously, in order of appearance.
+ **/
+class KeyInterner {
+public:
+  KeyInterner(): arena(), index(), handles()
+  {
+  }
+
+  /**
+   * Intern a batch of keys: hashes are computed and home groups prefetched
+   * first (see RefStringUnorderedHashMap::add_batch).
+   *
+   * @param keys The keys
+   * @param count The number of keys (at most BATCH_MAX)
+   * @param ids The identifiers to be filled; new keys get the next identifiers
+   **/
+  void intern_batch(const RefString *keys, size_t count, uint32_t *ids) {
+    uint64_t hashes[BATCH_MAX];
+    assert(count <= BATCH_MAX);
+    index.reserve(index.size() + count);
+    for(size_t i = 0; i < count; i++) {
+      hashes[i] = static_cast<uint64_t>(RefStringHash()(keys[i]));
+      index.prefetch(hashes[i]);
+    }
+    for(size_t i = 0; i < count; i++) {
+      const char *str = NULL;
+      uint32_t &id = index.insert(keys[i], hashes[i], [this, &str](const RefString &key) {
+          return str = arena.copy(key);
+        });
+      if (id == 0) {
+        handles.push_back(KeyArena::get_handle(str, keys[i].len));
+        id = static_cast<uint32_t>(handles.size());
+      }
+      ids[i] = id - 1;
+    }
+  }
+
+  /**
+   * Get the key of an identifier.
+   **/
+  RefString get(uint32_t id) const {
+    return KeyArena::get(handles[id]);
+  }
+
+  /**
+   * Return the number of distinct keys.
+   **/
+  size_t size() const {
+    return handles.size();
+  }
+
+  /**
+   * Return the number of bytes of stored keys.
+   **/
+  size_t get_size() const {
+    return arena.get_size();
+  }
+
+  enum {
+    // Maximum number of keys of an intern_batch() call
+    BATCH_MAX = 32
+  };
+
+protected:
+  // Keys storage
+  KeyArena arena;
+
+  // Identifier (plus one) of each key
+  RefStringUnorderedHashMap<uint32_t> index;
+
+  // Handle of each identifier
+  std::vector<KeyArena::Handle> handles;
+
+private:
+  /* Forbidden foes */
+  KeyInterner(const KeyInterner&) = delete;
+  KeyInterner& operator=(const KeyInterner&) = delete;
+};
+
+#endif
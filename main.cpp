@@ -10,11 +10,20 @@
 #include <strings.h>
 #include <getopt.h>
 #include <assert.h>
+#include <errno.h>
+#include <glob.h>
 
 #include <limits>
 #include <iostream>
+#include <fstream>
+#include <memory>
 
 #include "yprocessing.hpp"
+#include "yserver.hpp"
+#include "ystream.hpp"
+#include "ycompiled.hpp"
+#include "filewatch.hpp"
+#include "chrono.hpp"
 
 #define VERSION "1.0"
 
@@ -29,16 +38,46 @@ static const struct option long_options[] = {
   {"fast-seek", optional_argument, 0, 's'},
   {"jitter", required_argument, 0, 'j'},
 
+  {"threads", required_argument, 0, 'n'},
+  {"index", optional_argument, 0, 'i'},
+  {"rollup", optional_argument, 0, 'r'},
+  {"bucket", required_argument, 0, 'b'},
+
+  {"approx", optional_argument, 0, 'a'},
+  {"memory", required_argument, 0, 'm'},
+  {"count-min", no_argument, 0, 'c'},
+  {"max-memory", required_argument, 0, 'X'},
+  {"degrade", no_argument, 0, 'G'},
+
+  {"socket", required_argument, 0, 'u'},
+  {"follow", optional_argument, 0, 'F'},
+
+  {"map", required_argument, 0, 'M'},
+  {"readahead", required_argument, 0, 'R'},
+  {"read", required_argument, 0, 'P'},
+  {"drop-behind", required_argument, 0, 'D'},
+
+  {"decode", no_argument, 0, 'd'},
+  {"casefold", no_argument, 0, 'l'},
+
+  {"stats", required_argument, 0, 'S'},
+  {"perf", no_argument, 0, 'C'},
+
   {},
 };
 #define GETOPT_NON_OPTION_TYPE 1
-#define MAX_OPT_TOKENS 3
 
 // main program modes: distrinct queries, or top queries
 enum whyparser_mode {
   whyparser_mode_unknown,
   whyparser_mode_distinct,
   whyparser_mode_top,
+  whyparser_mode_index,
+  whyparser_mode_serve,
+  whyparser_mode_client,
+  whyparser_mode_batch,
+  whyparser_mode_rollup,
+  whyparser_mode_compile,
 };
 
 // convert a string into a enum whyparser_mode
@@ -47,6 +86,18 @@ static enum whyparser_mode whyparser_get(const char *mode) {
     return whyparser_mode_distinct;
   else if (strcasecmp(mode, "top") == 0)
     return whyparser_mode_top;
+  else if (strcasecmp(mode, "index") == 0)
+    return whyparser_mode_index;
+  else if (strcasecmp(mode, "serve") == 0)
+    return whyparser_mode_serve;
+  else if (strcasecmp(mode, "client") == 0)
+    return whyparser_mode_client;
+  else if (strcasecmp(mode, "batch") == 0)
+    return whyparser_mode_batch;
+  else if (strcasecmp(mode, "rollup") == 0)
+    return whyparser_mode_rollup;
+  else if (strcasecmp(mode, "compile") == 0)
+    return whyparser_mode_compile;
   else
     return whyparser_mode_unknown;
 }
@@ -54,10 +105,44 @@ static enum whyparser_mode whyparser_get(const char *mode) {
 // print program usage
 static void usage(const char *prog) {
   std::cout
-  << prog << " distinct [--from TIMESTAMP] [--to TIMESTAMP] input_file\n"
+  << prog << " distinct [--from TIMESTAMP] [--to TIMESTAMP] input_file [input_file...]\n"
   << "\tOutput the number of distinct queries that have been done during a specific time range with this interface\n"
-  << prog << " top nb_top_queries [--from TIMESTAMP] [--to TIMESTAMP] input_file\n"
-  << "\tOutput the top N popular queries (one per line) that have been done during a specific time range\n";
+  << prog << " top nb_top_queries [--from TIMESTAMP] [--to TIMESTAMP] input_file [input_file...]\n"
+  << "\tOutput the top N popular queries (one per line) that have been done during a specific time range\n"
+  << "\tSeveral input files (or quoted glob patterns) are processed concurrently, and their results merged\n"
+  << "\tA gzip or bzip2 compressed input file, a pipe, or - (the standard input) is read and parsed on the fly\n"
+  << prog << " index input_file\n"
+  << "\tWrite the timestamp index sidecar (input_file" HNIDX_SUFFIX "), used to locate ranges exactly\n"
+  << prog << " rollup [--bucket=SECONDS] [--approx=P] input_file\n"
+  << "\tWrite the rollup sidecar (input_file" HNROLL_SUFFIX "): per-bucket query counts and sketches, used to answer whole buckets of ranges\n"
+  << prog << " compile input_file output_file\n"
+  << "\tWrite the compiled (binary, columnar) form of input_file, answering distinct and top queries much faster\n"
+  << prog << " batch queries_file input_file\n"
+  << "\tAnswer the 'distinct FROM TO' and 'top K FROM TO' query lines of queries_file (- for the standard input) in a single scan; each result is followed by an empty line\n"
+  << prog << " serve --socket=PATH input_file\n"
+  << "\tServe 'distinct FROM TO' and 'top K FROM TO' request lines on a Unix socket, until interrupted\n"
+  << prog << " client --socket=PATH\n"
+  << "\tSend request lines read from the standard input to a server, and print the responses\n"
+  << "Options:\n"
+  << "\t--threads=N\tscan the file with N threads, scan N files at once, or serve with N threads (0: one per CPU)\n"
+  << "\t--index=no\tdo not use the timestamp index sidecar\n"
+  << "\t--rollup=no\tdo not use the rollup sidecar\n"
+  << "\t--bucket=SECONDS\trollup bucket size (default: " << HNROLL_DEFAULT_BUCKET << ")\n"
+  << "\t--approx\tbounded-memory approximate top queries, with error bounds\n"
+  << "\t--approx=P\tapproximate distinct queries, with a HyperLogLog sketch of precision P (" << HLL_MIN_PRECISION << " to " << HLL_MAX_PRECISION << ", default: " << HLL_DEFAULT_PRECISION << ")\n"
+  << "\t--memory=SIZE\tmemory budget of approximate top queries, shared by threads and files (default: 64M)\n"
+  << "\t--count-min\tuse a Count-Min sketch to tighten approximate top queries bounds\n"
+  << "\t--max-memory=SIZE\tmemory limit of the exact queries hashtable and top queries heap: the program fails once it is exceeded\n"
+  << "\t--degrade\tonce the memory limit is exceeded, count again approximately instead of failing\n"
+  << "\t--follow[=SECONDS]\tkeep following the appended lines of input_file, printing updated results (followed by an empty line) at most every SECONDS (default: 1)\n"
+  << "\t--map=POLICY\tmapping policy of input files: default, populate, hugepage, willneed or prefetch\n"
+  << "\t--readahead=SIZE\tread-ahead window of the willneed and prefetch mapping policies (default: 64M)\n"
+  << "\t--read=MODE\tread scanned records from the mapping (map), or with large reads into a bounded ring of buffers (pread), bypassing the page cache (direct)\n"
+  << "\t--drop-behind=SIZE\tdrop scanned pages lagging more than SIZE behind the cursor from memory and from the page cache, and report the peak RSS\n"
+  << "\t--decode\tcount URL-decoded queries, so that encoding variants are merged\n"
+  << "\t--casefold\tcount queries folded to lowercase (ASCII)\n"
+  << "\t--stats=FORMAT\tscan statistics format: text (default), or json, written on the standard error with per-phase timings and table metrics\n"
+  << "\t--perf\tadd the cycles, instructions and last-level cache misses of each phase to the json statistics, if permitted\n";
 }
 
 /**
@@ -75,11 +160,152 @@ static long int parse_int(const char *s) {
   return -1;
 }
 
+/**
+ * Parse a size, with an optional K, M or G suffix.
+ *
+ * @param s The string to be parsed.
+ * @return The size, or 0 upon error.
+**/
+static size_t parse_size(const char *s) {
+  char *end = NULL;
+  const unsigned long long value = strtoull(s, &end, 10);
+  if (end == NULL || end == s) {
+    return 0;
+  }
+  unsigned shift = 0;
+  switch(*end) {
+  case '\0':
+    return static_cast<size_t>(value);
+  case 'k':
+  case 'K':
+    shift = 10;
+    break;
+  case 'm':
+  case 'M':
+    shift = 20;
+    break;
+  case 'g':
+  case 'G':
+    shift = 30;
+    break;
+  default:
+    return 0;
+  }
+  return end[1] == '\0' ? static_cast<size_t>(value << shift) : 0;
+}
+
+/**
+ * Print the approximate top queries, with their [lower..upper] bounds.
+**/
+static void print_approx_top_queries(const YParser &parser, unsigned top_queries, Metrics *metrics) {
+  std::vector<HeavyHitters::Entry> list;
+  parser.get_approx_top_queries(top_queries, list);
+  if (metrics != NULL) {
+    metrics->phase("output");
+  }
+  for(const auto &element : list) {
+    std::cout << (std::string) element.key << " " << element.upper
+              << " [" << element.lower << ".." << element.upper << "]\n";
+  }
+}
+
+/** Streams do not have approximate top queries. **/
+static void print_approx_top_queries(const YStreamParser &, unsigned, Metrics *) {
+  abort();
+}
+
+/** Compiled logs are counted exactly. **/
+static void print_approx_top_queries(const CompiledLog &, unsigned, Metrics *) {
+  abort();
+}
+
+/**
+ * Print the approximate number of distinct queries, with its relative standard error.
+**/
+template<typename Parser>
+static void print_approx_distinct_queries(const Parser &parser, Metrics *metrics) {
+  double standard_error;
+  const uint64_t estimate = parser.get_approx_distinct_queries(standard_error);
+  if (metrics != NULL) {
+    metrics->phase("output");
+  }
+  std::cout << estimate << " (+/- " << standard_error*100 << "%)\n";
+}
+
+/** Compiled logs are counted exactly. **/
+static void print_approx_distinct_queries(const CompiledLog &, Metrics *) {
+  abort();
+}
+
+/**
+ * Print the distinct or top queries results.
+ *
+ * @param parser The parser (YParser, YStreamParser or CompiledLog), after @c parse_records
+ * @param mode The distinct or top mode
+ * @param top_queries The number of top queries
+ * @param approx The approximate mode
+ * @param metrics If not @c NULL, the metrics whose select and output phases are to be measured
+**/
+template<typename Parser>
+static void print_results(const Parser &parser, enum whyparser_mode mode, unsigned top_queries, bool approx,
+                          Metrics *metrics = NULL) {
+  if (metrics != NULL) {
+    metrics->phase("select");
+  }
+  switch(mode) {
+  case whyparser_mode_distinct:
+    if (approx) {
+      print_approx_distinct_queries(parser, metrics);
+    } else {
+      const size_t distinct = parser.get_distinct_queries();
+      if (metrics != NULL) {
+        metrics->phase("output");
+      }
+      std::cout << distinct << "\n";
+    }
+    break;
+  case whyparser_mode_top:
+    if (approx) {
+      print_approx_top_queries(parser, top_queries, metrics);
+    } else {
+      // Emit sorted (revered) queue
+      const auto list = parser.get_top_queries(top_queries);
+      if (metrics != NULL) {
+        metrics->phase("output");
+      }
+      for(const auto &element : list) {
+        std::cout << (std::string) element.first << " " << element.second << "\n";
+      }
+    }
+    break;
+  default:
+    abort();
+    break;
+  }
+}
+
+/**
+ * Expand an input file argument: a glob pattern is replaced by the sorted
+ * list of matching paths, and any other path is kept as is.
+ *
+ * @param pattern The argument
+ * @param files The list of files to be completed
+ * @return @c false if a glob pattern did not match any file
+**/
+static bool expand_files(const char *pattern, std::vector<std::string> &files) {
+  glob_t matches;
+  const int result = glob(pattern, GLOB_NOMAGIC, NULL, &matches);
+  if (result == 0) {
+    files.insert(files.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+  }
+  globfree(&matches);
+  return result == 0;
+}
+
 /** main(). **/
 int main(int argc, char **argv) {
   // Non-options
-  const char *tokens[MAX_OPT_TOKENS];
-  size_t tokens_offs = 0;
+  std::vector<const char*> tokens;
   
   // Start timestamp
   time_t from = 0;
@@ -96,6 +322,50 @@ int main(int argc, char **argv) {
   // Default jitter to 15 minutes (see design notes: queries are considered loosely sorted, with 5-minute chunks)
   time_t jitter = 900;
 
+  // Number of scanning threads (0 means one per CPU), and was it set
+  unsigned threads = 1;
+  bool threads_set = false;
+
+  // Use the timestamp index sidecar when present
+  bool use_index = true;
+
+  // Use the rollup sidecar when present, and its bucket size when building it
+  bool use_rollup = true;
+  time_t bucket_size = HNROLL_DEFAULT_BUCKET;
+
+  // Approximate mode, its memory budget, and Count-Min sketch
+  bool approx = false;
+  unsigned precision = HLL_DEFAULT_PRECISION;
+  size_t memory = 64 << 20;
+  bool count_min = false;
+
+  // Memory limit of exact counting (0: unlimited), and approximate fallback
+  size_t max_memory = 0;
+  bool degrade = false;
+
+  // Server socket path
+  const char *socket_path = NULL;
+
+  // Follow mode refresh interval, in seconds (0: disabled)
+  unsigned follow = 0;
+
+  // Queries canonicalization flags (see canonical_flags)
+  unsigned canonical = 0;
+
+  // Mapping policy, and its read-ahead window
+  enum map_policy policy = map_policy_default;
+  size_t window = MAP_DEFAULT_WINDOW;
+
+  // Records read mode
+  enum read_mode read_mode = read_mode_map;
+
+  // Drop-behind window of scanned pages (0: disabled)
+  size_t drop_behind = 0;
+
+  // JSON statistics, and their hardware counters
+  bool stats_json = false;
+  bool perf = false;
+
   // Parse args with getopt
   int c;
   int index;
@@ -142,13 +412,146 @@ int main(int argc, char **argv) {
       }
       break;
 
-    case GETOPT_NON_OPTION_TYPE:
-      assert(optarg != NULL);
-      if (tokens_offs == MAX_OPT_TOKENS) {
-        std::cerr << "too many arguments\n";
+    case 'i':
+      use_index = optarg != NULL ? strcasecmp(optarg, "yes") == 0 : true;
+      break;
+
+    case 'r':
+      use_rollup = optarg != NULL ? strcasecmp(optarg, "yes") == 0 : true;
+      break;
+
+    case 'b':
+      {
+        long int value = parse_int(optarg);
+        if (value > 0) {
+          bucket_size = value;
+        } else {
+          std::cerr << "bad bucket value: " << optarg << "\n";
+          return EXIT_FAILURE;
+        }
+      }
+      break;
+
+    case 'a':
+      approx = true;
+      if (optarg != NULL) {
+        const long int value = parse_int(optarg);
+        if (value < HLL_MIN_PRECISION || value > HLL_MAX_PRECISION) {
+          std::cerr << "bad approx precision: " << optarg << "\n";
+          return EXIT_FAILURE;
+        }
+        precision = static_cast<unsigned>(value);
+      }
+      break;
+
+    case 'm':
+      memory = parse_size(optarg);
+      if (memory == 0) {
+        std::cerr << "bad memory value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'X':
+      max_memory = parse_size(optarg);
+      if (max_memory == 0) {
+        std::cerr << "bad max-memory value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'G':
+      degrade = true;
+      break;
+
+    case 'c':
+      count_min = true;
+      break;
+
+    case 'u':
+      socket_path = optarg;
+      break;
+
+    case 'F':
+      follow = 1;
+      if (optarg != NULL) {
+        const long int value = parse_int(optarg);
+        if (value <= 0) {
+          std::cerr << "bad follow interval: " << optarg << "\n";
+          return EXIT_FAILURE;
+        }
+        follow = static_cast<unsigned>(value);
+      }
+      break;
+
+    case 'M':
+      if (!ReadOnlyMemoryMap::parse_policy(optarg, policy)) {
+        std::cerr << "bad mapping policy: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'R':
+      window = parse_size(optarg);
+      if (window == 0) {
+        std::cerr << "bad readahead value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'P':
+      if (!ChunkedReader::parse_read_mode(optarg, read_mode)) {
+        std::cerr << "bad read mode: " << optarg << "\n";
         return EXIT_FAILURE;
       }
-      tokens[tokens_offs++] = optarg;
+      break;
+
+    case 'D':
+      drop_behind = parse_size(optarg);
+      if (drop_behind == 0) {
+        std::cerr << "bad drop-behind value: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'S':
+      if (strcmp(optarg, "json") == 0) {
+        stats_json = true;
+      } else if (strcmp(optarg, "text") == 0) {
+        stats_json = false;
+      } else {
+        std::cerr << "bad stats format: " << optarg << "\n";
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'C':
+      perf = true;
+      break;
+
+    case 'd':
+      canonical |= canonical_decode;
+      break;
+
+    case 'l':
+      canonical |= canonical_casefold;
+      break;
+
+    case 'n':
+      {
+        long int value = parse_int(optarg);
+        if (value != -1) {
+          threads = static_cast<unsigned>(value);
+          threads_set = true;
+        } else {
+          std::cerr << "bad threads value: " << optarg << "\n";
+        }
+      }
+      break;
+
+    case GETOPT_NON_OPTION_TYPE:
+      assert(optarg != NULL);
+      tokens.push_back(optarg);
       break;
 
     default:
@@ -158,22 +561,182 @@ int main(int argc, char **argv) {
       break;
     }
   }
-  if (tokens_offs < 2) {
+  // Mode ? (the client does not need any input file)
+  const enum whyparser_mode mode = !tokens.empty() ? whyparser_get(tokens[0]) : whyparser_mode_unknown;
+  if (tokens.size() < (mode == whyparser_mode_client ? 1u : 2u)) {
     std::cerr << "missing argument\n";
     return EXIT_FAILURE;
+  } else if ((mode == whyparser_mode_serve || mode == whyparser_mode_client) && socket_path == NULL) {
+    std::cerr << "missing --socket\n";
+    return EXIT_FAILURE;
+  } else if (follow != 0 && mode != whyparser_mode_distinct && mode != whyparser_mode_top) {
+    std::cerr << "--follow is only supported by distinct and top\n";
+    return EXIT_FAILURE;
+  } else if (canonical != 0 && (mode != whyparser_mode_distinct && mode != whyparser_mode_top)) {
+    std::cerr << "--decode and --casefold are only supported by distinct and top\n";
+    return EXIT_FAILURE;
+  } else if (canonical != 0 && approx && mode == whyparser_mode_top) {
+    std::cerr << "--decode and --casefold are not supported by approximate top queries\n";
+    return EXIT_FAILURE;
+  } else if (read_mode != read_mode_map && mode != whyparser_mode_distinct && mode != whyparser_mode_top) {
+    std::cerr << "--read is only supported by distinct and top\n";
+    return EXIT_FAILURE;
+  } else if (read_mode != read_mode_map && approx && mode == whyparser_mode_top) {
+    std::cerr << "--read is not supported by approximate top queries\n";
+    return EXIT_FAILURE;
+  } else if (drop_behind != 0 && mode != whyparser_mode_distinct && mode != whyparser_mode_top) {
+    std::cerr << "--drop-behind is only supported by distinct and top\n";
+    return EXIT_FAILURE;
+  } else if (drop_behind != 0 && approx && mode == whyparser_mode_top) {
+    std::cerr << "--drop-behind is not supported by approximate top queries\n";
+    return EXIT_FAILURE;
+  } else if (stats_json && mode != whyparser_mode_distinct && mode != whyparser_mode_top) {
+    std::cerr << "--stats=json is only supported by distinct and top\n";
+    return EXIT_FAILURE;
+  } else if (stats_json && follow != 0) {
+    std::cerr << "--stats=json is not supported by --follow\n";
+    return EXIT_FAILURE;
+  } else if (perf && !stats_json) {
+    std::cerr << "--perf requires --stats=json\n";
+    return EXIT_FAILURE;
+  } else if (max_memory != 0 && mode != whyparser_mode_distinct && mode != whyparser_mode_top) {
+    std::cerr << "--max-memory is only supported by distinct and top\n";
+    return EXIT_FAILURE;
+  } else if (max_memory != 0 && (approx || follow != 0)) {
+    std::cerr << "--max-memory is not supported by approximate queries and --follow\n";
+    return EXIT_FAILURE;
+  } else if (degrade && max_memory == 0) {
+    std::cerr << "--degrade requires --max-memory\n";
+    return EXIT_FAILURE;
+  } else if (degrade && mode == whyparser_mode_top && (canonical != 0 || read_mode != read_mode_map || drop_behind != 0)) {
+    std::cerr << "--degrade of top queries is not supported by --decode, --casefold, --read and --drop-behind\n";
+    return EXIT_FAILURE;
+  }
+
+  // Client mode: no mapping needed
+  if (mode == whyparser_mode_client) {
+    return yclient(socket_path, std::cin, std::cout) ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
-  // Mode ?
-  const enum whyparser_mode mode = whyparser_get(tokens[0]);
   if (mode == whyparser_mode_unknown) {
     std::cerr << "invalid mode '" << tokens[0] << "'\n";
     return EXIT_FAILURE;
-  } else if (mode == whyparser_mode_top && tokens_offs >= 3) {
+  }
+
+  // The input files are all the arguments following the mode (and the
+  // number of top queries) in distinct and top modes, the argument following
+  // the mode in compile mode, and the last argument otherwise
+  size_t first_file = tokens.size() - 1;
+  size_t end_file = tokens.size();
+  if (mode == whyparser_mode_top && tokens.size() >= 3) {
     top_queries = parse_int(tokens[1]);
+    first_file = 2;
+  } else if (mode == whyparser_mode_distinct || mode == whyparser_mode_top) {
+    first_file = 1;
+  } else if (mode == whyparser_mode_compile && tokens.size() == 3) {
+    first_file = 1;
+    end_file = 2;
+  } else if (mode == whyparser_mode_compile) {
+    std::cerr << (tokens.size() < 3 ? "missing argument\n" : "too many arguments\n");
+    return EXIT_FAILURE;
+  } else if (tokens.size() > (mode == whyparser_mode_batch ? 3u : 2u)) {
+    std::cerr << "too many arguments\n";
+    return EXIT_FAILURE;
+  }
+  std::vector<std::string> files;
+  for(size_t i = first_file; i < end_file; i++) {
+    if (!expand_files(tokens[i], files)) {
+      std::cerr << "no file matching " << tokens[i] << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  if (follow != 0 && files.size() > 1) {
+    std::cerr << "--follow only supports a single file\n";
+    return EXIT_FAILURE;
+  }
+  const char *filename = files[0].c_str();
+
+  // Several files are mapped, and scanned at once: all of them must be plain regular files
+  if (files.size() > 1) {
+    for(const std::string &file : files) {
+      if (CompiledLog::is_compiled(file.c_str()) || StreamReader::detect(file.c_str()) != stream_format_plain
+          || !StreamReader::is_mappable(file.c_str())) {
+        std::cerr << file << ": compiled, compressed or streamed input is only supported as a single file\n";
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (stats_json && (files.size() > 1 || CompiledLog::is_compiled(filename)
+                     || StreamReader::detect(filename) != stream_format_plain || !StreamReader::is_mappable(filename))) {
+    std::cerr << "--stats=json only supports a single mapped file\n";
+    return EXIT_FAILURE;
+  } else if (degrade && files.size() > 1) {
+    std::cerr << "--degrade only supports a single file\n";
+    return EXIT_FAILURE;
+  } else if (max_memory != 0 && (CompiledLog::is_compiled(filename) || StreamReader::detect(filename) != stream_format_plain
+                                 || !StreamReader::is_mappable(filename))) {
+    std::cerr << "--max-memory only supports mapped files\n";
+    return EXIT_FAILURE;
+  }
+
+  // Compiled input: count query identifiers of the exactly located range
+  if (CompiledLog::is_compiled(filename)) {
+    if ((mode != whyparser_mode_distinct && mode != whyparser_mode_top)
+        || files.size() > 1 || follow != 0 || approx || canonical != 0) {
+      std::cerr << "compiled input is only supported by exact distinct and top queries of a single file, without canonicalization\n";
+      return EXIT_FAILURE;
+    }
+    CompiledLog compiled;
+    if (!compiled.load(filename)) {
+      std::cerr << "could not load compiled file: " << strerror(compiled.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    compiled.set_start(from);
+    compiled.set_end(to);
+    compiled.parse_records(mode == whyparser_mode_top);
+    print_results(compiled, mode, top_queries, false);
+    return EXIT_SUCCESS;
   }
 
-  // The filename is the last non-option argument
-  const char *filename = tokens[tokens_offs - 1];
+  // Compressed input, or input which can not be mapped (standard input,
+  // pipes): read (and decompressed) on a thread, and parsed on another one
+  const enum stream_format format = StreamReader::detect(filename);
+  if (format != stream_format_plain || !StreamReader::is_mappable(filename)) {
+    if ((mode != whyparser_mode_distinct && mode != whyparser_mode_top)
+        || files.size() > 1 || follow != 0 || (approx && mode == whyparser_mode_top)) {
+      std::cerr << "streamed input is only supported by distinct and exact top queries of a single file\n";
+      return EXIT_FAILURE;
+    }
+    YStreamParser stream(filename);
+    if (!stream.is_valid()) {
+      std::cerr << "could not open " << StreamReader::get_format_name(format) << " stream: " << strerror(stream.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    stream.set_fast_seek(fast_seek, jitter);
+    stream.set_start(from);
+    stream.set_end(to);
+    stream.set_canonical(canonical);
+    if (approx) {
+      stream.set_approx_distinct(precision);
+    }
+    if (!stream.parse_records()) {
+      std::cerr << "could not read " << StreamReader::get_format_name(format) << " stream: " << strerror(stream.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    print_results(stream, mode, top_queries, approx);
+    return EXIT_SUCCESS;
+  }
+
+  // Memory account of the aggregation structures, shared by all input files
+  MemoryAccount memory_account(max_memory);
+
+  // Structured statistics: the mapping is their first phase
+  std::unique_ptr<Metrics> metrics;
+  if (stats_json) {
+    metrics.reset(new Metrics(perf));
+    metrics->phase("map");
+  }
 
   // Create mapped records from the file, with WhyRequest as type object
   YParser parser(filename);
@@ -182,37 +745,215 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  // Set fast-seek mode
-  parser.set_fast_seek(fast_seek, jitter);
+  // Index mode: write the sidecar, and leave
+  if (mode == whyparser_mode_index) {
+    TimestampIndex index;
+    if (!parser.build_index(index)) {
+      std::cerr << "could not write index: " << strerror(index.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    std::cerr << index.get_blocks() << " blocks indexed\n";
+    return EXIT_SUCCESS;
+  }
+
+  // Compile mode: write the compiled file, and leave
+  if (mode == whyparser_mode_compile) {
+    CompiledLog compiled;
+    if (!parser.compile(compiled, tokens[2])) {
+      std::cerr << "could not write compiled file: " << strerror(compiled.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    std::cerr << compiled.get_records() << " records, " << compiled.get_strings() << " distinct queries compiled\n";
+    return EXIT_SUCCESS;
+  }
+
+  // Rollup mode: write the sidecar, and leave
+  if (mode == whyparser_mode_rollup) {
+    if (!parser.build_rollup(bucket_size, precision)) {
+      std::cerr << "could not write rollup: " << strerror(parser.get_rollup_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    std::cerr << parser.get_rollup_buckets() << " buckets written\n";
+    return EXIT_SUCCESS;
+  }
+
+  // Parser settings, shared by all input files
+  const auto configure = [&](YParser &target) {
+    // Set fast-seek mode
+    target.set_fast_seek(fast_seek, jitter);
+
+    // Set scanning threads (several files are rather scanned at once)
+    target.set_threads(files.size() > 1 ? 1 : threads);
+
+    // Set index and rollup sidecars usage
+    target.set_index(use_index);
+    target.set_rollup(use_rollup);
+
+    // Set approximate mode
+    if (approx && mode == whyparser_mode_top) {
+      target.set_approx(memory, count_min);
+    } else if (approx && mode == whyparser_mode_distinct) {
+      target.set_approx_distinct(precision);
+    }
+
+    // Set range
+    if (from != 0) {
+      target.set_start(from);
+    }
+
+    if (to != std::numeric_limits<time_t>::max()) {
+      target.set_end(to);
+    }
+
+    // Set follow mode
+    if (follow != 0) {
+      target.set_follow();
+    }
+
+    // Set queries canonicalization
+    target.set_canonical(canonical);
+
+    // Set read mode; pread is used if O_DIRECT is not supported
+    if (!target.set_read_mode(read_mode)) {
+      std::cerr << "could not use direct reads: " << strerror(errno) << ", using pread\n";
+    }
+
+    // Set drop-behind window
+    target.set_drop_behind(drop_behind);
+
+    // Set memory accounting, and the approximate fallback once its limit is exceeded
+    target.set_memory_account(&memory_account, !degrade ? memory_fallback_fail
+                              : mode == whyparser_mode_top ? memory_fallback_top : memory_fallback_distinct);
+
+    // Set mapping policy; the default one is kept if not supported
+    if (policy != map_policy_default && !target.set_map_policy(policy, window)) {
+      std::cerr << "could not use mapping policy " << ReadOnlyMemoryMap::get_policy_name(policy)
+                << ": " << strerror(target.get_error()) << "\n";
+    }
+  };
+  configure(parser);
+  parser.set_metrics(metrics.get());
+
+  // Batch mode: read all queries, and answer them in a single scan
+  if (mode == whyparser_mode_batch) {
+    if (tokens.size() < 3) {
+      std::cerr << "missing argument\n";
+      return EXIT_FAILURE;
+    }
+    std::ifstream file;
+    if (strcmp(tokens[1], "-") != 0) {
+      file.open(tokens[1]);
+      if (!file.is_open()) {
+        std::cerr << "could not open " << tokens[1] << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+      }
+    }
+    std::istream &input = file.is_open() ? file : std::cin;
+    std::vector<YQuery> queries;
+    std::string line;
+    while(std::getline(input, line)) {
+      YQuery query;
+      if (line.empty()) {
+        continue;
+      } else if (!query.parse(line)) {
+        std::cerr << "invalid query: " << line << "\n";
+        return EXIT_FAILURE;
+      }
+      queries.push_back(query);
+    }
+    if (queries.empty()) {
+      return EXIT_SUCCESS;
+    }
+
+    std::vector<YQueryResult> results;
+    parser.parse_batch(queries, results);
+    for(size_t i = 0; i < queries.size(); i++) {
+      if (queries[i].top) {
+        for(const auto &element : results[i].top) {
+          std::cout << (std::string) element.first << " " << element.second << "\n";
+        }
+      } else {
+        std::cout << results[i].distinct << "\n";
+      }
+      std::cout << "\n";
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // Serve mode: keep the mapping and the index resident, and answer requests
+  if (mode == whyparser_mode_serve) {
+    parser.load_index();
+    YServer server(parser, socket_path, threads);
+    if (!server.listen()) {
+      std::cerr << "could not listen on " << socket_path << ": " << strerror(server.get_error()) << "\n";
+      return EXIT_FAILURE;
+    }
+    std::cerr << "serving " << filename << " on " << socket_path << " with " << server.get_threads() << " threads\n";
+    server.run();
+    return EXIT_SUCCESS;
+  }
 
-  // Set range
-  if (from != 0) {
-    parser.set_start(from);
+  // Process all records; several files are processed at once, and merged
+  // into the first parser (the other mappings must remain alive)
+  std::vector<std::unique_ptr<YParser>> others;
+  if (files.size() == 1) {
+    parser.parse_records();
+  } else {
+    std::vector<YParser*> parsers(1, &parser);
+    for(size_t i = 1; i < files.size(); i++) {
+      others.push_back(std::unique_ptr<YParser>(new YParser(files[i].c_str())));
+      if (!others.back()->is_valid()) {
+        std::cerr << "could not map file " << files[i] << ": " << strerror(others.back()->get_error()) << "\n";
+        return EXIT_FAILURE;
+      }
+      configure(*others.back());
+      parsers.push_back(others.back().get());
+    }
+    const size_t skipped = YParser::parse_files(parsers, threads_set ? threads : 0);
+    std::cerr << files.size() << " files, " << skipped << " skipped\n";
   }
 
-  if (to != std::numeric_limits<time_t>::max()) {
-    parser.set_end(to);
+  // Memory limit exceeded without fallback: the results are incomplete
+  if (parser.is_memory_exceeded()) {
+    std::cerr << "memory limit of " << (max_memory >> 10) << "K exceeded, use --degrade for approximate results\n";
+    return EXIT_FAILURE;
   }
 
-  // Process all records
-  parser.parse_records();
+  // Follow mode: parse appended lines, and print updated results, until killed
+  if (follow != 0) {
+    FileWatcher watcher(filename);
+    if (!watcher.is_valid()) {
+      std::cerr << "could not watch file: " << strerror(watcher.get_error()) << ", polling\n";
+    }
+    for(;;) {
+      print_results(parser, mode, top_queries, approx);
+      std::cout << "\n" << std::flush;
 
-  // And display desired stats
-  switch(mode) {
-  case whyparser_mode_distinct:
-    std::cout << parser.get_distinct_queries() << "\n";
-    break;
-  case whyparser_mode_top:
-    {
-      // Emit sorted (revered) queue
-      for(const auto element : parser.get_top_queries(top_queries)) {
-        std::cout << (std::string) element.first << " " << element.second << "\n";
+      // Wait for changes during a whole interval, then refresh until something new is read
+      size_t records = 0;
+      while(records == 0) {
+        bool changed = false;
+        ChronoTimer timer;
+        const uint64_t interval_ns = follow*UINT64_C(1000000000);
+        for(uint64_t elapsed_ns = 0; elapsed_ns < interval_ns; elapsed_ns += timer.tick_ns()) {
+          changed = watcher.wait(static_cast<int>((interval_ns - elapsed_ns + 999999) / 1000000)) || changed;
+        }
+        if (changed) {
+          records = parser.refresh();
+        }
       }
+      std::cerr << records << " new records read\n";
     }
-    break;
-  default:
-    abort();
-    break;
+  }
+
+  // And display desired stats
+  print_results(parser, mode, top_queries, approx || parser.is_degraded(), metrics.get());
+
+  // Then the structured statistics, with the final tables
+  if (metrics) {
+    metrics->end();
+    parser.add_table_metrics();
+    metrics->write_json(std::cerr);
   }
 
   // That's all, folks!
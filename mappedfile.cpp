@@ -17,10 +17,29 @@
 #include <assert.h>
 #include <errno.h>
 
+#include <string.h>
+
 #include <string>
+#include <algorithm>
 
 #include "mappedfile.hpp"
 
+// Bytes touched by the prefetch thread between two cursor checks
+#define PREFETCH_CHUNK ((size_t) 1 << 20)
+
+/**
+ * Advise a range of a mapped region, rounded to pages.
+ *
+ * @return @c true upon success
+ **/
+static bool advise(const unsigned char *data, size_t from, size_t to, int advice) {
+  const long page = sysconf(_SC_PAGESIZE);
+  assert(page > 0);
+  const uintptr_t addr = (((uintptr_t) &data[from]) / page)*page;
+  const uintptr_t len = (((uintptr_t) &data[to] - addr + page - 1) / page)*page;
+  return len == 0 || madvise((void*) addr, len, advice) == 0;
+}
+
 /* ReadOnlyMemoryMap */
 
 void ReadOnlyMemoryMap::map(const char *filename) {
@@ -54,16 +73,102 @@ void ReadOnlyMemoryMap::map(const char *filename) {
     return ;
   }
 
-  data = reinterpret_cast<unsigned char*>(mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0));
-  if (data == MAP_FAILED) {
+  /* An empty file can not be mapped yet (see grow) */
+  if (size == 0) {
+    return ;
+  }
+
+  void *const region = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED) {
     error = errno;
     unmap();
     return ;
   }
+  data = reinterpret_cast<unsigned char*>(region);
+}
+
+bool ReadOnlyMemoryMap::grow() {
+  struct stat buf;
+  if (fd == -1 || fstat(fd, &buf) != 0 || (size_t) buf.st_size <= size) {
+    return false;
+  }
+  const size_t new_size = (size_t) buf.st_size;
+
+  /* The file was empty: map it for the first time */
+  if (data == NULL) {
+    void *const region = mmap(NULL, new_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+      error = errno;
+      return false;
+    }
+    data = reinterpret_cast<unsigned char*>(region);
+    size = new_size;
+    return true;
+  }
+
+  /* Extend in place, so that the region does not move */
+  void *const extended = mremap(data, size, new_size, 0);
+  if (extended != MAP_FAILED) {
+    assert(extended == data);
+    size = new_size;
+    return true;
+  }
+
+  /* Map again, and retire the previous region */
+  void *const region = mmap(NULL, new_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED) {
+    error = errno;
+    return false;
+  }
+  retired.push_back(std::make_pair(data, size));
+  data = reinterpret_cast<unsigned char*>(region);
+  size = new_size;
+  return true;
+}
+
+bool ReadOnlyMemoryMap::is_replaced(const char *filename) const {
+  struct stat current;
+  struct stat path;
+  return fd != -1 && fstat(fd, &current) == 0 && stat(filename, &path) == 0
+    && (current.st_ino != path.st_ino || current.st_dev != path.st_dev);
+}
+
+bool ReadOnlyMemoryMap::reopen(const char *filename) {
+  ReadOnlyMemoryMap other(filename);
+  if (!other.is_valid()) {
+    error = other.error;
+    return false;
+  }
+
+  /* Retire the current region, and take over the new one */
+  if (data != NULL) {
+    retired.push_back(std::make_pair(data, size));
+    data = NULL;
+  }
+  retired.insert(retired.end(), other.retired.begin(), other.retired.end());
+  other.retired.clear();
+  if (fd != -1 && close(fd) != 0) {
+    perror("unexpected close error");
+    abort();
+  }
+  fd = other.fd;
+  size = other.size;
+  data = other.data;
+  other.fd = -1;
+  other.data = NULL;
+  return true;
 }
 
 void ReadOnlyMemoryMap::unmap() {
-  if (data != NULL && data != MAP_FAILED) {
+  for(const auto &region : retired) {
+    if (munmap(region.first, region.second) != 0) {
+      perror("unexpected munmap error");
+      abort();
+    }
+  }
+  retired.clear();
+
+  if (data != NULL) {
     if (munmap(data, size) != 0) {
       perror("unexpected munmap error");
       abort();
@@ -80,6 +185,71 @@ void ReadOnlyMemoryMap::unmap() {
   }
 }
 
+bool ReadOnlyMemoryMap::set_policy(enum map_policy new_policy, size_t new_window) {
+  assert(new_window != 0);
+  if (fd == -1) {
+    return false;
+  }
+
+  switch(new_policy) {
+  case map_policy_populate:
+    /* Map again at the same address, reading the whole file */
+    if (size != 0 && mmap(data, size, PROT_READ, MAP_SHARED | MAP_FIXED | MAP_POPULATE, fd, 0) == MAP_FAILED) {
+      error = errno;
+      return false;
+    }
+    break;
+  case map_policy_hugepage:
+    /* Only supported by file systems whose page cache holds huge pages */
+    if (!advise(data, 0, size, MADV_HUGEPAGE)) {
+      error = errno;
+      return false;
+    }
+    break;
+  default:
+    break;
+  }
+
+  policy = new_policy;
+  window = new_window;
+  return true;
+}
+
+std::shared_ptr<ReadAhead> ReadOnlyMemoryMap::read_ahead(size_t offset, size_t end) const {
+  if ((policy != map_policy_willneed && policy != map_policy_prefetch && drop_behind == 0) || offset >= end) {
+    return std::shared_ptr<ReadAhead>();
+  }
+  return std::make_shared<ReadAhead>(*this, offset, end);
+}
+
+const char* ReadOnlyMemoryMap::get_policy_name(enum map_policy policy) {
+  switch(policy) {
+  case map_policy_default:
+    return "default";
+  case map_policy_populate:
+    return "populate";
+  case map_policy_hugepage:
+    return "hugepage";
+  case map_policy_willneed:
+    return "willneed";
+  case map_policy_prefetch:
+    return "prefetch";
+  }
+  return "unknown";
+}
+
+bool ReadOnlyMemoryMap::parse_policy(const char *name, enum map_policy &policy) {
+  const enum map_policy policies[] = { map_policy_default, map_policy_populate, map_policy_hugepage,
+                                       map_policy_willneed, map_policy_prefetch };
+  for(const enum map_policy candidate : policies) {
+    if (strcasecmp(name, get_policy_name(candidate)) == 0) {
+      policy = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
 void ReadOnlyMemoryMap::read_tune(size_t offset, bool random) const {
   assert(offset <= size);
 
@@ -93,3 +263,111 @@ void ReadOnlyMemoryMap::read_tune(size_t offset, bool random) const {
   const int ret = madvise((void*) addr, len, random ? MADV_RANDOM : MADV_SEQUENTIAL);
   assert(ret == 0);
 }
+
+/* ReadAhead */
+
+ReadAhead::ReadAhead(const ReadOnlyMemoryMap &map, size_t offset, size_t end):
+  data(map.get_data()),
+  fd(map.fd),
+  policy(map.get_policy()),
+  end(end),
+  window(map.get_window()),
+  step(window / 8 != 0 ? window / 8 : 1),
+  drop_behind(map.get_drop_behind()),
+  dropped((offset + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE)*sysconf(_SC_PAGESIZE)),
+  next(offset),
+  lock(),
+  cond(),
+  cursor(offset),
+  stopped(false),
+  worker()
+{
+  if (policy == map_policy_prefetch) {
+    worker = std::thread([this]() {
+        prefetch();
+      });
+  }
+  update(offset);
+}
+
+ReadAhead::~ReadAhead() {
+  if (worker.joinable()) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      stopped = true;
+    }
+    cond.notify_all();
+    worker.join();
+  }
+}
+
+void ReadAhead::update(size_t offset) {
+  size_t following = end;
+  if (policy == map_policy_prefetch) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      cursor = offset;
+    }
+    cond.notify_all();
+    following = offset + step;
+  } else if (policy == map_policy_willneed || drop_behind != 0) {
+    /* Windows overlap by half, so that the next one is issued before being reached */
+    const size_t stop = end - offset > window ? offset + window : end;
+    advise(data, offset, stop, MADV_WILLNEED);
+    following = offset + window / 2;
+  }
+
+  /* Pages are dropped by half windows */
+  if (drop_behind != 0) {
+    drop(offset);
+    following = std::min(following, dropped + drop_behind + drop_behind / 2);
+  }
+  next = following;
+}
+
+void ReadAhead::drop(size_t offset) {
+  const long page = sysconf(_SC_PAGESIZE);
+  assert(page > 0);
+  if (offset < drop_behind) {
+    return;
+  }
+  const size_t target = (offset - drop_behind) / page*page;
+  if (target < dropped + drop_behind / 2) {
+    return;
+  }
+
+  /* Unmap the pages, so that they can then be evicted from the page cache */
+  advise(data, dropped, target, MADV_DONTNEED);
+  posix_fadvise(fd, dropped, target - dropped, POSIX_FADV_DONTNEED);
+  dropped = target;
+}
+
+void ReadAhead::prefetch() {
+  const long page = sysconf(_SC_PAGESIZE);
+  assert(page > 0);
+  const volatile unsigned char *const bytes = data;
+  unsigned char sink = 0;
+
+  std::unique_lock<std::mutex> guard(lock);
+  size_t touched = cursor;
+  while(!stopped && touched < end) {
+    /* Never lag behind the cursor, nor get more than a window ahead */
+    if (touched < cursor) {
+      touched = cursor;
+    }
+    const size_t limit = end - cursor > window ? cursor + window : end;
+    if (touched >= limit) {
+      cond.wait(guard);
+      continue;
+    }
+
+    /* Touch a chunk of pages, unlocked */
+    const size_t stop = limit - touched > PREFETCH_CHUNK ? touched + PREFETCH_CHUNK : limit;
+    guard.unlock();
+    for(; touched < stop; touched += page) {
+      sink ^= bytes[touched];
+    }
+    guard.lock();
+  }
+  (void) sink;
+}
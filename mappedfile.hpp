@@ -20,10 +20,41 @@
 #include <errno.h>
 
 #include <string>
+#include <vector>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include "refstringmap.hpp"
 
+// Default read-ahead window of the willneed and prefetch policies
+#define MAP_DEFAULT_WINDOW ((size_t) 64 << 20)
+
+/**
+ * Mapping policies, trading memory and startup time for fewer page faults
+ * while scanning a cold file.
+ **/
+enum map_policy {
+  // Plain mapping, with the kernel sequential read-ahead
+  map_policy_default,
+
+  // MAP_POPULATE: the whole file is read (and mapped) upfront
+  map_policy_populate,
+
+  // MADV_HUGEPAGE: huge pages, where the page cache supports them
+  map_policy_hugepage,
+
+  // MADV_WILLNEED windows, issued ahead of the scan cursor
+  map_policy_willneed,
+
+  // A thread touching pages, staying a window ahead of the scan cursor
+  map_policy_prefetch,
+};
+
+class ReadAhead;
+
 /**
  * Read-Only mapping of a file in memory.
 **/
@@ -53,6 +84,73 @@ public:
   **/
   void read_tune(size_t offset, bool random) const;
 
+  /**
+   * Set the mapping policy.
+   *
+   * @param policy The policy
+   * @param window The read-ahead window of the willneed and prefetch policies
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   *         (the default policy is then kept)
+  **/
+  bool set_policy(enum map_policy policy, size_t window = MAP_DEFAULT_WINDOW);
+
+  /**
+   * Return the mapping policy.
+  **/
+  enum map_policy get_policy() const {
+    return policy;
+  }
+
+  /**
+   * Return the read-ahead window.
+  **/
+  size_t get_window() const {
+    return window;
+  }
+
+  /**
+   * Set the drop-behind window: pages of a scanned range lagging more than
+   * a window behind the cursor are dropped from the mapping and from the page
+   * cache, and MADV_WILLNEED read-ahead windows are issued ahead of it, so
+   * that the memory footprint of a scan stays flat whatever the file size.
+   *
+   * @param drop The drop-behind window (0: disabled)
+  **/
+  void set_drop_behind(size_t drop) {
+    drop_behind = drop;
+  }
+
+  /**
+   * Return the drop-behind window (0: disabled).
+  **/
+  size_t get_drop_behind() const {
+    return drop_behind;
+  }
+
+  /**
+   * Start a cursor-driven read-ahead of a range, if the policy (or the
+   * drop-behind window) needs one.
+   *
+   * @param offset The starting offset
+   * @param end The ending offset (exclusive)
+   * @return The read-ahead, to be advanced by the cursor, or @c NULL
+  **/
+  std::shared_ptr<ReadAhead> read_ahead(size_t offset, size_t end) const;
+
+  /**
+   * Get the name of a policy.
+  **/
+  static const char* get_policy_name(enum map_policy policy);
+
+  /**
+   * Parse a policy name.
+   *
+   * @param name The policy name
+   * @param policy The policy to be filled
+   * @return @c true if the name is known
+  **/
+  static bool parse_policy(const char *name, enum map_policy &policy);
+
   /**
    * Return the region size.
    *
@@ -63,12 +161,59 @@ public:
   }
 
   /**
-   * Check if the current region is valid.
+   * Return the region data.
+   *
+   * @return The mapped bytes (read-only)
+  **/
+  const unsigned char* get_data() const {
+    return data;
+  }
+
+  /**
+   * Get the mapped file status.
+   *
+   * @param buf The status buffer to be filled
+   * @return @c true upon success
+  **/
+  bool get_stat(struct stat &buf) const {
+    return fd != -1 && fstat(fd, &buf) == 0;
+  }
+
+  /**
+   * Extend the mapping to the current file size, if the file grew.
+   * The region is extended in place if possible; otherwise the file is mapped
+   * again elsewhere, and the previous region is kept mapped until destruction,
+   * so that references to it remain valid.
+   *
+   * @return @c true if the region grew
+  **/
+  bool grow();
+
+  /**
+   * Has the file path been replaced by another file (eg. rotated) ?
+   *
+   * @param filename The file path
+   * @return @c true if the path now names another file
+  **/
+  bool is_replaced(const char *filename) const;
+
+  /**
+   * Map the file path again (eg. after a rotation). The previous region is
+   * kept mapped until destruction, so that references to it remain valid.
+   *
+   * @param filename The file path
+   * @return @c true upon success; the previous region is kept otherwise
+  **/
+  bool reopen(const char *filename);
+
+  /**
+   * Check if the current region is valid (the region of an empty file is
+   * not mapped until it grows).
    *
    * @return @c true If the region is valid
   **/
   bool is_valid() const {
-    return data != NULL;
+    return fd != -1;
   }
 
   /**
@@ -93,6 +238,14 @@ protected:
   // The last error is the file could not be mapped
   int error;
 
+  // Previous regions, still mapped (see @c grow and @c reopen)
+  std::vector<std::pair<unsigned char*, size_t>> retired;
+
+  // Mapping policy, read-ahead window, and drop-behind window
+  enum map_policy policy;
+  size_t window;
+  size_t drop_behind;
+
 protected:
   /**
    * Map the file in memory.
@@ -108,11 +261,90 @@ protected:
 
 private:
   /* Default constructor, used as delegating constructor */
-  ReadOnlyMemoryMap(): fd(-1), size(0), data(NULL), error(0) { }
+  ReadOnlyMemoryMap(): fd(-1), size(0), data(NULL), error(0), policy(map_policy_default), window(MAP_DEFAULT_WINDOW),
+                       drop_behind(0) { }
 
   /* Forbidden foes */
   ReadOnlyMemoryMap(const ReadOnlyMemoryMap&) = delete;
   ReadOnlyMemoryMap& operator=(const ReadOnlyMemoryMap&) = delete;
+
+  /* Pages are dropped from the page cache through the file descriptor */
+  friend class ReadAhead;
+};
+
+/**
+ * Read-ahead of a mapped range, driven by a scan cursor (see @c map_policy):
+ * either MADV_WILLNEED windows are issued as the cursor moves, or a thread
+ * touches the pages of the window following the cursor, taking the page
+ * faults of a cold file in place of the scan. Pages lagging more than the
+ * drop-behind window behind the cursor are dropped, if enabled.
+ **/
+class ReadAhead {
+public:
+  /**
+   * Start the read-ahead of a range.
+   *
+   * @param map The mapped region
+   * @param offset The starting offset
+   * @param end The ending offset (exclusive)
+   **/
+  ReadAhead(const ReadOnlyMemoryMap &map, size_t offset, size_t end);
+
+  /**
+   * Destructor; stop the prefetch thread.
+   **/
+  ~ReadAhead();
+
+  /**
+   * Move the cursor; cheap unless the next step is reached.
+   *
+   * @param offset The cursor offset
+   **/
+  void advance(size_t offset) {
+    if (offset >= next) {
+      update(offset);
+    }
+  }
+
+protected:
+  /** Issue the window following the cursor. **/
+  void update(size_t offset);
+
+  /** Drop the pages lagging behind the cursor. **/
+  void drop(size_t offset);
+
+  /** Prefetch thread loop. **/
+  void prefetch();
+
+protected:
+  // Mapped data, its file descriptor, and the policy
+  const unsigned char *const data;
+  const int fd;
+  const enum map_policy policy;
+
+  // Ending offset, window, and cursor step between two updates
+  const size_t end;
+  const size_t window;
+  const size_t step;
+
+  // Drop-behind window, and offset (page aligned) up to which pages were dropped
+  const size_t drop_behind;
+  size_t dropped;
+
+  // Next cursor offset to update at
+  size_t next;
+
+  // Prefetch thread cursor, and synchronization
+  std::mutex lock;
+  std::condition_variable cond;
+  size_t cursor;
+  bool stopped;
+  std::thread worker;
+
+private:
+  /* Forbidden foes */
+  ReadAhead(const ReadAhead&) = delete;
+  ReadAhead& operator=(const ReadAhead&) = delete;
 };
 
 #endif
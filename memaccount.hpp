@@ -0,0 +1,177 @@
+/**
+ * Memory Accounting.
+ * Allocations accounting of the aggregation structures, and their memory limit
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_MEMACCOUNT_HPP
+#define RX_MEMACCOUNT_HPP
+
+#include <stddef.h>
+
+#include <atomic>
+#include <new>
+#include <type_traits>
+
+/**
+ * Memory account: live and peak bytes, live blocks and total allocations of
+ * the containers allocating through an @c AccountingAllocator, and an
+ * optional limit. The account may be shared by containers of several threads.
+ * The limit does not make allocations fail: it is only noted as exceeded,
+ * and checked by the users of the containers (see @c is_exceeded).
+ **/
+class MemoryAccount {
+public:
+  /**
+   * Create an account.
+   *
+   * @param limit The limit of live bytes (0: unlimited)
+   **/
+  explicit MemoryAccount(size_t limit = 0):
+    bytes(0), peak(0), blocks(0), allocations(0), limit(limit), exceeded(false)
+  {
+  }
+
+  /**
+   * Account an allocation.
+   *
+   * @param size The allocation size, in bytes
+   **/
+  void allocate(size_t size) {
+    const size_t current = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    blocks.fetch_add(1, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    for(size_t highest = peak.load(std::memory_order_relaxed);
+        current > highest && !peak.compare_exchange_weak(highest, current, std::memory_order_relaxed); ) ;
+    if (limit != 0 && current > limit) {
+      exceeded.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Account a deallocation.
+   *
+   * @param size The allocation size, in bytes
+   **/
+  void release(size_t size) {
+    bytes.fetch_sub(size, std::memory_order_relaxed);
+    blocks.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /** Return the live bytes. **/
+  size_t get_bytes() const {
+    return bytes.load(std::memory_order_relaxed);
+  }
+
+  /** Return the highest live bytes. **/
+  size_t get_peak() const {
+    return peak.load(std::memory_order_relaxed);
+  }
+
+  /** Return the number of live blocks. **/
+  size_t get_blocks() const {
+    return blocks.load(std::memory_order_relaxed);
+  }
+
+  /** Return the total number of allocations. **/
+  size_t get_allocations() const {
+    return allocations.load(std::memory_order_relaxed);
+  }
+
+  /** Return the limit (0: unlimited). **/
+  size_t get_limit() const {
+    return limit;
+  }
+
+  /** Were the live bytes ever above the limit ? **/
+  bool is_exceeded() const {
+    return exceeded.load(std::memory_order_relaxed);
+  }
+
+protected:
+  // Live bytes, and their peak
+  std::atomic<size_t> bytes;
+  std::atomic<size_t> peak;
+
+  // Live blocks, and total allocations
+  std::atomic<size_t> blocks;
+  std::atomic<size_t> allocations;
+
+  // Limit, and was it exceeded
+  const size_t limit;
+  std::atomic<bool> exceeded;
+
+private:
+  /* Forbidden foes */
+  MemoryAccount(const MemoryAccount&) = delete;
+  MemoryAccount& operator=(const MemoryAccount&) = delete;
+};
+
+/**
+ * Standard allocator accounting its allocations in a @c MemoryAccount (none
+ * if @c NULL). The account follows the containers when they are copied,
+ * assigned or swapped.
+ **/
+template<typename T>
+class AccountingAllocator {
+public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  /**
+   * Create an allocator.
+   *
+   * @param account The memory account, or @c NULL
+   **/
+  explicit AccountingAllocator(MemoryAccount *account = NULL) noexcept: account(account)
+  {
+  }
+
+  /** Rebinding constructor. **/
+  template<typename U>
+  AccountingAllocator(const AccountingAllocator<U> &other) noexcept: account(other.get_account())
+  {
+  }
+
+  /** Standard allocator allocate(). **/
+  T* allocate(size_t n) {
+    if (account != NULL) {
+      account->allocate(n*sizeof(T));
+    }
+    return static_cast<T*>(::operator new(n*sizeof(T)));
+  }
+
+  /** Standard allocator deallocate(). **/
+  void deallocate(T *p, size_t n) noexcept {
+    if (account != NULL) {
+      account->release(n*sizeof(T));
+    }
+    ::operator delete(p);
+  }
+
+  /** Return the memory account, or @c NULL. **/
+  MemoryAccount* get_account() const {
+    return account;
+  }
+
+protected:
+  // Memory account
+  MemoryAccount *account;
+};
+
+/** Allocators are interchangeable if they share their account. **/
+template<typename T, typename U>
+bool operator==(const AccountingAllocator<T> &a, const AccountingAllocator<U> &b) {
+  return a.get_account() == b.get_account();
+}
+
+template<typename T, typename U>
+bool operator!=(const AccountingAllocator<T> &a, const AccountingAllocator<U> &b) {
+  return !(a == b);
+}
+
+#endif
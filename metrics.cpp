@@ -0,0 +1,232 @@
+/**
+ * Run Metrics.
+ * Per-phase wall time and hardware counters, and named values, reported as JSON
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <sstream>
+
+#include "metrics.hpp"
+
+/* PerfCounters */
+
+PerfCounters::PerfCounters(): error(0) {
+  for(int &fd : fds) {
+    fd = -1;
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  close();
+}
+
+bool PerfCounters::open() {
+  static const uint64_t configs[PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+  };
+
+  close();
+  for(size_t i = 0; i < PERF_COUNTERS; i++) {
+    // Counters of the process, on any CPU, inherited by the threads created
+    // afterwards (inherited counters can not be read as a group)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    const long fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1) {
+      error = errno;
+      close();
+      return false;
+    }
+    fds[i] = static_cast<int>(fd);
+  }
+  return true;
+}
+
+void PerfCounters::close() {
+  for(int &fd : fds) {
+    if (fd != -1) {
+      if (::close(fd) != 0) {
+        perror("unexpected close error");
+        abort();
+      }
+      fd = -1;
+    }
+  }
+}
+
+void PerfCounters::read(uint64_t *values) const {
+  for(size_t i = 0; i < PERF_COUNTERS; i++) {
+    values[i] = 0;
+    if (fds[i] != -1 && ::read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+      perror("unexpected read error");
+      abort();
+    }
+  }
+}
+
+const char* PerfCounters::get_name(size_t counter) {
+  switch(counter) {
+  case 0:
+    return "cycles";
+  case 1:
+    return "instructions";
+  case 2:
+    return "llc_misses";
+  }
+  return "unknown";
+}
+
+/* Metrics */
+
+Metrics::Metrics(bool hardware): timer(), perf(), hardware(hardware), phases(), current(), running(false) {
+  if (hardware) {
+    perf.open();
+  }
+  memset(counters, 0, sizeof(counters));
+}
+
+uint64_t Metrics::phase(const char *name) {
+  const uint64_t elapsed = end();
+  current = name;
+  running = true;
+  perf.read(counters);
+  timer.tick_ns();
+  return elapsed;
+}
+
+uint64_t Metrics::end() {
+  if (!running) {
+    return 0;
+  }
+  Phase ended;
+  ended.name = current;
+  ended.ns = timer.tick_ns();
+  perf.read(ended.counters);
+  for(size_t i = 0; i < PERF_COUNTERS; i++) {
+    ended.counters[i] -= counters[i];
+  }
+  phases.push_back(ended);
+  running = false;
+  return ended.ns;
+}
+
+uint64_t Metrics::get_phase_ns(const char *name) const {
+  uint64_t ns = 0;
+  for(const Phase &phase : phases) {
+    if (phase.name == name) {
+      ns += phase.ns;
+    }
+  }
+  return ns;
+}
+
+void Metrics::set(const char *key, double value) {
+  for(auto &element : values) {
+    if (element.first == key) {
+      element.second = value;
+      return;
+    }
+  }
+  values.push_back(std::make_pair(std::string(key), value));
+}
+
+void Metrics::set_histogram(const char *key, const std::vector<size_t> &histogram) {
+  for(auto &element : histograms) {
+    if (element.first == key) {
+      element.second = histogram;
+      return;
+    }
+  }
+  histograms.push_back(std::make_pair(std::string(key), histogram));
+}
+
+size_t Metrics::get_peak_rss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return static_cast<size_t>(usage.ru_maxrss)*1024;
+}
+
+std::string Metrics::quote(const std::string &s) {
+  std::ostringstream quoted;
+  quoted << '"';
+  for(const char c : s) {
+    if (c == '"' || c == '\\') {
+      quoted << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static const char hex[] = "0123456789abcdef";
+      quoted << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+    } else {
+      quoted << c;
+    }
+  }
+  quoted << '"';
+  return quoted.str();
+}
+
+void Metrics::write_json(std::ostream &stream) const {
+  std::ostringstream json;
+  json.precision(15);
+
+  // Phases, in order
+  uint64_t total = 0;
+  json << "{\n  \"phases\": [";
+  for(size_t i = 0; i < phases.size(); i++) {
+    const Phase &phase = phases[i];
+    json << (i != 0 ? "," : "") << "\n    {\"name\": " << quote(phase.name) << ", \"ns\": " << phase.ns;
+    if (perf.is_valid()) {
+      for(size_t j = 0; j < PERF_COUNTERS; j++) {
+        json << ", " << quote(PerfCounters::get_name(j)) << ": " << phase.counters[j];
+      }
+    }
+    json << "}";
+    total += phase.ns;
+  }
+  json << "\n  ],\n  \"total_ns\": " << total;
+
+  // Values, and histograms
+  for(const auto &element : values) {
+    json << ",\n  " << quote(element.first) << ": " << element.second;
+  }
+  for(const auto &element : histograms) {
+    json << ",\n  " << quote(element.first) << ": [";
+    for(size_t i = 0; i < element.second.size(); i++) {
+      json << (i != 0 ? ", " : "") << element.second[i];
+    }
+    json << "]";
+  }
+  json << ",\n  \"peak_rss\": " << get_peak_rss();
+
+  // Hardware counters availability
+  if (hardware) {
+    json << ",\n  \"perf\": {\"available\": " << (perf.is_valid() ? "true" : "false");
+    if (!perf.is_valid()) {
+      json << ", \"error\": " << quote(strerror(perf.get_error()));
+    }
+    json << "}";
+  }
+  json << "\n}\n";
+
+  // Single write
+  stream << json.str();
+}
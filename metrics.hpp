@@ -0,0 +1,196 @@
+/**
+ * Run Metrics.
+ * Per-phase wall time and hardware counters, and named values, reported as JSON
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_METRICS_HPP
+#define RX_METRICS_HPP
+
+#include <inttypes.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "chrono.hpp"
+
+// Number of hardware counters (cycles, instructions, LLC misses)
+#define PERF_COUNTERS 3
+
+/**
+ * Hardware counters of the process, and of the threads it creates once
+ * opened (perf_event_open(2)); counters of a thread are added when it exits.
+ **/
+class PerfCounters {
+public:
+  PerfCounters();
+
+  /**
+   * Destructor; close the counters.
+   **/
+  ~PerfCounters();
+
+  /**
+   * Open and start the counters.
+   *
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   *         (eg. not permitted by the perf_event_paranoid setting)
+   **/
+  bool open();
+
+  /**
+   * Are the counters opened ?
+   **/
+  bool is_valid() const {
+    return fds[0] != -1;
+  }
+
+  /**
+   * Read the current counters values.
+   *
+   * @param values The values to be filled, of PERF_COUNTERS counters
+   **/
+  void read(uint64_t *values) const;
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+  /**
+   * Get the name of a counter.
+   **/
+  static const char* get_name(size_t counter);
+
+protected:
+  /** Close the counters. **/
+  void close();
+
+protected:
+  // Counters file descriptors
+  int fds[PERF_COUNTERS];
+
+  // Last error
+  int error;
+
+private:
+  /* Forbidden foes */
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+};
+
+/**
+ * Metrics of a run: consecutive named phases, timed with a ChronoTimer (and
+ * optional hardware counters), and named values, written as a JSON object.
+ * Phases are not thread-safe: they are delimited by a single thread.
+ **/
+class Metrics {
+public:
+  /**
+   * Create metrics.
+   *
+   * @param hardware If @c true, also measure hardware counters of phases, if possible
+   **/
+  explicit Metrics(bool hardware = false);
+
+  /**
+   * End the current phase, if any, and start a new one.
+   *
+   * @param name The phase name
+   * @return The duration of the ended phase, in nanoseconds
+   **/
+  uint64_t phase(const char *name);
+
+  /**
+   * End the current phase, if any.
+   *
+   * @return The duration of the ended phase, in nanoseconds
+   **/
+  uint64_t end();
+
+  /**
+   * Get the total duration of the phases of a given name.
+   *
+   * @param name The phase name
+   * @return The duration, in nanoseconds
+   **/
+  uint64_t get_phase_ns(const char *name) const;
+
+  /**
+   * Set a named value.
+   *
+   * @param key The value name
+   * @param value The value
+   **/
+  void set(const char *key, double value);
+
+  /**
+   * Set a named histogram.
+   *
+   * @param key The histogram name
+   * @param histogram The histogram buckets
+   **/
+  void set_histogram(const char *key, const std::vector<size_t> &histogram);
+
+  /**
+   * Write the metrics as a JSON object; the peak RSS of the process is added.
+   *
+   * @param stream The output stream
+   **/
+  void write_json(std::ostream &stream) const;
+
+  /**
+   * Return the peak RSS of the process, in bytes.
+   **/
+  static size_t get_peak_rss();
+
+  /**
+   * Quote a JSON string.
+   **/
+  static std::string quote(const std::string &s);
+
+protected:
+  /**
+   * Ended phase.
+   **/
+  struct Phase {
+    // Name
+    std::string name;
+
+    // Duration, in nanoseconds
+    uint64_t ns;
+
+    // Hardware counters deltas (if measured)
+    uint64_t counters[PERF_COUNTERS];
+  };
+
+protected:
+  // Phase timer, and hardware counters (if requested)
+  ChronoTimer timer;
+  PerfCounters perf;
+  const bool hardware;
+
+  // Ended phases
+  std::vector<Phase> phases;
+
+  // Current phase, and its starting counters
+  std::string current;
+  bool running;
+  uint64_t counters[PERF_COUNTERS];
+
+  // Named values, and histograms, in insertion order
+  std::vector<std::pair<std::string, double>> values;
+  std::vector<std::pair<std::string, std::vector<size_t>>> histograms;
+
+private:
+  /* Forbidden foes */
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+};
+
+#endif
@@ -10,7 +10,9 @@
 #define RX_RECORDS_HPP
 
 #include <string>
+#include <vector>
 #include <functional>
+#include <memory>
 #include <iostream>
 
 #include "mappedfile.hpp"
@@ -112,6 +114,41 @@ public:
     return RecordLocation<T>(*this, 0);
   }
 
+  /**
+   * Split a location into (at most) @c count consecutive locations, each
+   * one starting and ending on a record frontier. Empty chunks are merged.
+   *
+   * @param location The location to be split
+   * @param count The desired number of chunks
+   * @param min_size The minimum size of a chunk, in bytes
+   * @return The list of chunks, in file order, spanning the whole location
+  **/
+  std::vector<RecordLocation<T>> split(const RecordLocation<T> &location, size_t count, size_t min_size = 0) const {
+    assert(count != 0);
+
+    const size_t left = location.get_offset();
+    const size_t right = location.get_end();
+    const size_t span = right - left;
+
+    /* Do not create too small chunks */
+    if (min_size != 0 && span / min_size < count) {
+      count = span / min_size != 0 ? span / min_size : 1;
+    }
+
+    std::vector<RecordLocation<T>> chunks;
+    size_t start = left;
+    for(size_t i = 1; i <= count; i++) {
+      /* Align the chunk end on a record frontier */
+      const size_t stop = i != count ? begin(left + (span / count)*i) : right;
+      if (stop > start) {
+        chunks.push_back(RecordLocation<T>(*this, start, stop));
+        start = stop;
+      }
+    }
+
+    return chunks;
+  }
+
 protected:
   /**
    * Locate a specific record in a sorted set of records, using a binary search.
@@ -207,18 +244,41 @@ class RecordIterator;
 template <typename T>
 class RecordLocation {
 public:
-  RecordLocation(const MappedRecords<T> &map, size_t offset): map(map), offset(offset), size(map.get_size())
+  RecordLocation(const MappedRecords<T> &map, size_t offset): RecordLocation(map, offset, map.get_size())
   {
   }
 
+  /**
+   * Create a bounded location.
+   *
+   * @param map The upstream mapped records object
+   * @param offset The starting offset, on a record frontier
+   * @param limit The ending offset (exclusive), on a record frontier (or equal to the region size)
+  **/
+  RecordLocation(const MappedRecords<T> &map, size_t offset, size_t limit): map(map), offset(offset), size(limit)
+  {
+    assert(offset <= size);
+    assert(size <= map.get_size());
+  }
+
   /** Standard iterator begin(). **/
   RecordIterator<T> begin() const {
-    return RecordIterator<T>(map, offset);
+    return RecordIterator<T>(map, offset, size);
   }
 
   /** Standard iterator end(). **/
   RecordIterator<T> end() const {
-    return RecordIterator<T>(map, size);
+    return RecordIterator<T>(map, size, size);
+  }
+
+  /** Starting offset. **/
+  size_t get_offset() const {
+    return offset;
+  }
+
+  /** Ending offset (exclusive). **/
+  size_t get_end() const {
+    return size;
   }
 
 protected:
@@ -228,7 +288,7 @@ protected:
   // The offset within the mapped file
   const size_t offset;
 
-  // Mapped size
+  // Ending offset (mapped size if unbounded)
   const size_t size;
 };
 
@@ -238,7 +298,8 @@ protected:
 template <typename T>
 class RecordIterator: public std::iterator<std::input_iterator_tag, T> {
 public:
-  RecordIterator(const MappedRecords<T> &map, size_t offs): map(map), current(offs), offset(offs), size(map.get_size()) {
+  RecordIterator(const MappedRecords<T> &map, size_t offs, size_t limit): map(map), current(offs), offset(offs), size(limit),
+                                                                         ahead(map.read_ahead(offs, limit)) {
     assert(offset <= size);
     if (offset != size) {
       // Tune for linear read
@@ -253,6 +314,9 @@ public:
   RecordIterator& operator++() {
     current = offset;
     map.get_record(record, offset);
+    if (ahead) {
+      ahead->advance(offset);
+    }
     return *this;
   }
 
@@ -277,12 +341,15 @@ protected:
   // Next offset
   size_t offset;
 
-  // Mapped size
+  // Ending offset
   const size_t size;
 
   // Temporary object placeholder
   T record;
 
+  // Cursor-driven read-ahead, if needed by the mapping policy (shared by copies)
+  std::shared_ptr<ReadAhead> ahead;
+
 private:
   /* Forbidden foes */
   RecordIterator() = delete;
@@ -10,50 +10,24 @@
 #define RX_REFSTRING_MAP_HPP
 
 #include <string.h>
-#include <unordered_map>
-#include <queue>
-
-/**
- * Simple FNV1-a hash function
- * See <https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function>
- **/
-static uint64_t fnv1a_hash(const unsigned char *str, size_t size) {
-  uint64_t hash = 0xcbf29ce484222325;
-  for(size_t i = 0; i < size; i++) {
-    hash ^= str[i];
-    hash *= 1099511628211;
-  }
-  return hash;
-}
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
 
-#if 1
-/**
- * Simple FNV1-a hash function, optimized (source should ideally be aligned to 64-bit)
- * Only aimed for platforms where unaligned access is tolerated (typically x86*)
- * Note that this is actually a visible optimization, reducing overall program time by ~30%.
- * Ideally, this function should be improved to read aligned access only
- * See <https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function>
- **/
-static uint64_t fnv1a_hash_fast(const unsigned char *str, size_t size) {
-  // Strictly speaking, this is an aliasing violation
-  const uint64_t *longs = reinterpret_cast<const uint64_t*>(str);
-  const size_t size64 = size / 8;
-  uint64_t hash = 0xcbf29ce484222325;
-  for(size_t i = 0; i < size64; i++) {
-    hash ^= longs[i];
-    hash *= 1099511628211;
-  }
-  // Remaining bytes
-  const size_t remain = size - size64*8;
-  if (remain != 0) {
-    hash ^= fnv1a_hash(&str[size64*8], remain);
-    hash *= 1099511628211;
-  }
-  return hash;
-}
-#define fnv1a_hash fnv1a_hash_fast
+#ifdef __SSE2__
+#include <emmintrin.h>
 #endif
 
+#include <iostream>
+#include <iterator>
+#include <queue>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#include "hashing.hpp"
+#include "memaccount.hpp"
+
 /**
  * A reference string (a const char*, and a length)
  * The goal is to avoid storing the string twice in memory, and reduce allocator pressure.
@@ -61,7 +35,7 @@ static uint64_t fnv1a_hash_fast(const unsigned char *str, size_t size) {
 class RefString {
 public:
   /** Default constructor **/
-  RefString(): str(NULL), len(0)
+  RefString(): str(NULL), len(0), cached_hash(0)
   {
   }
 
@@ -71,7 +45,18 @@ public:
    * @param str The string pointer
    * @param len The string length
   **/
-  RefString(const char *str, size_t len): str(str), len(len)
+  RefString(const char *str, size_t len): str(str), len(len), cached_hash(0)
+  {
+  }
+
+  /**
+   * Create a new reference string object, with its hash already computed.
+   *
+   * @param str The string pointer
+   * @param len The string length
+   * @param hash The string hash, using the default hash policy (0 if unknown)
+  **/
+  RefString(const char *str, size_t len, size_t hash): str(str), len(len), cached_hash(hash)
   {
   }
 
@@ -81,7 +66,7 @@ public:
    * @param str The string pointer
    * @param len The string length
   **/
-  RefString(const char *str): str(str), len(strlen(str))
+  RefString(const char *str): str(str), len(strlen(str)), cached_hash(0)
   {
   }
 
@@ -89,15 +74,32 @@ public:
    * Equality operator.
   **/
   bool operator==(const RefString &other) const {
-    return len == other.len && strncmp(str, other.str, len) == 0;
+    return len == other.len
+      && (cached_hash == 0 || other.cached_hash == 0 || cached_hash == other.cached_hash)
+      && memcmp(str, other.str, len) == 0;
+  }
+
+  /**
+   * Ordering operator (bytewise, shortest first on common prefix).
+  **/
+  bool operator<(const RefString &other) const {
+    const int cmp = memcmp(str, other.str, len < other.len ? len : other.len);
+    return cmp < 0 || (cmp == 0 && len < other.len);
   }
 
   /**
    * Hash this object. The hash is suitable for hashtable handling.
   **/
   size_t hash() const {
-    /* Use FNV1-a. We probably could use a 128-bit version, XOR-folded, for better results. */
-    return static_cast<size_t>(fnv1a_hash(reinterpret_cast<const unsigned char*>(str), len));
+    return cached_hash != 0 ? cached_hash : hash<DefaultHashPolicy>();
+  }
+
+  /**
+   * Hash this object with a specific hash policy (see hashing.hpp).
+  **/
+  template<typename Policy>
+  size_t hash() const {
+    return static_cast<size_t>(Policy::hash(reinterpret_cast<const unsigned char*>(str), len));
   }
 
   /**
@@ -130,10 +132,24 @@ public:
 
   // String length (if 0, 'str' is meaningless)
   size_t len;
+
+  // Hash computed upstream (typically, while tokenizing), using the default policy; 0 if unknown
+  size_t cached_hash;
 };
 
-/** Hash for RefString class. **/
-struct RefStringHash
+/** Hash for RefString class, given a hash policy (see hashing.hpp). **/
+template<typename Policy = DefaultHashPolicy>
+struct RefStringPolicyHash
+{
+  std::size_t operator()(RefString const& s) const noexcept
+  {
+    return s.hash<Policy>();
+  }
+};
+
+/** Hash for RefString class, using the default policy: the cached hash is used if known. **/
+template<>
+struct RefStringPolicyHash<DefaultHashPolicy>
 {
   std::size_t operator()(RefString const& s) const noexcept
   {
@@ -141,6 +157,9 @@ struct RefStringHash
   }
 };
 
+/** Hash for RefString class (default policy). **/
+typedef RefStringPolicyHash<> RefStringHash;
+
 /** Comparison for RefString class. **/
 struct RefStringCompare
 {
@@ -152,10 +171,451 @@ struct RefStringCompare
 /**
  * A reference string unordered map.
  * The provided T shall be an integer numerical type.
+ *
+ * This is an open-addressing table, with Swiss-style probing: slots are
+ * grouped by 16, and each slot has a control byte (empty marker, or 7-bit
+ * fingerprint of the hash), so that a whole group is probed at once (SSE2).
+ * Slots are stored flat (no node per key), with the full hash cached, so that
+ * keys (pointing to mapped memory) are only compared on a probable match.
+ * Elements can not be removed. Tables are allocated through an
+ * @c AccountingAllocator, and copies share the account of their origin.
 **/
-template<typename T>
-class RefStringUnorderedHashMap: public std::unordered_map<RefString, T, RefStringHash>
+template<typename T, typename Hash = RefStringHash>
+class RefStringUnorderedHashMap
 {
+public:
+  /** Element type, as seen by iterators. **/
+  typedef std::pair<RefString, T> value_type;
+
+  /**
+   * Create an empty map (no allocation is done until the first insertion).
+   *
+   * @param account The memory account of the tables, or @c NULL
+  **/
+  explicit RefStringUnorderedHashMap(MemoryAccount *account = NULL):
+    control(AccountingAllocator<unsigned char>(account)), slots(AccountingAllocator<Slot>(account)),
+    count(0), group_mask(0)
+  {
+  }
+
+  /**
+   * Get the value associated with a key, inserting a zero-initialized one if needed.
+   *
+   * @param key The key
+   * @return The value reference, valid until the next insertion
+  **/
+  T& operator[](const RefString &key) {
+    return insert(key, static_cast<uint64_t>(Hash()(key)));
+  }
+
+  /**
+   * Get the value associated with a key whose hash is known, inserting a
+   * zero-initialized one if needed.
+   *
+   * @param key The key
+   * @param hash The key hash (using this map hash policy)
+   * @return The value reference, valid until the next insertion
+  **/
+  T& insert(const RefString &key, uint64_t hash) {
+    return insert(key, hash, [](const RefString &inserted) {
+        return inserted.str;
+      });
+  }
+
+  /**
+   * Get the value associated with a key whose hash is known, inserting a
+   * zero-initialized one if needed; an inserted key is stored through a
+   * copier, so that transient keys (eg. within a recycled read buffer) can be
+   * counted.
+   *
+   * @param key The key
+   * @param hash The key hash (using this map hash policy)
+   * @param copy The copier, returning the stored bytes of a new key (see KeyArena)
+   * @return The value reference, valid until the next insertion
+  **/
+  template<typename Copy>
+  T& insert(const RefString &key, uint64_t hash, Copy copy) {
+    size_t position;
+    if (find(key, hash, position)) {
+      return slots[position].value;
+    }
+
+    // Grow if needed, and locate the new slot position
+    if (count >= max_load()) {
+      rehash(groups() != 0 ? groups()*2 : 1);
+      find(key, hash, position);
+    }
+
+    // Claim the slot
+    if (key.len > UINT32_MAX) {
+      std::cerr << "key too large\n";
+      abort();
+    }
+    Slot &slot = slots[position];
+    control[position] = fingerprint(hash);
+    slot.str = copy(key);
+    slot.len = static_cast<uint32_t>(key.len);
+    slot.value = T();
+    slot.hash = hash;
+    count++;
+
+    return slot.value;
+  }
+
+  /**
+   * Prefetch the home group of a key hash (control bytes and first slots).
+   *
+   * @param hash The key hash
+  **/
+  void prefetch(uint64_t hash) const {
+    if (!slots.empty()) {
+      const size_t group = home(hash, group_mask);
+      __builtin_prefetch(&control[group*GROUP_SIZE]);
+      __builtin_prefetch(&slots[group*GROUP_SIZE]);
+    }
+  }
+
+  /**
+   * Add a value to a batch of keys: all hashes are computed and their home
+   * groups prefetched first, and only then are the values updated, so that
+   * cache misses of consecutive keys overlap instead of being serialized.
+   *
+   * @param keys The keys
+   * @param count The number of keys
+   * @param value The value to be added to each key
+  **/
+  void add_batch(const RefString *keys, size_t keys_count, T value = 1) {
+    add_batch(keys, keys_count, value, [](const RefString &inserted) {
+        return inserted.str;
+      });
+  }
+
+  /**
+   * Add a value to a batch of keys, inserted keys being stored through a
+   * copier (see @c insert).
+   *
+   * @param keys The keys
+   * @param count The number of keys
+   * @param value The value to be added to each key
+   * @param copy The copier, returning the stored bytes of a new key
+  **/
+  template<typename Copy>
+  void add_batch(const RefString *keys, size_t keys_count, T value, Copy copy) {
+    uint64_t hashes[BATCH_MAX];
+    while(keys_count != 0) {
+      const size_t batch = keys_count < BATCH_MAX ? keys_count : static_cast<size_t>(BATCH_MAX);
+      // Grow beforehand, so that prefetched groups stay valid
+      if (count + batch > max_load()) {
+        reserve(count + batch);
+      }
+      for(size_t i = 0; i < batch; i++) {
+        hashes[i] = static_cast<uint64_t>(Hash()(keys[i]));
+        prefetch(hashes[i]);
+      }
+      for(size_t i = 0; i < batch; i++) {
+        insert(keys[i], hashes[i], copy) += value;
+      }
+      keys += batch;
+      keys_count -= batch;
+    }
+  }
+
+  /**
+   * Merge another map, adding its values.
+   *
+   * @param other The other map (with the same hash policy)
+  **/
+  void merge(const RefStringUnorderedHashMap &other) {
+    for(size_t i = 0; i < other.slots.size(); i++) {
+      if (other.control[i] != CONTROL_EMPTY) {
+        const Slot &slot = other.slots[i];
+        insert(RefString(slot.str, slot.len), slot.hash) += slot.value;
+      }
+    }
+  }
+
+  /** Number of elements. **/
+  size_t size() const {
+    return count;
+  }
+
+  /** Is the map empty ? **/
+  bool empty() const {
+    return count == 0;
+  }
+
+  /** Number of slots. **/
+  size_t bucket_count() const {
+    return slots.size();
+  }
+
+  /** Reserve room for at least @c elements elements. **/
+  void reserve(size_t elements) {
+    size_t wanted = 1;
+    while(wanted*GROUP_SIZE*MAX_LOAD_NUM/MAX_LOAD_DEN < elements) {
+      wanted *= 2;
+    }
+    if (wanted > groups()) {
+      rehash(wanted);
+    }
+  }
+
+  /** Remove all elements, and release memory. **/
+  void clear() {
+    RefStringUnorderedHashMap(get_account()).swap(*this);
+  }
+
+  /** Return the memory account of the tables, or @c NULL. **/
+  MemoryAccount* get_account() const {
+    return slots.get_allocator().get_account();
+  }
+
+  /** Return the allocated bytes of the tables. **/
+  size_t get_memory() const {
+    return control.capacity()*sizeof(unsigned char) + slots.capacity()*sizeof(Slot);
+  }
+
+  /**
+   * Return the bytes of the tables used by elements (the remaining ones,
+   * vacant slots kept by the load factor, are the fragmentation).
+  **/
+  size_t get_used_memory() const {
+    return count*(sizeof(unsigned char) + sizeof(Slot));
+  }
+
+  /** Swap with another map. **/
+  void swap(RefStringUnorderedHashMap &other) {
+    control.swap(other.control);
+    slots.swap(other.slots);
+    std::swap(count, other.count);
+    std::swap(group_mask, other.group_mask);
+  }
+
+  /**
+   * Compute the probe length histogram.
+   *
+   * @param histogram Filled with the number of elements found after probing 1, 2, ... groups
+  **/
+  void get_probe_histogram(std::vector<size_t> &histogram) const {
+    histogram.clear();
+    for(size_t i = 0; i < slots.size(); i++) {
+      if (control[i] != CONTROL_EMPTY) {
+        size_t group = home(slots[i].hash, group_mask);
+        size_t probes = 1;
+        for(size_t step = 1; group != i / GROUP_SIZE; step++, probes++) {
+          group = (group + step) & group_mask;
+        }
+        if (histogram.size() < probes) {
+          histogram.resize(probes);
+        }
+        histogram[probes - 1]++;
+      }
+    }
+  }
+
+  /**
+   * Elements iterator (in slot order).
+  **/
+  class const_iterator: public std::iterator<std::forward_iterator_tag, value_type> {
+  public:
+    const_iterator(const RefStringUnorderedHashMap &map, size_t position): map(map), position(position) {
+      skip();
+    }
+
+    /** Standard iterator operator++. **/
+    const_iterator& operator++() {
+      position++;
+      skip();
+      return *this;
+    }
+
+    /** Standard iterator operator!=. **/
+    bool operator != (const const_iterator &other) const {
+      return position != other.position;
+    }
+
+    /** Standard iterator operator*. **/
+    value_type operator * () const {
+      const Slot &slot = map.slots[position];
+      // The cached hash is only meaningful for the default policy
+      return value_type(RefString(slot.str, slot.len, std::is_same<Hash, RefStringHash>::value ? slot.hash : 0), slot.value);
+    }
+
+  protected:
+    /** Skip empty slots. **/
+    void skip() {
+      for(; position < map.control.size() && map.control[position] == CONTROL_EMPTY; position++) ;
+    }
+
+  protected:
+    // The upstream map
+    const RefStringUnorderedHashMap &map;
+
+    // Current slot
+    size_t position;
+  };
+
+  /** Standard iterator begin(). **/
+  const_iterator begin() const {
+    return const_iterator(*this, 0);
+  }
+
+  /** Standard iterator end(). **/
+  const_iterator end() const {
+    return const_iterator(*this, slots.size());
+  }
+
+protected:
+  enum {
+    // Slots per group
+    GROUP_SIZE = 16,
+
+    // Maximum number of keys of an add_batch() round
+    BATCH_MAX = 64,
+
+    // Maximum load factor (7/8)
+    MAX_LOAD_NUM = 7,
+    MAX_LOAD_DEN = 8,
+
+    // Control byte of an empty slot (full slots have the high bit cleared)
+    CONTROL_EMPTY = 0x80
+  };
+
+  /**
+   * A slot: the key (pointer and 32-bit length), the value, and the cached hash.
+  **/
+  struct Slot {
+    const char *str;
+    uint32_t len;
+    T value;
+    uint64_t hash;
+  };
+
+  /** Number of groups. **/
+  size_t groups() const {
+    return slots.size() / GROUP_SIZE;
+  }
+
+  /** Maximum number of elements before growing. **/
+  size_t max_load() const {
+    return slots.size()*MAX_LOAD_NUM/MAX_LOAD_DEN;
+  }
+
+  /** Control byte of a full slot (7-bit hash fingerprint, uncorrelated with the group index). **/
+  static unsigned char fingerprint(uint64_t hash) {
+    return static_cast<unsigned char>(hash >> 57);
+  }
+
+  /**
+   * Home group of a hash. The hash is scrambled (Fibonacci hashing), and the
+   * highest bits are kept, so that hashes with poorly distributed low bits
+   * (such as word-wise FNV-1a) do not pile up in the same groups.
+  **/
+  static size_t home(uint64_t hash, size_t mask) {
+    return static_cast<size_t>((hash*UINT64_C(0x9e3779b97f4a7c15)) >> 32) & mask;
+  }
+
+  /**
+   * Return the bitmask of the control bytes of a group equal to a given byte.
+  **/
+  static unsigned group_match(const unsigned char *group, unsigned char byte) {
+#ifdef __SSE2__
+    const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(byte)))));
+#else
+    unsigned mask = 0;
+    for(size_t i = 0; i < GROUP_SIZE; i++) {
+      mask |= static_cast<unsigned>(group[i] == byte) << i;
+    }
+    return mask;
+#endif
+  }
+
+  /**
+   * Find a key.
+   *
+   * @param key The key
+   * @param hash The key hash
+   * @param position The key position if found, or the position where it shall be inserted (if the table is not empty)
+   * @return @c true if found
+  **/
+  bool find(const RefString &key, uint64_t hash, size_t &position) const {
+    position = 0;
+    if (slots.empty()) {
+      return false;
+    }
+
+    const unsigned char fp = fingerprint(hash);
+    size_t group = home(hash, group_mask);
+    // Triangular probing over groups visits every group for power-of-two sizes
+    for(size_t step = 1; ; step++) {
+      const unsigned char *ctrl = &control[group*GROUP_SIZE];
+      for(unsigned match = group_match(ctrl, fp); match != 0; match &= match - 1) {
+        const size_t candidate = group*GROUP_SIZE + __builtin_ctz(match);
+        const Slot &slot = slots[candidate];
+        if (slot.hash == hash && slot.len == key.len
+            && memcmp(slot.str, key.str, key.len) == 0) {
+          position = candidate;
+          return true;
+        }
+      }
+      // No deletion: the first empty slot ends the probe sequence
+      const unsigned empty = group_match(ctrl, CONTROL_EMPTY);
+      if (empty != 0) {
+        position = group*GROUP_SIZE + __builtin_ctz(empty);
+        return false;
+      }
+      group = (group + step) & group_mask;
+    }
+  }
+
+  /**
+   * Resize the table.
+   *
+   * @param new_groups The new number of groups (a power of two)
+  **/
+  void rehash(size_t new_groups) {
+    assert(new_groups != 0 && (new_groups & (new_groups - 1)) == 0);
+
+    RefStringUnorderedHashMap other(get_account());
+    other.control.assign(new_groups*GROUP_SIZE, static_cast<unsigned char>(CONTROL_EMPTY));
+    other.slots.resize(new_groups*GROUP_SIZE);
+    other.group_mask = new_groups - 1;
+
+    // Move elements, using the cached hash (keys are never compared, being unique)
+    for(size_t i = 0; i < slots.size(); i++) {
+      if (control[i] != CONTROL_EMPTY) {
+        const Slot &slot = slots[i];
+        size_t group = home(slot.hash, other.group_mask);
+        for(size_t step = 1; ; step++) {
+          const unsigned empty = group_match(&other.control[group*GROUP_SIZE], CONTROL_EMPTY);
+          if (empty != 0) {
+            const size_t position = group*GROUP_SIZE + __builtin_ctz(empty);
+            other.control[position] = control[i];
+            other.slots[position] = slot;
+            break;
+          }
+          group = (group + step) & other.group_mask;
+        }
+      }
+    }
+    other.count = count;
+
+    swap(other);
+  }
+
+protected:
+  // Control bytes (one per slot)
+  std::vector<unsigned char, AccountingAllocator<unsigned char>> control;
+
+  // Slots
+  std::vector<Slot, AccountingAllocator<Slot>> slots;
+
+  // Number of elements
+  size_t count;
+
+  // Number of groups minus one
+  size_t group_mask;
 };
 
 /** A pair of RefString, and the number of hits. **/
@@ -165,11 +625,55 @@ typedef std::pair<RefString, unsigned> RefStringPriorityPair;
 struct RefStringPriorityPairCompare
 {
   bool operator()(const RefStringPriorityPair& lhs, const RefStringPriorityPair& rhs) const {
-    return lhs.second > rhs.second;
+    /* Ties are broken on the string itself, so that results do not depend on the hashtable order */
+    return lhs.second > rhs.second
+      || (lhs.second == rhs.second && rhs.first < lhs.first);
   }
 };
 
+/** Storage of RefStringPriorityQueue, allocated through an AccountingAllocator. **/
+typedef std::vector<RefStringPriorityPair, AccountingAllocator<RefStringPriorityPair>> RefStringPriorityVector;
+
 /** A pair of RefStringPriorityPair, and the number of hits. **/
-typedef std::priority_queue<RefStringPriorityPair, std::vector<RefStringPriorityPair>, RefStringPriorityPairCompare> RefStringPriorityQueue;
+typedef std::priority_queue<RefStringPriorityPair, RefStringPriorityVector, RefStringPriorityPairCompare> RefStringPriorityQueue;
+
+/**
+ * Get the top entries of counts indexed by dense string identifiers: counts
+ * are walked sequentially, and strings are only fetched when they enter the
+ * queue.
+ *
+ * @param counts The count of each identifier (zero counts are ignored)
+ * @param top_queries The maximum number of entries to retreive
+ * @param get_string The functor returning the string of an identifier
+ * @return The list of top entries, sorted in descending order
+ **/
+template<typename GetString>
+std::vector<RefStringPriorityPair> get_top_counts(const std::vector<unsigned> &counts, size_t top_queries,
+                                                  GetString get_string) {
+  RefStringPriorityQueue min_heap;
+  if (top_queries == 0) {
+    return std::vector<RefStringPriorityPair>();
+  }
+  for(size_t id = 0; id < counts.size(); id++) {
+    if (counts[id] == 0 || (min_heap.size() == top_queries && counts[id] < min_heap.top().second)) {
+      continue;
+    }
+    const RefStringPriorityPair element(get_string(static_cast<uint32_t>(id)), counts[id]);
+    if (min_heap.size() < top_queries) {
+      min_heap.push(element);
+    } else if (RefStringPriorityPairCompare()(element, min_heap.top())) {
+      min_heap.pop();
+      min_heap.push(element);
+    }
+  }
+
+  // Extract in descending order
+  std::vector<RefStringPriorityPair> list(min_heap.size());
+  for(size_t i = list.size(); i != 0; i--) {
+    list[i - 1] = min_heap.top();
+    min_heap.pop();
+  }
+  return list;
+}
 
 #endif
@@ -0,0 +1,219 @@
+/**
+ * Vectorized byte scanning.
+ * Locate separators within a buffer, 16 (SSE2) or 32 (AVX2) bytes at a time, with runtime dispatch
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RX_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#include "simdscan.hpp"
+#include "hashing.hpp"
+
+/**
+ * Scalar implementation; the reference one.
+ **/
+static const unsigned char* find_byte_scalar(const unsigned char *begin, const unsigned char *end, unsigned char c) {
+  for(; begin != end && *begin != c; begin++) ;
+  return begin;
+}
+
+#ifdef RX_SIMD_X86
+
+/**
+ * SSE2 implementation: 16 bytes at a time, using unaligned loads.
+ * The loads never cross the buffer end; the tail is handled by the scalar loop.
+ **/
+__attribute__((target("sse2")))
+static const unsigned char* find_byte_sse2(const unsigned char *begin, const unsigned char *end, unsigned char c) {
+  const __m128i pattern = _mm_set1_epi8(static_cast<char>(c));
+  for(; end - begin >= 16; begin += 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return find_byte_scalar(begin, end, c);
+}
+
+/**
+ * AVX2 implementation: 32 bytes at a time, using unaligned loads.
+ **/
+__attribute__((target("avx2")))
+static const unsigned char* find_byte_avx2(const unsigned char *begin, const unsigned char *end, unsigned char c) {
+  const __m256i pattern = _mm256_set1_epi8(static_cast<char>(c));
+  for(; end - begin >= 32; begin += 32) {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return find_byte_sse2(begin, end, c);
+}
+
+#endif
+
+/**
+ * Find the first occurrence of a byte, and compute the rxhash of the bytes
+ * before it, in a single pass; @c match returns the bitmask of the bytes of a
+ * 32-byte block equal to the byte (bit i set if byte i matches).
+ **/
+template<uint32_t (*match)(const unsigned char*, unsigned char)>
+static inline __attribute__((always_inline))
+const unsigned char* find_byte_rxhash(const unsigned char *begin, const unsigned char *end, unsigned char c, uint64_t &hash) {
+  RxHashState state;
+  rxhash_init(state);
+
+  const unsigned char *p = begin;
+  for(; end - p >= RXHASH_BLOCK; p += RXHASH_BLOCK) {
+    const uint32_t mask = match(p, c);
+    if (mask != 0) {
+      const size_t position = __builtin_ctz(mask);
+      rxhash_tail(state, p, position);
+      hash = rxhash_final(state, p + position - begin);
+      return p + position;
+    }
+    rxhash_block(state, p);
+  }
+
+  // Last bytes of the buffer (less than a block)
+  const unsigned char *const found = find_byte_scalar(p, end, c);
+  rxhash_tail(state, p, found - p);
+  hash = rxhash_final(state, found - begin);
+  return found;
+}
+
+/**
+ * Scalar block matching.
+ **/
+static inline uint32_t block_match_scalar(const unsigned char *p, unsigned char c) {
+  uint32_t mask = 0;
+  for(size_t i = 0; i < RXHASH_BLOCK; i++) {
+    mask |= static_cast<uint32_t>(p[i] == c) << i;
+  }
+  return mask;
+}
+
+static const unsigned char* find_byte_rxhash_scalar(const unsigned char *begin, const unsigned char *end, unsigned char c,
+                                                    uint64_t &hash) {
+  return find_byte_rxhash<block_match_scalar>(begin, end, c, hash);
+}
+
+#ifdef RX_SIMD_X86
+
+/**
+ * SSE2 block matching: two 16-byte halves.
+ **/
+__attribute__((target("sse2")))
+static inline uint32_t block_match_sse2(const unsigned char *p, unsigned char c) {
+  const __m128i pattern = _mm_set1_epi8(static_cast<char>(c));
+  const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(lo, pattern)))
+    | (static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi, pattern))) << 16);
+}
+
+__attribute__((target("sse2")))
+static const unsigned char* find_byte_rxhash_sse2(const unsigned char *begin, const unsigned char *end, unsigned char c,
+                                                  uint64_t &hash) {
+  return find_byte_rxhash<block_match_sse2>(begin, end, c, hash);
+}
+
+/**
+ * AVX2 block matching: the whole block at once.
+ **/
+__attribute__((target("avx2")))
+static inline uint32_t block_match_avx2(const unsigned char *p, unsigned char c) {
+  const __m256i pattern = _mm256_set1_epi8(static_cast<char>(c));
+  const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern)));
+}
+
+__attribute__((target("avx2")))
+static const unsigned char* find_byte_rxhash_avx2(const unsigned char *begin, const unsigned char *end, unsigned char c,
+                                                  uint64_t &hash) {
+  return find_byte_rxhash<block_match_avx2>(begin, end, c, hash);
+}
+
+#endif
+
+bool simd_scan_supported(enum simd_scan_impl impl) {
+  switch(impl) {
+  case simd_scan_scalar:
+    return true;
+#ifdef RX_SIMD_X86
+  case simd_scan_sse2:
+    return __builtin_cpu_supports("sse2");
+  case simd_scan_avx2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+bool simd_scan_select(enum simd_scan_impl impl) {
+  if (!simd_scan_supported(impl)) {
+    return false;
+  }
+  switch(impl) {
+#ifdef RX_SIMD_X86
+  case simd_scan_sse2:
+    simd_find_byte_impl = find_byte_sse2;
+    simd_find_byte_rxhash_impl = find_byte_rxhash_sse2;
+    break;
+  case simd_scan_avx2:
+    simd_find_byte_impl = find_byte_avx2;
+    simd_find_byte_rxhash_impl = find_byte_rxhash_avx2;
+    break;
+#endif
+  default:
+    simd_find_byte_impl = find_byte_scalar;
+    simd_find_byte_rxhash_impl = find_byte_rxhash_scalar;
+    break;
+  }
+  return true;
+}
+
+const char* simd_scan_name(enum simd_scan_impl impl) {
+  switch(impl) {
+  case simd_scan_scalar:
+    return "scalar";
+  case simd_scan_sse2:
+    return "sse2";
+  case simd_scan_avx2:
+    return "avx2";
+  default:
+    assert(! "unknown implementation");
+    return "unknown";
+  }
+}
+
+/**
+ * Select the best implementation available, once, at startup.
+ **/
+static enum simd_scan_impl simd_scan_resolve() {
+#ifdef RX_SIMD_X86
+  __builtin_cpu_init();
+#endif
+  if (simd_scan_supported(simd_scan_avx2)) {
+    return simd_scan_avx2;
+  } else if (simd_scan_supported(simd_scan_sse2)) {
+    return simd_scan_sse2;
+  }
+  return simd_scan_scalar;
+}
+
+simd_find_byte_fn simd_find_byte_impl = find_byte_scalar;
+simd_find_byte_rxhash_fn simd_find_byte_rxhash_impl = find_byte_rxhash_scalar;
+
+// Both implementations are selected together, before main()
+static const bool simd_scan_resolved = simd_scan_select(simd_scan_resolve());
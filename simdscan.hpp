@@ -0,0 +1,110 @@
+/**
+ * Vectorized byte scanning.
+ * Locate separators within a buffer, 16 (SSE2) or 32 (AVX2) bytes at a time, with runtime dispatch
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_SIMD_SCAN_HPP
+#define RX_SIMD_SCAN_HPP
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/**
+ * Available scanning implementations.
+ **/
+enum simd_scan_impl {
+  simd_scan_scalar,
+  simd_scan_sse2,
+  simd_scan_avx2,
+};
+
+/**
+ * Find the first occurrence of a byte within a buffer.
+ *
+ * @param begin The beginning of the buffer
+ * @param end The end of the buffer (exclusive)
+ * @param c The byte to look for
+ * @return The position of the first occurrence, or @c end if not found
+ **/
+typedef const unsigned char* (*simd_find_byte_fn)(const unsigned char *begin, const unsigned char *end, unsigned char c);
+
+/**
+ * The current implementation, selected at startup given the CPU features.
+ **/
+extern simd_find_byte_fn simd_find_byte_impl;
+
+/**
+ * Find the first occurrence of a byte within a buffer, using the best
+ * implementation available.
+ *
+ * @param begin The beginning of the buffer
+ * @param end The end of the buffer (exclusive)
+ * @param c The byte to look for
+ * @return The position of the first occurrence, or @c end if not found
+ **/
+static inline const unsigned char* simd_find_byte(const unsigned char *begin, const unsigned char *end, unsigned char c) {
+  return simd_find_byte_impl(begin, end, c);
+}
+
+/**
+ * Find the first occurrence of a byte within a buffer, and compute the
+ * rxhash (see hashing.hpp) of the bytes before it, in a single pass: each
+ * 32-byte block is loaded once, checked for the byte, and mixed into the hash.
+ *
+ * @param begin The beginning of the buffer
+ * @param end The end of the buffer (exclusive)
+ * @param c The byte to look for
+ * @param hash The rxhash of [begin, position)
+ * @return The position of the first occurrence, or @c end if not found
+ **/
+typedef const unsigned char* (*simd_find_byte_rxhash_fn)(const unsigned char *begin, const unsigned char *end, unsigned char c,
+                                                         uint64_t &hash);
+
+/**
+ * The current fused implementation, selected along with @c simd_find_byte_impl.
+ **/
+extern simd_find_byte_rxhash_fn simd_find_byte_rxhash_impl;
+
+/**
+ * Find the first occurrence of a byte within a buffer, and compute the
+ * rxhash of the bytes before it, using the best implementation available.
+ *
+ * @param begin The beginning of the buffer
+ * @param end The end of the buffer (exclusive)
+ * @param c The byte to look for
+ * @param hash The rxhash of [begin, position)
+ * @return The position of the first occurrence, or @c end if not found
+ **/
+static inline const unsigned char* simd_find_byte_rxhash(const unsigned char *begin, const unsigned char *end, unsigned char c,
+                                                         uint64_t &hash) {
+  return simd_find_byte_rxhash_impl(begin, end, c, hash);
+}
+
+/**
+ * Is the given implementation supported by this CPU ?
+ *
+ * @param impl The implementation
+ * @return @c true if supported
+ **/
+bool simd_scan_supported(enum simd_scan_impl impl);
+
+/**
+ * Force a specific implementation (benchmarks and tests).
+ *
+ * @param impl The implementation
+ * @return @c true if the implementation is supported, and was selected
+ **/
+bool simd_scan_select(enum simd_scan_impl impl);
+
+/**
+ * Return the name of an implementation.
+ *
+ * @param impl The implementation
+ * @return The implementation name
+ **/
+const char* simd_scan_name(enum simd_scan_impl impl);
+
+#endif
@@ -0,0 +1,206 @@
+/**
+ * Stream reader.
+ * Sequential reader of a plain, gzip or bzip2 compressed file
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+#include "streamreader.hpp"
+
+// zlib internal buffer size
+#define GZIP_BUFFER_SIZE (1 << 20)
+
+StreamReader::StreamReader(const char *filename): format(detect(filename)), fd(-1), gz(NULL), fp(NULL), bz(NULL), error(0)
+{
+  fd = strcmp(filename, "-") == 0
+    ? fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0)
+    : open(filename, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    error = errno;
+    return;
+  }
+
+  switch(format) {
+  case stream_format_plain:
+    break;
+  case stream_format_gzip:
+    // The descriptor is now owned by zlib
+    gz = gzdopen(fd, "rb");
+    if (gz == NULL) {
+      error = errno != 0 ? errno : ENOMEM;
+      break;
+    }
+    fd = -1;
+    gzbuffer(static_cast<gzFile>(gz), GZIP_BUFFER_SIZE);
+    break;
+  case stream_format_bzip2:
+    {
+      // The descriptor is now owned by the stdio stream
+      fp = fdopen(fd, "rb");
+      if (fp == NULL) {
+        error = errno;
+        break;
+      }
+      fd = -1;
+      int bzerror;
+      bz = BZ2_bzReadOpen(&bzerror, fp, 0, 0, NULL, 0);
+      if (bzerror != BZ_OK) {
+        error = bzerror == BZ_MEM_ERROR ? ENOMEM : EINVAL;
+        bz = NULL;
+      }
+    }
+    break;
+  case stream_format_zstd:
+    error = ENOTSUP;
+    break;
+  }
+}
+
+StreamReader::~StreamReader() {
+  if (bz != NULL) {
+    int bzerror;
+    BZ2_bzReadClose(&bzerror, bz);
+  }
+  if (fp != NULL && fclose(fp) != 0) {
+    perror("unexpected fclose error");
+    abort();
+  }
+  if (gz != NULL) {
+    gzclose(static_cast<gzFile>(gz));
+  }
+  if (fd != -1 && close(fd) != 0) {
+    perror("unexpected close error");
+    abort();
+  }
+}
+
+bool StreamReader::is_mappable(const char *filename) {
+  struct stat st;
+  return strcmp(filename, "-") != 0 && (stat(filename, &st) != 0 || S_ISREG(st.st_mode));
+}
+
+enum stream_format StreamReader::detect(const char *filename) {
+  // Only regular files can be peeked without consuming their bytes
+  if (!is_mappable(filename)) {
+    return stream_format_plain;
+  }
+
+  unsigned char magic[4];
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return stream_format_plain;
+  }
+  const ssize_t length = pread(fd, magic, sizeof(magic), 0);
+  close(fd);
+
+  if (length >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+    return stream_format_gzip;
+  } else if (length >= 3 && memcmp(magic, "BZh", 3) == 0) {
+    return stream_format_bzip2;
+  } else if (length >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+    return stream_format_zstd;
+  }
+  return stream_format_plain;
+}
+
+const char* StreamReader::get_format_name(enum stream_format format) {
+  switch(format) {
+  case stream_format_plain:
+    return "plain";
+  case stream_format_gzip:
+    return "gzip";
+  case stream_format_bzip2:
+    return "bzip2";
+  case stream_format_zstd:
+    return "zstd";
+  }
+  return "unknown";
+}
+
+ssize_t StreamReader::read(void *buffer, size_t size) {
+  if (error != 0) {
+    return -1;
+  } else if (size > INT_MAX) {
+    size = INT_MAX;
+  }
+
+  switch(format) {
+  case stream_format_plain:
+    for(;;) {
+      const ssize_t length = ::read(fd, buffer, size);
+      if (length != -1) {
+        return length;
+      } else if (errno != EINTR) {
+        error = errno;
+        return -1;
+      }
+    }
+  case stream_format_gzip:
+    {
+      const int length = gzread(static_cast<gzFile>(gz), buffer, static_cast<unsigned>(size));
+      int code = Z_OK;
+      if (length <= 0) {
+        // A truncated stream is reported at its end
+        gzerror(static_cast<gzFile>(gz), &code);
+      }
+      if (length < 0 || code != Z_OK) {
+        error = code == Z_ERRNO ? errno : EBADMSG;
+        return -1;
+      }
+      return length;
+    }
+  case stream_format_bzip2:
+    return read_bzip2(buffer, size);
+  case stream_format_zstd:
+    break;
+  }
+
+  error = ENOTSUP;
+  return -1;
+}
+
+ssize_t StreamReader::read_bzip2(void *buffer, size_t size) {
+  while(bz != NULL) {
+    int bzerror;
+    const int length = BZ2_bzRead(&bzerror, bz, buffer, static_cast<int>(size));
+    if (bzerror == BZ_OK) {
+      return length;
+    } else if (bzerror != BZ_STREAM_END) {
+      error = bzerror == BZ_IO_ERROR ? errno : bzerror == BZ_MEM_ERROR ? ENOMEM : EBADMSG;
+      return -1;
+    }
+
+    // End of stream: keep the bytes read ahead, and open the next stream, if any
+    void *ahead;
+    int ahead_length;
+    BZ2_bzReadGetUnused(&bzerror, bz, &ahead, &ahead_length);
+    unused.assign(static_cast<char*>(ahead), static_cast<char*>(ahead) + ahead_length);
+    BZ2_bzReadClose(&bzerror, bz);
+    bz = NULL;
+    if (!unused.empty() || ungetc(getc(fp), fp) != EOF) {
+      bz = BZ2_bzReadOpen(&bzerror, fp, 0, 0, unused.data(), static_cast<int>(unused.size()));
+      if (bzerror != BZ_OK) {
+        error = bzerror == BZ_MEM_ERROR ? ENOMEM : EBADMSG;
+        bz = NULL;
+        return -1;
+      }
+    }
+    if (length != 0) {
+      return length;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * Stream reader.
+ * Sequential reader of a plain, gzip or bzip2 compressed file
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_STREAMREADER_HPP
+#define RX_STREAMREADER_HPP
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <vector>
+
+/** Compression formats, detected by their magic bytes. **/
+enum stream_format {
+  stream_format_plain,
+  stream_format_gzip,
+  stream_format_bzip2,
+  stream_format_zstd,
+};
+
+/**
+ * Sequential reader of a file, decompressing it on the fly. Concatenated
+ * streams (eg. produced by pigz or pbzip2) are read as a whole.
+ * zstd streams are detected, but not supported by this build.
+ * Non-regular files (pipes, "-" for the standard input) are read as plain.
+ **/
+class StreamReader {
+public:
+  /**
+   * Open a file.
+   *
+   * @param filename The file path, or "-" for the standard input
+   **/
+  explicit StreamReader(const char *filename);
+
+  /**
+   * Destructor; close the file.
+   **/
+  ~StreamReader();
+
+  /**
+   * Read (decompressed) bytes.
+   *
+   * @param buffer The buffer to be filled
+   * @param size The buffer size
+   * @return The number of bytes read, 0 at end of stream, or -1 upon error (see @c get_error)
+   **/
+  ssize_t read(void *buffer, size_t size);
+
+  /**
+   * Was the file correctly opened ?
+   **/
+  bool is_valid() const {
+    return error == 0;
+  }
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+  /**
+   * Return the file format.
+   **/
+  enum stream_format get_format() const {
+    return format;
+  }
+
+  /**
+   * Detect the format of a file from its magic bytes.
+   *
+   * @param filename The file path
+   * @return The format (plain if unknown, or if the file can not be read)
+   **/
+  static enum stream_format detect(const char *filename);
+
+  /**
+   * Can a file be mapped (see ReadOnlyMemoryMap) ? Pipes, character
+   * devices and the standard input can only be read sequentially.
+   *
+   * @param filename The file path
+   * @return @c true if the path names a regular file (or can not be checked)
+   **/
+  static bool is_mappable(const char *filename);
+
+  /**
+   * Return the name of a format.
+   **/
+  static const char* get_format_name(enum stream_format format);
+
+protected:
+  /** Read a bzip2 stream, continuing with the following concatenated one. **/
+  ssize_t read_bzip2(void *buffer, size_t size);
+
+protected:
+  // Format
+  enum stream_format format;
+
+  // Plain file descriptor
+  int fd;
+
+  // gzip stream (a gzFile)
+  void *gz;
+
+  // bzip2 file, and stream (a BZFILE)
+  FILE *fp;
+  void *bz;
+
+  // Bytes following the end of a bzip2 stream
+  std::vector<char> unused;
+
+  // Last error
+  int error;
+
+private:
+  /* Forbidden foes */
+  StreamReader(const StreamReader&) = delete;
+  StreamReader& operator=(const StreamReader&) = delete;
+};
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * Synthetic Logs Generator.
+ * Deterministic generation of query logs with a given size, cardinality, popularity skew, lengths and jitter
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <algorithm>
+
+#include "synthlog.hpp"
+
+// Characters of queries, after their rank
+#define SYNTH_ALPHABET "abcdefghijklmnopqrstuvwxyz0123456789+."
+
+SynthLogGenerator::SynthLogGenerator(const SynthLogSettings &settings):
+  settings(settings), random(settings.seed), cdf(settings.queries), records(0), error(0)
+{
+  assert(settings.is_valid());
+
+  // Popularity of rank r is 1/(r + 1)^skew
+  double sum = 0;
+  for(size_t i = 0; i < cdf.size(); i++) {
+    sum += 1.0 / pow(static_cast<double>(i + 1), settings.skew);
+    cdf[i] = sum;
+  }
+  for(double &value : cdf) {
+    value /= sum;
+  }
+}
+
+size_t SynthLogGenerator::draw_rank() {
+  const double value = random.uniform();
+  const size_t rank = std::upper_bound(cdf.begin(), cdf.end(), value) - cdf.begin();
+  return rank < cdf.size() ? rank : cdf.size() - 1;
+}
+
+void SynthLogGenerator::get_query(size_t rank, std::string &query) const {
+  // Rank, in bijective base 26
+  query.clear();
+  for(size_t n = rank + 1; n != 0; n = (n - 1) / 26) {
+    query += static_cast<char>('a' + (n - 1) % 26);
+  }
+
+  // Length, and characters, drawn from the rank
+  SynthRandom generator(settings.seed ^ ((rank + 1)*0xd6e8feb86659fd93ULL));
+  const size_t length = settings.min_length + generator.below(settings.max_length - settings.min_length + 1);
+  static const char alphabet[] = SYNTH_ALPHABET;
+  if (query.size() + 1 < length) {
+    query += '-';
+    while(query.size() < length) {
+      query += alphabet[generator.below(sizeof(alphabet) - 1)];
+    }
+  }
+}
+
+bool SynthLogGenerator::write(const char *filename) {
+  FILE *const fp = fopen(filename, "we");
+  if (fp == NULL) {
+    error = errno;
+    return false;
+  }
+
+  // Queries are built once
+  std::vector<std::string> dictionary(settings.queries);
+  for(size_t i = 0; i < dictionary.size(); i++) {
+    get_query(i, dictionary[i]);
+  }
+
+  size_t written = 0;
+  bool success = true;
+  char line[32];
+  while(success && written < settings.size) {
+    // Nominal timestamp, and its lag (never before the first one)
+    time_t stamp = settings.start + static_cast<time_t>(records / settings.rate);
+    stamp -= static_cast<time_t>(random.below(settings.jitter + 1));
+    if (stamp < settings.start) {
+      stamp = settings.start;
+    }
+
+    const std::string &query = dictionary[draw_rank()];
+    const int length = snprintf(line, sizeof(line), "%lld\t", static_cast<long long>(stamp));
+    assert(length > 0 && static_cast<size_t>(length) < sizeof(line));
+    success = fwrite(line, length, 1, fp) == 1
+      && fwrite(query.c_str(), query.size(), 1, fp) == 1
+      && fputc('\n', fp) != EOF;
+    written += length + query.size() + 1;
+    records++;
+  }
+  if (!success) {
+    error = errno;
+  }
+  if (fclose(fp) != 0 && success) {
+    error = errno;
+    success = false;
+  }
+  return success;
+}
@@ -0,0 +1,181 @@
+/**
+ * Synthetic Logs Generator.
+ * Deterministic generation of query logs with a given size, cardinality, popularity skew, lengths and jitter
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_SYNTHLOG_HPP
+#define RX_SYNTHLOG_HPP
+
+#include <inttypes.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// Default settings
+#define SYNTH_DEFAULT_SIZE ((size_t) 64 << 20)
+#define SYNTH_DEFAULT_QUERIES 100000
+#define SYNTH_DEFAULT_SKEW 1.0
+#define SYNTH_DEFAULT_MIN_LENGTH 4
+#define SYNTH_DEFAULT_MAX_LENGTH 64
+#define SYNTH_DEFAULT_RATE 10
+#define SYNTH_DEFAULT_JITTER 300
+#define SYNTH_DEFAULT_SEED 1
+
+// First timestamp (2015-08-01 00:00:00 UTC, as the sample logs)
+#define SYNTH_DEFAULT_START 1438387200
+
+/**
+ * Pseudo-random generator (splitmix64). The standard library engines are
+ * portable, but not its distributions: ours are computed here, so that a
+ * seed gives the same logs everywhere.
+ **/
+class SynthRandom {
+public:
+  explicit SynthRandom(uint64_t seed): state(seed) {
+  }
+
+  /** Next 64-bit value. **/
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  /** Uniform value within [0, 1). **/
+  double uniform() {
+    return (next() >> 11)*(1.0 / (static_cast<uint64_t>(1) << 53));
+  }
+
+  /** Uniform value within [0, bound). **/
+  uint64_t below(uint64_t bound) {
+    return bound != 0 ? next() % bound : 0;
+  }
+
+protected:
+  uint64_t state;
+};
+
+/**
+ * Synthetic logs settings.
+ **/
+struct SynthLogSettings {
+  SynthLogSettings():
+    size(SYNTH_DEFAULT_SIZE),
+    queries(SYNTH_DEFAULT_QUERIES),
+    skew(SYNTH_DEFAULT_SKEW),
+    min_length(SYNTH_DEFAULT_MIN_LENGTH),
+    max_length(SYNTH_DEFAULT_MAX_LENGTH),
+    rate(SYNTH_DEFAULT_RATE),
+    jitter(SYNTH_DEFAULT_JITTER),
+    start(SYNTH_DEFAULT_START),
+    seed(SYNTH_DEFAULT_SEED)
+  {
+  }
+
+  /**
+   * Are the settings consistent ?
+   **/
+  bool is_valid() const {
+    return size != 0 && queries != 0 && skew >= 0 && min_length != 0 && min_length <= max_length && rate != 0
+      && jitter >= 0;
+  }
+
+  // Output size, in bytes (the last line may overflow it)
+  size_t size;
+
+  // Number of distinct queries
+  size_t queries;
+
+  // Zipf exponent of the queries popularity (0: uniform)
+  double skew;
+
+  // Queries length range, uniformly distributed
+  size_t min_length;
+  size_t max_length;
+
+  // Records per second
+  unsigned rate;
+
+  // Maximum lag of a timestamp behind its nominal value, in seconds (thus
+  // records are at most this much out of order, see YParser::set_fast_seek)
+  time_t jitter;
+
+  // First nominal timestamp
+  time_t start;
+
+  // Random seed
+  uint64_t seed;
+};
+
+/**
+ * Generator of synthetic logs: "timestamp<tab>query" lines, loosely sorted
+ * by timestamp (see @c SynthLogSettings::jitter), queries being drawn from a
+ * fixed dictionary with a Zipf popularity.
+ **/
+class SynthLogGenerator {
+public:
+  /**
+   * Create a generator.
+   *
+   * @param settings The settings (see @c SynthLogSettings::is_valid)
+   **/
+  explicit SynthLogGenerator(const SynthLogSettings &settings);
+
+  /**
+   * Write the logs.
+   *
+   * @param filename The output path
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool write(const char *filename);
+
+  /**
+   * Get the query of a given popularity rank; queries begin with the rank,
+   * so that they are distinct whatever their length.
+   *
+   * @param rank The rank, from 0 (the most popular) to queries - 1
+   * @param query The query to be filled
+   **/
+  void get_query(size_t rank, std::string &query) const;
+
+  /**
+   * Return the number of records written.
+   **/
+  uint64_t get_records() const {
+    return records;
+  }
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+protected:
+  /** Draw a popularity rank. **/
+  size_t draw_rank();
+
+protected:
+  // Settings
+  const SynthLogSettings settings;
+
+  // Records generator
+  SynthRandom random;
+
+  // Cumulative popularity of ranks (normalized)
+  std::vector<double> cdf;
+
+  // Records written
+  uint64_t records;
+
+  // Last error
+  int error;
+};
+
+#endif
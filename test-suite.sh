@@ -110,6 +110,352 @@ to=$(($from+280113/3))
 [ "$(./hnStat top 10 --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" == "$(python parser.py top 10 --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" ]
 ok "ALTERNATE IMPLEMENTATION - $((alt++))"
 
+# Multi-threaded scan must give the same results
+for threads in 2 4 7; do
+	[ "$(./hnStat top 100 --threads=$threads hn_logs.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 100 hn_logs.tsv 2>/dev/null | hash_string)" ]
+	[ "$(./hnStat distinct --threads=$threads --from $from --to $to hn_logs.tsv 2>/dev/null)" == "$(./hnStat distinct --from $from --to $to hn_logs.tsv 2>/dev/null)" ]
+	[ "$(./hnStat top 10 --threads=$threads --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 10 --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" ]
+done
+[ "$(./hnStat top 3 --threads=4 test-sample 2>/dev/null | tail -n +3)" == "three 3" ]
+ok "THREADS"
+
+# Timestamp index sidecar must give the same results, and be rebuilt when stale
+cp test-sample test-sample-index
+./hnStat index test-sample-index 2>/dev/null
+test -f test-sample-index.hnidx
+[ "$(./hnStat distinct --from 51 --to 61 test-sample-index 2>/dev/null)" == "4" ]
+[ "$(./hnStat distinct --from 50 test-sample-index 2>/dev/null)" == "8" ]
+[ "$(./hnStat distinct --from 300 test-sample-index 2>/dev/null)" == "0" ]
+./hnStat index hn_logs.tsv 2>/dev/null
+[ "$(./hnStat top 10 --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 10 --index=no --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" ]
+[ "$(./hnStat distinct --from $from --to $to hn_logs.tsv 2>/dev/null)" == "$(./hnStat distinct --index=no --from $from --to $to hn_logs.tsv 2>/dev/null)" ]
+echo "52	six" >> test-sample-index
+[[ "$(./hnStat distinct --from 51 --to 61 test-sample-index 2>&1 >/dev/null)" =~ "rebuilding stale index" ]]
+[ "$(./hnStat distinct --from 51 --to 61 test-sample-index 2>/dev/null)" == "5" ]
+printf '\377\377\377\377\377\377\377\377' | dd of=test-sample-index.hnidx bs=1 seek=56 conv=notrunc 2>/dev/null
+[[ "$(./hnStat distinct --from 51 --to 61 test-sample-index 2>&1 >/dev/null)" =~ "rebuilding invalid index" ]]
+[ "$(./hnStat distinct --from 51 --to 61 test-sample-index 2>/dev/null)" == "5" ]
+rm -f test-sample-index test-sample-index.hnidx hn_logs.tsv.hnidx
+ok "INDEX"
+
+# Approximate top queries: exact when the budget is large enough, bounds always hold
+[ "$(./hnStat top 3 --approx test-sample 2>/dev/null | tail -n +3)" == "three 3 [3..3]" ]
+[ "$(./hnStat top 10 --approx hn_logs.tsv 2>/dev/null | cut -f1,2 -d' ' | hash_string)" == "$(./hnStat top 10 hn_logs.tsv 2>/dev/null | hash_string)" ]
+[ "$(./hnStat top 10 --approx --threads=3 --from $from --to $to hn_logs.tsv 2>/dev/null | cut -f1,2 -d' ' | hash_string)" == "$(./hnStat top 10 --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" ]
+[ "$(./hnStat top 1 --approx --memory=20M --threads=2 hn_logs.tsv 2>&1 | grep -o "approx counters=[0-9]*")" == "$(./hnStat top 1 --approx --memory=10M hn_logs.tsv 2>&1 | grep -o "approx counters=[0-9]*")" ]
+[ "$(./hnStat top 5 --approx --memory=64K --count-min hn_logs.tsv 2>/dev/null | cut -f1 -d' ' | hash_string)" == "$(./hnStat top 5 hn_logs.tsv 2>/dev/null | cut -f1 -d' ' | hash_string)" ]
+./hnStat top 5 --approx --memory=64K hn_logs.tsv 2>/dev/null | while read query count bounds; do
+	exact=$(./hnStat top 100000 hn_logs.tsv 2>/dev/null | grep -m1 "^$query " | cut -f2 -d' ')
+	bounds=${bounds#[}; bounds=${bounds%]}
+	[ ${bounds%..*} -le $exact ] && [ $exact -le ${bounds#*..} ] || exit 1
+done
+[[ "$(./hnStat top 3 --approx --memory=12Q test-sample 2>&1)" =~ "bad memory value" ]]
+ok "APPROX"
+
+# Approximate distinct queries: exact for small counts, within three standard errors otherwise
+[ "$(./hnStat distinct --approx test-sample 2>/dev/null | cut -f1 -d' ')" == "9" ]
+[ "$(./hnStat distinct --approx --from 50 test-sample 2>/dev/null | cut -f1 -d' ')" == "8" ]
+exact=$(./hnStat distinct hn_logs.tsv 2>/dev/null)
+for precision in 10 12 14; do
+	estimate=$(./hnStat distinct --approx=$precision hn_logs.tsv 2>/dev/null | cut -f1 -d' ')
+	[ $(( (estimate - exact)*(estimate - exact)*(1 << precision) )) -le $(( 9*exact*exact*108/100 )) ]
+	[ "$(./hnStat distinct --approx=$precision --threads=3 hn_logs.tsv 2>/dev/null | cut -f1 -d' ')" == "$estimate" ]
+done
+[[ "$(./hnStat distinct --approx=2 test-sample 2>&1)" =~ "bad approx precision" ]]
+ok "APPROX DISTINCT"
+
+# Rollup sidecar: same results, whole buckets and edges, and rebuilt when stale
+cp hn_logs.tsv test-rollup.tsv
+for bucket in 60 3600; do
+	./hnStat rollup --bucket=$bucket test-rollup.tsv 2>/dev/null
+	test -f test-rollup.tsv.hnroll
+	for range in "" "--from $from --to $to" "--from $((from+1)) --to $((from+1000))" "--from $from" "--to $to"; do
+		[ "$(./hnStat top 10 $range test-rollup.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 10 --rollup=no $range test-rollup.tsv 2>/dev/null | hash_string)" ]
+		[ "$(./hnStat distinct $range test-rollup.tsv 2>/dev/null)" == "$(./hnStat distinct --rollup=no $range test-rollup.tsv 2>/dev/null)" ]
+		exact=$(./hnStat distinct --rollup=no $range test-rollup.tsv 2>/dev/null)
+		estimate=$(./hnStat distinct --approx $range test-rollup.tsv 2>/dev/null | cut -f1 -d' ')
+		[ $(( (estimate - exact)*(estimate - exact)*400 )) -le $(( exact*exact )) ]
+	done
+done
+[[ "$(./hnStat top 10 --from $from --to $to test-rollup.tsv 2>&1 >/dev/null)" =~ "rollup:" ]]
+cp test-sample test-sample-rollup
+./hnStat rollup --bucket=10 test-sample-rollup 2>/dev/null
+[ "$(./hnStat distinct --from 50 test-sample-rollup 2>/dev/null)" == "8" ]
+echo "52	six" >> test-sample-rollup
+[[ "$(./hnStat distinct --from 50 test-sample-rollup 2>&1 >/dev/null)" =~ "rebuilding stale rollup" ]]
+[ "$(./hnStat distinct --from 50 test-sample-rollup 2>/dev/null)" == "9" ]
+buckets=$(od -An -t u8 -j 56 -N 8 test-sample-rollup.hnroll | tr -d ' ')
+strings=$(od -An -t u8 -j 64 -N 8 test-sample-rollup.hnroll | tr -d ' ')
+printf '\377\377\377\377' | dd of=test-sample-rollup.hnroll bs=1 seek=$((96+buckets*32+strings*24)) conv=notrunc 2>/dev/null
+[[ "$(./hnStat distinct --from 50 test-sample-rollup 2>&1 >/dev/null)" =~ "rebuilding invalid rollup" ]]
+[ "$(./hnStat distinct --from 50 test-sample-rollup 2>/dev/null)" == "9" ]
+rm -f test-rollup.tsv test-rollup.tsv.hnroll test-sample-rollup test-sample-rollup.hnroll
+ok "ROLLUP"
+
+# Batch queries: same results as one run per query, overlapping ranges included
+base=1438387423
+for h in $(seq 0 7); do
+	f=$((base+h*3600))
+	echo "top 5 $f $((f+3599))"
+	echo "distinct $f $((f+3599))"
+done > test-batch
+echo "distinct $base $((base+28799))" >> test-batch
+echo "top 10 $((base+1800)) $((base+9000))" >> test-batch
+while read mode count f t; do
+	if [ "$mode" == "top" ]; then
+		./hnStat top $count --from $f --to $t hn_logs.tsv 2>/dev/null
+	else
+		./hnStat distinct --from $count --to $f hn_logs.tsv 2>/dev/null
+	fi
+	echo
+done < test-batch > test-batch-ref
+./hnStat batch test-batch hn_logs.tsv 2>/dev/null | cmp - test-batch-ref
+./hnStat batch --threads=3 - hn_logs.tsv < test-batch 2>/dev/null | cmp - test-batch-ref
+[ "$(echo "distinct 30 300" | ./hnStat batch - test-sample 2>/dev/null)" == "9" ]
+[[ "$(echo "top ten" | ./hnStat batch - test-sample 2>&1)" =~ "invalid query" ]]
+[ "$(printf "distinct 1438500000 1438400000\ndistinct 1438400000 1438500000\n" | ./hnStat batch - hn_logs.tsv 2>/dev/null | head -1)" == "$(./hnStat distinct --from 1438500000 --to 1438400000 hn_logs.tsv 2>/dev/null)" ]
+rm -f test-batch test-batch-ref
+ok "BATCH"
+
+# Query server: same results as the command line, concurrent clients, cached ranges
+./hnStat serve --socket=test-socket --threads=3 hn_logs.tsv 2>/dev/null &
+server=$!
+for i in $(seq 50); do ./hnStat client --socket=test-socket </dev/null 2>/dev/null && break; sleep 0.1; done
+[ "$(echo "distinct 0 9999999999" | ./hnStat client --socket=test-socket)" == "$(./hnStat distinct hn_logs.tsv 2>/dev/null)" ]
+for i in 1 2 3 4; do
+	printf "top 10 $from $to\ndistinct $from $to\n" | ./hnStat client --socket=test-socket > test-client-$i &
+done
+wait $(jobs -p | grep -v "^$server$")
+(./hnStat top 10 --from $from --to $to hn_logs.tsv; ./hnStat distinct --from $from --to $to hn_logs.tsv) 2>/dev/null > test-client-ref
+for i in 1 2 3 4; do
+	cmp test-client-$i test-client-ref
+done
+[ "$(echo "top 3 $from $to" | ./hnStat client --socket=test-socket)" == "$(head -3 test-client-ref)" ]
+[ "$(echo "top 200 $from $to" | ./hnStat client --socket=test-socket | hash_string)" == "$(./hnStat top 200 --from $from --to $to hn_logs.tsv 2>/dev/null | hash_string)" ]
+[ "$(echo "top ten" | ./hnStat client --socket=test-socket)" == "error: invalid request" ]
+[[ "$( (echo "distinct 0 9999999999"; head -c 5000 /dev/zero | tr '\0' x; echo) | ./hnStat client --socket=test-socket 2>&1)" =~ ^[0-9]+.error:\ request\ too\ long ]]
+kill $server
+wait $server
+[ ! -e test-socket ]
+# An idle client does not hold the single worker
+./hnStat serve --socket=test-socket --threads=1 hn_logs.tsv 2>/dev/null &
+server=$!
+for i in $(seq 50); do ./hnStat client --socket=test-socket </dev/null 2>/dev/null && break; sleep 0.1; done
+(echo "distinct 0 9999999999"; sleep 3) | ./hnStat client --socket=test-socket > test-client-idle &
+idle=$!
+sleep 0.5
+[ "$(echo "top 3 $from $to" | timeout 2 ./hnStat client --socket=test-socket)" == "$(head -3 test-client-ref)" ]
+wait $idle
+[ "$(cat test-client-idle)" == "$(./hnStat distinct hn_logs.tsv 2>/dev/null)" ]
+kill $server
+wait $server
+[ ! -e test-socket ]
+rm -f test-client-*
+ok "SERVER"
+
+# Multiple files: same results as the whole file, files outside of range skipped
+lines=$(wc -l < hn_logs.tsv)
+split -l $((lines/3+1)) -d hn_logs.tsv test-part-
+[ "$(./hnStat top 10 test-part-00 test-part-01 test-part-02 2>/dev/null)" == "$(./hnStat top 10 hn_logs.tsv 2>/dev/null)" ]
+[ "$(./hnStat distinct --threads=2 'test-part-*' 2>/dev/null)" == "$(./hnStat distinct hn_logs.tsv 2>/dev/null)" ]
+[ "$(./hnStat top 10 --approx --threads=2 test-part-0? 2>/dev/null | cut -f1,2 -d' ')" == "$(./hnStat top 10 hn_logs.tsv 2>/dev/null)" ]
+counters=$(./hnStat top 1 --approx --memory=10M hn_logs.tsv 2>&1 | grep -o "approx counters=[0-9]*")
+[ "$(./hnStat top 1 --approx --memory=30M --threads=2 test-part-0? 2>&1 | grep -o "approx counters=[0-9]*" | sort -u)" == "$counters" ]
+middle=$(head -1 test-part-01 | cut -f1)
+[ "$(./hnStat top 10 --from $((middle+3600)) --to $((middle+7200)) test-part-0? 2>/dev/null)" == "$(./hnStat top 10 --from $((middle+3600)) --to $((middle+7200)) hn_logs.tsv 2>/dev/null)" ]
+[[ "$(./hnStat distinct --from $((middle+3600)) --to $((middle+7200)) test-part-0? 2>&1)" =~ "3 files, 2 skipped" ]]
+[[ "$(./hnStat distinct 'test-none-*' 2>&1)" =~ "no file matching" ]]
+rm -f test-part-*
+ok "MULTIPLE FILES"
+
+# Compressed input: streamed, same results as the plain file
+gzip -c hn_logs.tsv > test-stream.gz
+(head -1000 hn_logs.tsv | bzip2 -c; tail -n +1001 hn_logs.tsv | bzip2 -c) > test-stream.bz2
+for f in test-stream.gz test-stream.bz2; do
+	[ "$(./hnStat top 10 $f 2>/dev/null)" == "$(./hnStat top 10 hn_logs.tsv 2>/dev/null)" ]
+	[ "$(./hnStat distinct --from $from --to $to $f 2>/dev/null)" == "$(./hnStat distinct --from $from --to $to hn_logs.tsv 2>/dev/null)" ]
+	[ "$(./hnStat distinct --approx $f 2>/dev/null)" == "$(./hnStat distinct --approx hn_logs.tsv 2>/dev/null)" ]
+done
+head -c 10000 test-stream.gz > test-stream-truncated.gz
+[[ "$(./hnStat distinct test-stream-truncated.gz 2>&1)" =~ "could not read gzip stream" ]]
+[[ "$(./hnStat index test-stream.gz 2>&1)" =~ "only supported" ]]
+[[ "$(./hnStat distinct hn_logs.tsv test-stream.gz 2>&1)" =~ "only supported as a single file" ]]
+[[ "$(cat hn_logs.tsv | ./hnStat distinct hn_logs.tsv - 2>&1)" =~ "only supported as a single file" ]]
+rm -f test-stream*
+ok "COMPRESSED INPUT"
+
+# Standard input and pipes: streamed, same results as the mapped file
+[ "$(cat hn_logs.tsv | ./hnStat top 10 - 2>/dev/null)" == "$(./hnStat top 10 hn_logs.tsv 2>/dev/null)" ]
+[ "$(cat hn_logs.tsv | ./hnStat distinct --from $from --to $to /dev/stdin 2>/dev/null)" == "$(./hnStat distinct --from $from --to $to hn_logs.tsv 2>/dev/null)" ]
+rm -f test-fifo
+mkfifo test-fifo
+cat hn_logs.tsv > test-fifo &
+[ "$(./hnStat top 10 test-fifo 2>/dev/null)" == "$(./hnStat top 10 hn_logs.tsv 2>/dev/null)" ]
+wait
+[ "$(printf "" | ./hnStat distinct - 2>/dev/null)" == "0" ]
+[[ "$(printf "" | ./hnStat index - 2>&1)" =~ "only supported" ]]
+# Queries larger than 16MiB are streamed too
+rm -f test-fifo
+(printf '10\tshort\n11\t'; head -c 17000000 /dev/zero | tr '\0' x; printf '\n12\tshort\n') > test-fifo
+[ "$(cat test-fifo | ./hnStat top 2 - 2>/dev/null | hash_string)" == "$(./hnStat top 2 test-fifo 2>/dev/null | hash_string)" ]
+rm -f test-fifo
+ok "STANDARD INPUT"
+
+# Compiled logs: exact ranges, same results as the log file
+./hnStat compile hn_logs.tsv test-compiled.hnc 2>/dev/null
+[ "$(./hnStat top 200 test-compiled.hnc 2>/dev/null | hash_string)" == "$(./hnStat top 200 hn_logs.tsv 2>/dev/null | hash_string)" ]
+[ "$(./hnStat top 10 --from $from --to $to test-compiled.hnc 2>/dev/null)" == "$(./hnStat top 10 --from $from --to $to --fast-seek=no hn_logs.tsv 2>/dev/null)" ]
+[ "$(./hnStat distinct --from $from --to $to test-compiled.hnc 2>/dev/null)" == "$(./hnStat distinct --from $from --to $to --fast-seek=no hn_logs.tsv 2>/dev/null)" ]
+./hnStat compile test-sample test-compiled.hnc 2>/dev/null
+[ "$(./hnStat distinct --from 30 --to 300 test-compiled.hnc 2>/dev/null)" == "9" ]
+[[ "$(./hnStat distinct --approx test-compiled.hnc 2>&1)" =~ "only supported" ]]
+[[ "$(./hnStat compile test-sample 2>&1)" =~ "missing argument" ]]
+# Identifiers outside of the dictionary are invalid records, and bad dictionary offsets are rejected
+strings=$(od -An -t u8 -j 24 -N 8 test-compiled.hnc | tr -d ' ')
+checkpoints=$(od -An -t u8 -j 32 -N 8 test-compiled.hnc | tr -d ' ')
+printf '\377\377\377\377' | dd of=test-compiled.hnc bs=1 seek=$((64+checkpoints*16+(strings+1)*8)) conv=notrunc 2>/dev/null
+[[ "$(./hnStat top 10 test-compiled.hnc 2>&1)" =~ "1 records invalid" ]]
+printf '\377\377\377\377' | dd of=test-compiled.hnc bs=1 seek=$((64+checkpoints*16)) conv=notrunc 2>/dev/null
+[[ "$(./hnStat distinct test-compiled.hnc 2>&1)" =~ "could not load compiled file: Invalid argument" ]]
+rm -f test-compiled.hnc
+ok "COMPILED"
+
+# Canonical queries: encoding and case variants are merged, whatever the input
+printf '10\ta%%20b\n11\ta+b\n12\ta%%2520b\n13\tA B\n14\tHello%%41\n15\thelloa\n16\t%%zzx\n17\tx\n' > test-canonical
+[ "$(./hnStat distinct test-canonical 2>/dev/null)" == "8" ]
+[ "$(./hnStat distinct --decode test-canonical 2>/dev/null)" == "5" ]
+[ "$(./hnStat distinct --casefold test-canonical 2>/dev/null)" == "8" ]
+[ "$(./hnStat top 1 --decode --casefold test-canonical 2>/dev/null)" == "a b 4" ]
+[ "$(./hnStat top 3 --decode --casefold --threads=3 test-canonical 2>/dev/null)" == "$(cat test-canonical | ./hnStat top 3 --decode --casefold - 2>/dev/null)" ]
+[ "$(./hnStat top 200 --decode --threads=3 hn_logs.tsv 2>/dev/null | hash_string)" == "$(gzip -c hn_logs.tsv > test-canonical.gz && ./hnStat top 200 --decode test-canonical.gz 2>/dev/null | hash_string)" ]
+[[ "$(./hnStat top 10 --approx --decode test-canonical 2>&1)" =~ "not supported" ]]
+# Literal percent signs are kept, and never decoded again
+printf '10\t50%%25+off\n11\t50ff\n12\t100%%25\n13\t100\n14\t50%%25%%20off\n15\t%%2541\n' > test-canonical
+[ "$(./hnStat top 10 --decode test-canonical 2>/dev/null)" == "$(printf '50%% off 2\nA 1\n50ff 1\n100%% 1\n100 1')" ]
+rm -f test-canonical test-canonical.gz
+ok "CANONICAL"
+
+# Mapping policies: same results, whatever the read-ahead strategy
+for policy in populate hugepage willneed prefetch; do
+	[ "$(./hnStat top 10 --map=$policy --readahead=1M --rollup=no --threads=3 hn_logs.tsv 2>/dev/null)" == "$(./hnStat top 10 --rollup=no hn_logs.tsv 2>/dev/null)" ]
+	[ "$(./hnStat distinct --map=$policy --readahead=64K --from $from --to $to hn_logs.tsv 2>/dev/null)" == "$(./hnStat distinct --from $from --to $to hn_logs.tsv 2>/dev/null)" ]
+done
+[[ "$(./hnStat distinct --map=unknown hn_logs.tsv 2>&1)" =~ "bad mapping policy" ]]
+ok "MAPPING POLICIES"
+
+# Read modes: records read into a ring of buffers, same results as the mapping
+for read in pread direct; do
+	[ "$(./hnStat top 200 --read=$read --rollup=no --threads=3 hn_logs.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 200 --rollup=no hn_logs.tsv 2>/dev/null | hash_string)" ]
+	[ "$(./hnStat distinct --read=$read --index=no --from $from --to $to hn_logs.tsv 2>/dev/null)" == "$(./hnStat distinct --index=no --from $from --to $to hn_logs.tsv 2>/dev/null)" ]
+	[ "$(./hnStat top 10 --read=$read --decode test-sample 2>/dev/null)" == "$(./hnStat top 10 --decode test-sample 2>/dev/null)" ]
+done
+(printf '10\tshort\n11\t'; head -c 9000000 /dev/zero | tr '\0' x; printf '\n12\tshort\n13\tend') > test-read
+[ "$(./hnStat top 3 --read=pread test-read 2>/dev/null | hash_string)" == "$(./hnStat top 3 test-read 2>/dev/null | hash_string)" ]
+[[ "$(./hnStat top 10 --approx --read=pread hn_logs.tsv 2>&1)" =~ "not supported" ]]
+rm -f test-read
+ok "READ MODES"
+
+# Drop-behind: same results, pages being dropped behind the cursor, and the peak RSS reported
+for args in "--drop-behind=64K" "--drop-behind=64K --threads=3" "--drop-behind=64K --map=prefetch --readahead=256K" "--drop-behind=64K --read=pread" "--drop-behind=64K --decode"; do
+	[ "$(./hnStat top 200 $args --rollup=no hn_logs.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 200 ${args/--drop-behind=64K/} --rollup=no hn_logs.tsv 2>/dev/null | hash_string)" ]
+done
+[ "$(./hnStat distinct --drop-behind=1M --index=no --from $from --to $to hn_logs.tsv 2>/dev/null)" == "$(./hnStat distinct --index=no --from $from --to $to hn_logs.tsv 2>/dev/null)" ]
+[[ "$(./hnStat top 10 --drop-behind=1M --rollup=no hn_logs.tsv 2>&1 >/dev/null)" =~ "peak rss=" ]]
+[[ "$(./hnStat top 10 --drop-behind=0 hn_logs.tsv 2>&1)" =~ "bad drop-behind value" ]]
+[[ "$(./hnStat top 10 --approx --drop-behind=1M hn_logs.tsv 2>&1)" =~ "not supported" ]]
+ok "DROP BEHIND"
+
+# Structured statistics: same results, and per-phase metrics on the standard error
+[ "$(./hnStat top 200 --stats=json --rollup=no --threads=3 hn_logs.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 200 --rollup=no hn_logs.tsv 2>/dev/null | hash_string)" ]
+stats="$(./hnStat top 10 --stats=json --rollup=no --threads=3 hn_logs.tsv 2>&1 >/dev/null)"
+for name in phases '"name": "scan"' '"name": "merge"' records_per_s table_probe_histogram peak_rss; do
+	[[ "$stats" =~ "$name" ]]
+done
+[[ "$(./hnStat distinct --approx --stats=json --from $from --to $to hn_logs.tsv 2>&1 >/dev/null)" =~ "approx_precision" ]]
+[[ "$(./hnStat distinct --stats=json --perf hn_logs.tsv 2>&1 >/dev/null)" =~ "\"perf\": {\"available\"" ]]
+[[ "$(./hnStat top 10 --stats=xml hn_logs.tsv 2>&1)" =~ "bad stats format" ]]
+[[ "$(./hnStat top 10 --perf hn_logs.tsv 2>&1)" =~ "requires --stats=json" ]]
+[[ "$(cat hn_logs.tsv | ./hnStat top 10 --stats=json - 2>&1)" =~ "single mapped file" ]]
+ok "STATS"
+
+# Memory accounting: the hashtable and heap are accounted, and the limit fails fast or degrades to approximate counting
+stats="$(./hnStat top 10 --stats=json --rollup=no --threads=3 hn_logs.tsv 2>&1 >/dev/null)"
+for name in memory_peak memory_allocations table_bytes_per_query table_fragmentation; do
+	[[ "$stats" =~ "$name" ]]
+done
+[ "$(./hnStat top 200 --max-memory=64M --rollup=no --threads=3 hn_logs.tsv 2>/dev/null | hash_string)" == "$(./hnStat top 200 --rollup=no hn_logs.tsv 2>/dev/null | hash_string)" ]
+[[ "$(./hnStat top 10 --max-memory=256K --rollup=no hn_logs.tsv 2>&1)" =~ "memory limit of 256K exceeded" ]]
+! ./hnStat distinct --max-memory=256K --threads=3 hn_logs.tsv >/dev/null 2>&1
+[ "$(./hnStat top 3 --max-memory=256K --degrade --rollup=no hn_logs.tsv 2>/dev/null | cut -f1,2 -d' ')" == "$(./hnStat top 3 --rollup=no hn_logs.tsv 2>/dev/null)" ]
+[ "$(./hnStat distinct --max-memory=256K --degrade --rollup=no hn_logs.tsv 2>/dev/null)" == "$(./hnStat distinct --approx --rollup=no hn_logs.tsv 2>/dev/null)" ]
+[[ "$(./hnStat top 10 --max-memory=256K --degrade --stats=json --rollup=no hn_logs.tsv 2>&1 >/dev/null)" =~ "\"memory_degraded\": 1" ]]
+[[ "$(./hnStat top 10 --degrade hn_logs.tsv 2>&1)" =~ "requires --max-memory" ]]
+[[ "$(./hnStat top 10 --max-memory=0 hn_logs.tsv 2>&1)" =~ "bad max-memory value" ]]
+ok "MEMORY ACCOUNTING"
+
+# Synthetic logs: deterministic, with the requested cardinality
+./hnBench generate test-synth --size=2M --queries=1000 --skew=0 --length=2:30 --jitter=60 >/dev/null
+./hnBench generate test-synth2 --size=2M --queries=1000 --skew=0 --length=2:30 --jitter=60 >/dev/null
+cmp -s test-synth test-synth2
+[ "$(./hnStat distinct --index=no --rollup=no test-synth 2>/dev/null)" == "1000" ]
+[ "$(./hnStat distinct --index=no --rollup=no --fast-seek=no --from 1438387500 --to 1438388000 test-synth 2>/dev/null)" == "$(./hnStat distinct --index=no --rollup=no --jitter=60 --from 1438387500 --to 1438388000 test-synth 2>/dev/null)" ]
+[[ "$(./hnBench generate test-synth --length=5:2 2>&1)" =~ "bad length range" ]]
+
+# Benchmark drivers, and their JSON results
+./hnBench generate test-synth --size=1M --queries=500 >/dev/null
+results="$(./hnBench all test-synth 1 --json 2>/dev/null)"
+for name in tokenize/fused insert/batch topk/10 locate/index run/top10/range/threads=1 read/pread/warm; do
+	[[ "$results" =~ "\"name\": \"$name\"" ]]
+done
+[[ "$results" =~ "\"success\": true" ]]
+rm -f test-synth test-synth2
+ok "SYNTHETIC LOGS"
+
+# Follow mode: appended lines are added to the results, and rotated files are followed
+head -1000 hn_logs.tsv > test-follow
+./hnStat distinct --follow=1 test-follow > test-follow-out 2>/dev/null &
+follower=$!
+for i in $(seq 50); do [ -s test-follow-out ] && break; sleep 0.1; done
+(sed -n 1001,2000p hn_logs.tsv; printf "1438387200\tpartial") > test-follow-append
+cat test-follow-append >> test-follow
+for i in $(seq 50); do [ "$(grep -c "^$" test-follow-out)" -ge 2 ] && break; sleep 0.1; done
+mv test-follow test-follow.1
+sed -n 2001,2500p hn_logs.tsv > test-follow-append
+mv test-follow-append test-follow
+for i in $(seq 50); do [ "$(grep -c "^$" test-follow-out)" -ge 3 ] && break; sleep 0.1; done
+kill $follower
+wait $follower || true
+head -1000 hn_logs.tsv > test-follow-ref
+./hnStat distinct test-follow-ref 2>/dev/null > test-follow-ref-out
+echo >> test-follow-ref-out
+head -2000 hn_logs.tsv > test-follow-ref
+./hnStat distinct test-follow-ref 2>/dev/null >> test-follow-ref-out
+echo >> test-follow-ref-out
+head -2500 hn_logs.tsv > test-follow-ref
+./hnStat distinct test-follow-ref 2>/dev/null >> test-follow-ref-out
+echo >> test-follow-ref-out
+cmp test-follow-out test-follow-ref-out
+rm -f test-follow test-follow.1 test-follow-*
+
+# Follow mode of an empty file, rotated to an empty file
+: > test-follow
+./hnStat distinct --follow=1 test-follow > test-follow-out 2>/dev/null &
+follower=$!
+for i in $(seq 50); do [ -s test-follow-out ] && break; sleep 0.1; done
+head -100 hn_logs.tsv >> test-follow
+for i in $(seq 50); do [ "$(grep -c "^$" test-follow-out)" -ge 2 ] && break; sleep 0.1; done
+mv test-follow test-follow.1
+: > test-follow
+sleep 0.5
+sed -n 101,150p hn_logs.tsv >> test-follow
+for i in $(seq 50); do [ "$(grep -c "^$" test-follow-out)" -ge 3 ] && break; sleep 0.1; done
+kill $follower
+wait $follower || true
+[ "$(grep -v "^$" test-follow-out | tr '\n' ' ')" == "0 $(head -100 hn_logs.tsv | ./hnStat distinct - 2>/dev/null) $(head -150 hn_logs.tsv | ./hnStat distinct - 2>/dev/null) " ]
+[[ "$(./hnStat index --follow test-sample 2>&1)" =~ "only supported" ]]
+rm -f test-follow test-follow.1 test-follow-*
+ok "FOLLOW"
+
 # Torture tests: give fat binaries and not expect a crash
 for f in /usr/lib/x86_64-linux-gnu/*.so; do
 	./hnStat top 10 "$f" >/dev/null 2>/dev/null
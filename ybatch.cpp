@@ -0,0 +1,140 @@
+/**
+ * YCombinator Logs Batch Queries.
+ * Queries definition, and time-segmented counting of the queries of several ranges in a single scan
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include "ybatch.hpp"
+
+/**
+ * Parse a timestamp or a count.
+ *
+ * @return @c true upon success
+ **/
+static bool parse_number(const std::string &s, long long &value) {
+  char *end = NULL;
+  value = strtoll(s.c_str(), &end, 10);
+  return !s.empty() && end != NULL && *end == '\0' && value >= 0;
+}
+
+bool YQuery::parse(const std::string &line) {
+  std::istringstream stream(line);
+  std::vector<std::string> tokens;
+  std::string token;
+  while(stream >> token) {
+    tokens.push_back(token);
+  }
+
+  long long value_count = 0;
+  long long value_from;
+  long long value_to;
+  top = tokens.size() == 4 && tokens[0] == "top";
+  if (!(top || (tokens.size() == 3 && tokens[0] == "distinct"))
+      || (top && !parse_number(tokens[1], value_count))
+      || !parse_number(tokens[tokens.size() - 2], value_from)
+      || !parse_number(tokens[tokens.size() - 1], value_to)) {
+    return false;
+  }
+  count = static_cast<size_t>(value_count);
+  from = static_cast<time_t>(value_from);
+  to = static_cast<time_t>(value_to);
+  return true;
+}
+
+SegmentedMap::SegmentedMap(const std::vector<YQuery> &queries) {
+  // Cut the timeline at every range start, and after every range end
+  for(const YQuery &query : queries) {
+    starts.push_back(query.from);
+    if (query.to != std::numeric_limits<time_t>::max()) {
+      starts.push_back(query.to + 1);
+    }
+  }
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+  // A segment is counted if a range covers it
+  used.assign(starts.size(), false);
+  for(const YQuery &query : queries) {
+    for(size_t i = find_segment(query.from); i < starts.size() && starts[i] <= query.to; i++) {
+      used[i] = true;
+    }
+  }
+
+  maps.resize(starts.size());
+}
+
+size_t SegmentedMap::find_segment(time_t stamp) const {
+  const auto it = std::upper_bound(starts.begin(), starts.end(), stamp);
+  return it != starts.begin() ? (it - starts.begin()) - 1 : 0;
+}
+
+void SegmentedMap::add_batch(const RefString *keys, const time_t *stamps, size_t count) {
+  // Records are mostly sorted: insert runs of the same segment at once
+  size_t i = 0;
+  while(i < count) {
+    const size_t segment = find_segment(stamps[i]);
+    const time_t low = starts[segment];
+    const time_t high = segment + 1 < starts.size() ? starts[segment + 1] : std::numeric_limits<time_t>::max();
+    size_t j = i + 1;
+    for(; j < count && stamps[j] >= low && stamps[j] < high; j++) ;
+    if (used[segment]) {
+      maps[segment].add_batch(&keys[i], j - i);
+    }
+    i = j;
+  }
+}
+
+void SegmentedMap::merge(const SegmentedMap &other) {
+  assert(starts == other.starts);
+  for(size_t i = 0; i < maps.size(); i++) {
+    maps[i].merge(other.maps[i]);
+  }
+}
+
+void SegmentedMap::swap(SegmentedMap &other) {
+  starts.swap(other.starts);
+  used.swap(other.used);
+  maps.swap(other.maps);
+}
+
+const RefStringUnorderedHashMap<unsigned>& SegmentedMap::get_range(time_t from, time_t to,
+                                                                   RefStringUnorderedHashMap<unsigned> &merged) const {
+  // An inverted range is empty
+  if (from > to) {
+    merged.clear();
+    return merged;
+  }
+
+  const size_t first = find_segment(from);
+  size_t last = first;
+  for(; last + 1 < starts.size() && starts[last + 1] <= to; last++) ;
+
+  // A single segment needs no merge
+  if (first == last) {
+    return maps[first];
+  }
+
+  // Start from the largest segment
+  size_t largest = first;
+  for(size_t i = first; i <= last; i++) {
+    if (maps[i].size() > maps[largest].size()) {
+      largest = i;
+    }
+  }
+  merged = maps[largest];
+  for(size_t i = first; i <= last; i++) {
+    if (i != largest) {
+      merged.merge(maps[i]);
+    }
+  }
+  return merged;
+}
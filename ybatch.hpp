@@ -0,0 +1,131 @@
+/**
+ * YCombinator Logs Batch Queries.
+ * Queries definition, and time-segmented counting of the queries of several ranges in a single scan
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_YBATCH_HPP
+#define RX_YBATCH_HPP
+
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "refstringmap.hpp"
+
+/**
+ * A query: "distinct FROM TO", or "top K FROM TO".
+ **/
+struct YQuery {
+  YQuery(): top(false), count(0), from(0), to(0)
+  {
+  }
+
+  /**
+   * Parse a query line.
+   *
+   * @param line The query line
+   * @return @c true if the line is a valid query
+   **/
+  bool parse(const std::string &line);
+
+  // Top queries (otherwise, distinct queries)
+  bool top;
+
+  // Number of top queries
+  size_t count;
+
+  // Start timestamp
+  time_t from;
+
+  // End timestamp (inclusive)
+  time_t to;
+};
+
+/**
+ * Result of a query.
+ **/
+struct YQueryResult {
+  YQueryResult(): distinct(0)
+  {
+  }
+
+  // Number of distinct queries
+  size_t distinct;
+
+  // Top queries, sorted in descending order
+  std::vector<std::pair<RefString, unsigned>> top;
+};
+
+/**
+ * Queries counts, split by time segments: the timeline is cut at every range
+ * boundary of a set of queries, so that each record is counted once, in the
+ * segment holding its timestamp, and each range is the union of consecutive
+ * segments. Segments not covered by any range are not counted.
+ **/
+class SegmentedMap {
+public:
+  /**
+   * Create the segments of a set of queries.
+   *
+   * @param queries The queries
+   **/
+  explicit SegmentedMap(const std::vector<YQuery> &queries);
+
+  /**
+   * Add a batch of records; consecutive records of the same segment are
+   * inserted at once (see RefStringUnorderedHashMap::add_batch).
+   *
+   * @param keys The queries
+   * @param stamps The timestamps
+   * @param count The number of records
+   **/
+  void add_batch(const RefString *keys, const time_t *stamps, size_t count);
+
+  /**
+   * Merge another segmented map of the same segments.
+   **/
+  void merge(const SegmentedMap &other);
+
+  /**
+   * Swap with another segmented map.
+   **/
+  void swap(SegmentedMap &other);
+
+  /**
+   * Get the counts of a range, merging its segments if needed.
+   *
+   * @param from The start timestamp (a segment boundary)
+   * @param to The end timestamp (inclusive, a segment boundary minus one)
+   * @param merged The map used if several segments need to be merged
+   * @return The counts of the range (empty if @c from is after @c to)
+   **/
+  const RefStringUnorderedHashMap<unsigned>& get_range(time_t from, time_t to,
+                                                       RefStringUnorderedHashMap<unsigned> &merged) const;
+
+  /**
+   * Return the number of segments.
+   **/
+  size_t get_segments() const {
+    return starts.size();
+  }
+
+protected:
+  /** Index of the segment holding a timestamp (the first one if before). **/
+  size_t find_segment(time_t stamp) const;
+
+protected:
+  // Segment start timestamps, sorted
+  std::vector<time_t> starts;
+
+  // Is a segment covered by a range ?
+  std::vector<bool> used;
+
+  // Counts, per segment
+  std::vector<RefStringUnorderedHashMap<unsigned>> maps;
+};
+
+#endif
@@ -0,0 +1,362 @@
+/**
+ * YCombinator Compiled Logs.
+ * Binary columnar log format: sorted delta-encoded timestamps, query identifiers, and a dictionary
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "ycompiled.hpp"
+#include "streamreader.hpp"
+#include "chrono.hpp"
+
+// Format version
+#define HNC_VERSION 1
+
+/**
+ * Compiled file header.
+ **/
+struct hnc_header {
+  char magic[8];
+  uint64_t version;
+  uint64_t record_count;
+  uint64_t string_count;
+  uint64_t checkpoint_count;
+  uint64_t checkpoint_interval;
+  uint64_t stamps_size;
+  uint64_t strings_size;
+};
+
+/**
+ * Timestamp checkpoint: the timestamp of a record, and the offset of its
+ * (delta) encoding within the timestamps column.
+ **/
+struct hnc_checkpoint {
+  int64_t timestamp;
+  uint64_t offset;
+};
+
+/**
+ * Write a whole buffer.
+ *
+ * @return @c true upon success
+ **/
+static bool write_fully(FILE *fp, const void *buffer, size_t size) {
+  return size == 0 || fwrite(buffer, size, 1, fp) == 1;
+}
+
+/**
+ * Append a LEB128 varint.
+ **/
+static inline void encode_varint(std::vector<uint8_t> &buffer, uint64_t value) {
+  for(; value >= 0x80; value >>= 7) {
+    buffer.push_back(static_cast<uint8_t>(value | 0x80));
+  }
+  buffer.push_back(static_cast<uint8_t>(value));
+}
+
+/**
+ * Read a LEB128 varint, and advance the pointer.
+ **/
+static inline uint64_t decode_varint(const uint8_t *&p) {
+  uint64_t value = 0;
+  for(unsigned shift = 0; ; shift += 7) {
+    const uint8_t byte = *p++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+}
+
+/** Size of the identifiers column, padded to 8 bytes. **/
+static inline uint64_t identifiers_size(uint64_t records) {
+  return (records*sizeof(uint32_t) + 7) & ~static_cast<uint64_t>(7);
+}
+
+bool CompiledLog::build(const MappedRecords<WhyRequest> &records, const char *filename) {
+  // Assign an identifier to each distinct query, in order of appearance
+  RefStringUnorderedHashMap<uint32_t> ids;
+  std::vector<RefString> dictionary;
+  std::vector<std::pair<time_t, uint32_t>> columns;
+  for(const auto &record : records.begin()) {
+    if (!record.is_valid()) {
+      continue;
+    }
+    const RefString query = record.get_raw_query();
+    uint32_t &id = ids[query];
+    if (id == 0) {
+      if (dictionary.size() == std::numeric_limits<uint32_t>::max()) {
+        error = EOVERFLOW;
+        return false;
+      }
+      dictionary.push_back(query);
+      id = static_cast<uint32_t>(dictionary.size());
+    }
+    columns.push_back(std::make_pair(record.get_timestamp(), id - 1));
+  }
+
+  // Sort records by timestamp (keeping the file order of equal ones)
+  std::stable_sort(columns.begin(), columns.end(),
+                   [](const std::pair<time_t, uint32_t> &a, const std::pair<time_t, uint32_t> &b) {
+                     return a.first < b.first;
+                   });
+
+  // Encode columns
+  std::vector<hnc_checkpoint> checkpoint_list;
+  std::vector<uint8_t> stamp_column;
+  std::vector<uint32_t> identifier_column(columns.size());
+  time_t previous = 0;
+  for(size_t i = 0; i < columns.size(); i++) {
+    if (i % HNC_CHECKPOINT_INTERVAL == 0) {
+      const hnc_checkpoint checkpoint = { columns[i].first, stamp_column.size() };
+      checkpoint_list.push_back(checkpoint);
+      previous = columns[i].first;
+    }
+    encode_varint(stamp_column, static_cast<uint64_t>(columns[i].first - previous));
+    previous = columns[i].first;
+    identifier_column[i] = columns[i].second;
+  }
+  identifier_column.resize(identifiers_size(columns.size()) / sizeof(uint32_t), 0);
+
+  std::vector<uint64_t> offsets;
+  uint64_t strings_size = 0;
+  for(const RefString &string : dictionary) {
+    offsets.push_back(strings_size);
+    strings_size += string.len;
+  }
+  offsets.push_back(strings_size);
+
+  hnc_header file_header;
+  memset(&file_header, 0, sizeof(file_header));
+  memcpy(file_header.magic, HNC_MAGIC, sizeof(file_header.magic));
+  file_header.version = HNC_VERSION;
+  file_header.record_count = columns.size();
+  file_header.string_count = dictionary.size();
+  file_header.checkpoint_count = checkpoint_list.size();
+  file_header.checkpoint_interval = HNC_CHECKPOINT_INTERVAL;
+  file_header.stamps_size = stamp_column.size();
+  file_header.strings_size = strings_size;
+
+  // Write a temporary file, and rename it, so that readers never see a partial file
+  const std::string temporary = std::string(filename) + ".tmp." + std::to_string(getpid());
+  FILE *const fp = fopen(temporary.c_str(), "wbe");
+  if (fp == NULL) {
+    error = errno;
+    return false;
+  }
+  bool success = write_fully(fp, &file_header, sizeof(file_header))
+    && write_fully(fp, checkpoint_list.data(), checkpoint_list.size()*sizeof(hnc_checkpoint))
+    && write_fully(fp, offsets.data(), offsets.size()*sizeof(uint64_t))
+    && write_fully(fp, identifier_column.data(), identifier_column.size()*sizeof(uint32_t))
+    && write_fully(fp, stamp_column.data(), stamp_column.size());
+  for(size_t i = 0; success && i < dictionary.size(); i++) {
+    success = write_fully(fp, dictionary[i].str, dictionary[i].len);
+  }
+  if (!success) {
+    error = errno;
+  }
+  if (fclose(fp) != 0 && success) {
+    error = errno;
+    success = false;
+  }
+  if (success && rename(temporary.c_str(), filename) != 0) {
+    error = errno;
+    success = false;
+  }
+  if (!success) {
+    unlink(temporary.c_str());
+    return false;
+  }
+
+  return load(filename);
+}
+
+bool CompiledLog::is_compiled(const char *filename) {
+  // Only regular files can be peeked without consuming their bytes
+  if (!StreamReader::is_mappable(filename)) {
+    return false;
+  }
+
+  char magic[8];
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    return false;
+  }
+  const ssize_t length = pread(fd, magic, sizeof(magic), 0);
+  close(fd);
+  return length == sizeof(magic) && memcmp(magic, HNC_MAGIC, sizeof(magic)) == 0;
+}
+
+bool CompiledLog::load(const char *filename) {
+  header = NULL;
+  map.reset(new ReadOnlyMemoryMap(filename));
+  if (!map->is_valid()) {
+    error = map->get_error();
+    map.reset();
+    return false;
+  }
+
+  // Check the header, and the sections size
+  const size_t size = map->get_size();
+  const unsigned char *const base = map->get_data();
+  const hnc_header *const candidate = reinterpret_cast<const hnc_header*>(base);
+  if (size < sizeof(hnc_header)
+      || memcmp(candidate->magic, HNC_MAGIC, sizeof(candidate->magic)) != 0
+      || candidate->version != HNC_VERSION
+      || candidate->record_count > size
+      || candidate->string_count > size
+      || candidate->checkpoint_interval == 0
+      || candidate->checkpoint_count != (candidate->record_count + candidate->checkpoint_interval - 1) / candidate->checkpoint_interval
+      || candidate->stamps_size > size
+      || candidate->strings_size > size
+      || sizeof(hnc_header)
+      + candidate->checkpoint_count*sizeof(hnc_checkpoint)
+      + (candidate->string_count + 1)*sizeof(uint64_t)
+      + identifiers_size(candidate->record_count)
+      + candidate->stamps_size
+      + candidate->strings_size != size) {
+    error = EINVAL;
+    map.reset();
+    return false;
+  }
+
+  // Check the checkpoints and dictionary offsets: increasing, and within
+  // their section (identifiers are checked while counting)
+  const hnc_checkpoint *const candidate_checkpoints = reinterpret_cast<const hnc_checkpoint*>(base + sizeof(hnc_header));
+  const uint64_t *const candidate_strings = reinterpret_cast<const uint64_t*>(candidate_checkpoints + candidate->checkpoint_count);
+  bool valid = candidate_strings[candidate->string_count] <= candidate->strings_size;
+  for(size_t i = 0; i < candidate->checkpoint_count && valid; i++) {
+    valid = candidate_checkpoints[i].offset < candidate->stamps_size
+      && (i == 0 || candidate_checkpoints[i].offset > candidate_checkpoints[i - 1].offset);
+  }
+  for(size_t i = 0; i < candidate->string_count && valid; i++) {
+    valid = candidate_strings[i] <= candidate_strings[i + 1];
+  }
+  if (!valid) {
+    error = EINVAL;
+    map.reset();
+    return false;
+  }
+
+  header = candidate;
+  checkpoints = candidate_checkpoints;
+  strings = candidate_strings;
+  identifiers = reinterpret_cast<const uint32_t*>(strings + header->string_count + 1);
+  stamps = reinterpret_cast<const uint8_t*>(identifiers) + identifiers_size(header->record_count);
+  data = reinterpret_cast<const char*>(stamps + header->stamps_size);
+  return true;
+}
+
+size_t CompiledLog::get_records() const {
+  return header != NULL ? static_cast<size_t>(header->record_count) : 0;
+}
+
+size_t CompiledLog::get_strings() const {
+  return header != NULL ? static_cast<size_t>(header->string_count) : 0;
+}
+
+RefString CompiledLog::get_string(uint32_t id) const {
+  return RefString(data + strings[id], strings[id + 1] - strings[id]);
+}
+
+size_t CompiledLog::lower_bound(time_t stamp) const {
+  // Last checkpoint before the timestamp (the following records may reach it)
+  const hnc_checkpoint *const end = checkpoints + header->checkpoint_count;
+  const hnc_checkpoint *const it = std::lower_bound(checkpoints, end, stamp,
+                                                    [](const hnc_checkpoint &checkpoint, time_t value) {
+                                                      return checkpoint.timestamp < value;
+                                                    });
+  if (it == checkpoints) {
+    return 0;
+  }
+
+  // Decode its block
+  const size_t block = (it - checkpoints) - 1;
+  size_t index = block*header->checkpoint_interval;
+  const size_t limit = std::min<size_t>(index + header->checkpoint_interval, header->record_count);
+  const uint8_t *p = stamps + checkpoints[block].offset;
+  time_t current = checkpoints[block].timestamp;
+  for(; index < limit; index++) {
+    current += static_cast<time_t>(decode_varint(p));
+    if (current >= stamp) {
+      break;
+    }
+  }
+  return index;
+}
+
+void CompiledLog::locate(time_t range_from, time_t range_to, size_t &first, size_t &last) const {
+  first = lower_bound(range_from);
+  last = range_to != std::numeric_limits<time_t>::max() ? lower_bound(range_to + 1) : get_records();
+  if (last < first) {
+    last = first;
+  }
+}
+
+void CompiledLog::parse_records(bool top) {
+  ChronoTimer timer;
+
+  size_t first;
+  size_t last;
+  locate(from, to, first, last);
+  const std::string seek = timer.tick();
+
+  // Count identifiers in a flat array, or flag them in a bitmap; identifiers
+  // outside of the dictionary are invalid records
+  const size_t strings_count = get_strings();
+  size_t invalid = 0;
+  if (top) {
+    counts.assign(strings_count, 0);
+    for(size_t i = first; i < last; i++) {
+      const uint32_t id = identifiers[i];
+      if (id < strings_count) {
+        counts[id]++;
+      } else {
+        invalid++;
+      }
+    }
+  } else {
+    seen.assign((strings_count + 63) / 64, 0);
+    for(size_t i = first; i < last; i++) {
+      const uint32_t id = identifiers[i];
+      if (id < strings_count) {
+        seen[id >> 6] |= static_cast<uint64_t>(1) << (id & 63);
+      } else {
+        invalid++;
+      }
+    }
+  }
+  const std::string scan = timer.tick();
+
+  std::cerr << last - first - invalid << " records read in " << scan << " (seek: " << seek << " compiled)"
+            << ", " << get_records() - (last - first) << " records skipped, " << invalid << " records invalid, dictionary=" << get_strings() << "\n";
+}
+
+size_t CompiledLog::get_distinct_queries() const {
+  size_t distinct = 0;
+  for(const uint64_t bits : seen) {
+    distinct += __builtin_popcountll(bits);
+  }
+  for(const unsigned count : counts) {
+    distinct += count != 0;
+  }
+  return distinct;
+}
+
+std::vector<std::pair<RefString, unsigned>> CompiledLog::get_top_queries(size_t top_queries) const {
+  return get_top_counts(counts, top_queries, [this](uint32_t id) {
+      return get_string(id);
+    });
+}
@@ -0,0 +1,182 @@
+/**
+ * YCombinator Compiled Logs.
+ * Binary columnar log format: sorted delta-encoded timestamps, query identifiers, and a dictionary
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_YCOMPILED_HPP
+#define RX_YCOMPILED_HPP
+
+#include <inttypes.h>
+#include <time.h>
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "yrequest.hpp"
+
+// Compiled log file magic
+#define HNC_MAGIC "HNCOMP\0"
+
+// Number of records between two timestamp checkpoints
+#define HNC_CHECKPOINT_INTERVAL 1024
+
+/** On-disk structures (see ycompiled.cpp) **/
+struct hnc_header;
+struct hnc_checkpoint;
+
+/**
+ * Compiled log file: records are sorted by timestamp, and stored in columns,
+ * so that ranges are located exactly, and queries are counted as integers.
+ *
+ * On-disk format (native byte order, mapped as is):
+ *   header: magic "HNCOMP", version, record count, string count, checkpoint count, timestamps size, strings size
+ *   checkpoints: { int64 timestamp, uint64 offset } * checkpoint count, one every HNC_CHECKPOINT_INTERVAL records
+ *   strings: uint64 offset * (string count + 1)
+ *   identifiers: uint32 query identifier * record count (padded to 8 bytes)
+ *   timestamps: sorted, delta and LEB128 varint encoded, each checkpoint restarting from its timestamp
+ *   strings data
+ **/
+class CompiledLog {
+public:
+  /**
+   * Create an empty (unloaded) compiled log.
+   **/
+  CompiledLog(): header(NULL), checkpoints(NULL), strings(NULL), identifiers(NULL), stamps(NULL), data(NULL),
+                 from(0), to(std::numeric_limits<time_t>::max()), error(0)
+  {
+  }
+
+  /**
+   * Compile mapped records, and write them to a file.
+   *
+   * @param records The mapped records
+   * @param filename The compiled file path
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool build(const MappedRecords<WhyRequest> &records, const char *filename);
+
+  /**
+   * Load (map) a compiled file.
+   *
+   * @param filename The compiled file path
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool load(const char *filename);
+
+  /**
+   * Is a file a compiled log (see @c HNC_MAGIC) ?
+   *
+   * @param filename The file path
+   * @return @c true if the file starts with the compiled log magic
+   **/
+  static bool is_compiled(const char *filename);
+
+  /**
+   * Set the range start
+   *
+   * @param timestamp The start range (seconds since Epoch)
+   **/
+  void set_start(time_t timestamp) {
+    from = timestamp;
+  }
+
+  /**
+   * Set the range end
+   *
+   * @param timestamp The ending range (seconds since Epoch)
+   **/
+  void set_end(time_t timestamp) {
+    to = timestamp;
+  }
+
+  /**
+   * Count the queries of the range, by identifier.
+   *
+   * @param top If @c true, count the occurrences of queries; only flag seen queries otherwise
+   **/
+  void parse_records(bool top);
+
+  /**
+   * Get the number of distinct queries.
+   *
+   * @comment This function can only be called after @c parse_records
+   **/
+  size_t get_distinct_queries() const;
+
+  /**
+   * Get the top queries.
+   *
+   * @param top_queries The maximum number of top queries to retreive
+   * @return The list of top queries, sorted in descending order
+   * @comment This function can only be called after @c parse_records(true)
+   **/
+  std::vector<std::pair<RefString, unsigned>> get_top_queries(size_t top_queries = 10) const;
+
+  /**
+   * Locate the records of a range exactly.
+   *
+   * @param range_from The start of the range
+   * @param range_to The end of the range (inclusive)
+   * @param first The first record of the range
+   * @param last The record following the range
+   **/
+  void locate(time_t range_from, time_t range_to, size_t &first, size_t &last) const;
+
+  /**
+   * Return the number of records.
+   **/
+  size_t get_records() const;
+
+  /**
+   * Return the number of distinct queries of the dictionary.
+   **/
+  size_t get_strings() const;
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+protected:
+  /**
+   * Index of the first record whose timestamp is not lower than a timestamp.
+   **/
+  size_t lower_bound(time_t stamp) const;
+
+  /** The dictionary string of a query identifier. **/
+  RefString get_string(uint32_t id) const;
+
+protected:
+  // Mapped file, and its sections
+  std::unique_ptr<ReadOnlyMemoryMap> map;
+  const hnc_header *header;
+  const hnc_checkpoint *checkpoints;
+  const uint64_t *strings;
+  const uint32_t *identifiers;
+  const uint8_t *stamps;
+  const char *data;
+
+  // Range
+  time_t from;
+  time_t to;
+
+  // Occurrences of each query, or bitmap of seen queries
+  std::vector<unsigned> counts;
+  std::vector<uint64_t> seen;
+
+  // Last error
+  int error;
+
+private:
+  /* Forbidden foes */
+  CompiledLog(const CompiledLog&) = delete;
+  CompiledLog& operator=(const CompiledLog&) = delete;
+};
+
+#endif
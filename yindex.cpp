@@ -0,0 +1,225 @@
+/**
+ * YCombinator Logs Timestamp Index.
+ * Sparse sidecar index of a log file, giving the byte offsets and the timestamp bounds of its blocks
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <limits>
+
+#include "yindex.hpp"
+
+// Sidecar magic and version
+#define HNIDX_MAGIC "HNIDX\0\0"
+#define HNIDX_VERSION 1
+
+/**
+ * Sidecar header.
+ **/
+struct hnidx_header {
+  char magic[8];
+  uint64_t version;
+  uint64_t file_size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t block_size;
+  uint64_t block_count;
+};
+
+/**
+ * Read exactly @c size bytes.
+ *
+ * @return @c true upon success
+ **/
+static bool read_fully(int fd, void *buffer, size_t size) {
+  unsigned char *dest = reinterpret_cast<unsigned char*>(buffer);
+  while(size != 0) {
+    const ssize_t n = read(fd, dest, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      if (n == 0) {
+        errno = EINVAL;
+      }
+      return false;
+    }
+    dest += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+/**
+ * Write exactly @c size bytes.
+ *
+ * @return @c true upon success
+ **/
+static bool write_fully(int fd, const void *buffer, size_t size) {
+  const unsigned char *src = reinterpret_cast<const unsigned char*>(buffer);
+  while(size != 0) {
+    const ssize_t n = write(fd, src, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    src += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+void TimestampIndex::build(const MappedRecords<WhyRequest> &records, const struct stat &st, size_t size) {
+  assert(size != 0);
+
+  file_size = static_cast<uint64_t>(st.st_size);
+  mtime_sec = st.st_mtim.tv_sec;
+  mtime_nsec = st.st_mtim.tv_nsec;
+  block_size = size;
+  blocks.clear();
+
+  const size_t total = records.get_size();
+  WhyRequest record;
+  size_t offset = 0;
+  while(offset < total) {
+    Block block;
+    block.offset = offset;
+    block.min_stamp = std::numeric_limits<int64_t>::max();
+    block.max_stamp = 0;
+
+    // Records until the block is full; the block ends on a record frontier
+    while(offset < total && offset - block.offset < size) {
+      records.get_record(record, offset);
+      if (record.is_valid()) {
+        const int64_t stamp = record.get_timestamp();
+        if (stamp < block.min_stamp) {
+          block.min_stamp = stamp;
+        }
+        if (stamp > block.max_stamp) {
+          block.max_stamp = stamp;
+        }
+      }
+    }
+
+    blocks.push_back(block);
+  }
+}
+
+bool TimestampIndex::load(const char *filename) {
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    error = errno;
+    return false;
+  }
+
+  struct hnidx_header header;
+  bool success = read_fully(fd, &header, sizeof(header));
+  if (success
+      && (memcmp(header.magic, HNIDX_MAGIC, sizeof(header.magic)) != 0
+          || header.version != HNIDX_VERSION
+          || header.block_size == 0
+          || header.block_count > header.file_size)) {
+    errno = EINVAL;
+    success = false;
+  }
+
+  if (success) {
+    blocks.resize(header.block_count);
+    success = read_fully(fd, blocks.data(), blocks.size()*sizeof(Block));
+  }
+
+  // Block offsets must be increasing, and within the file
+  for(size_t i = 0; success && i < blocks.size(); i++) {
+    if (blocks[i].offset > header.file_size || (i != 0 && blocks[i].offset <= blocks[i - 1].offset)) {
+      errno = EINVAL;
+      success = false;
+    }
+  }
+
+  if (!success) {
+    error = errno;
+    blocks.clear();
+  } else {
+    file_size = header.file_size;
+    mtime_sec = header.mtime_sec;
+    mtime_nsec = header.mtime_nsec;
+    block_size = header.block_size;
+  }
+
+  close(fd);
+  return success;
+}
+
+bool TimestampIndex::save(const char *filename) {
+  struct hnidx_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HNIDX_MAGIC, sizeof(header.magic));
+  header.version = HNIDX_VERSION;
+  header.file_size = file_size;
+  header.mtime_sec = mtime_sec;
+  header.mtime_nsec = mtime_nsec;
+  header.block_size = block_size;
+  header.block_count = blocks.size();
+
+  // Write a temporary file, and rename it, so that readers never see a partial index
+  const std::string temporary = std::string(filename) + ".tmp." + std::to_string(getpid());
+  const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    error = errno;
+    return false;
+  }
+
+  bool success = write_fully(fd, &header, sizeof(header))
+    && write_fully(fd, blocks.data(), blocks.size()*sizeof(Block));
+  if (!success) {
+    error = errno;
+  }
+  if (close(fd) != 0 && success) {
+    error = errno;
+    success = false;
+  }
+  if (success && rename(temporary.c_str(), filename) != 0) {
+    error = errno;
+    success = false;
+  }
+  if (!success) {
+    unlink(temporary.c_str());
+  }
+
+  return success;
+}
+
+bool TimestampIndex::is_fresh(const struct stat &st) const {
+  return file_size == static_cast<uint64_t>(st.st_size)
+    && mtime_sec == st.st_mtim.tv_sec
+    && mtime_nsec == st.st_mtim.tv_nsec;
+}
+
+void TimestampIndex::locate(time_t from, time_t to, size_t &begin, size_t &end) const {
+  // A block may hold records within range only if its bounds overlap the range
+  size_t first = blocks.size();
+  size_t last = blocks.size();
+  for(size_t i = 0; i < blocks.size(); i++) {
+    if (blocks[i].max_stamp >= from && blocks[i].min_stamp <= to) {
+      if (first == blocks.size()) {
+        first = i;
+      }
+      last = i;
+    }
+  }
+
+  if (first == blocks.size()) {
+    begin = end = 0;
+  } else {
+    begin = blocks[first].offset;
+    end = last + 1 < blocks.size() ? blocks[last + 1].offset : file_size;
+  }
+}
@@ -0,0 +1,146 @@
+/**
+ * YCombinator Logs Timestamp Index.
+ * Sparse sidecar index of a log file, giving the byte offsets and the timestamp bounds of its blocks
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_YINDEX_HPP
+#define RX_YINDEX_HPP
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "yrequest.hpp"
+
+// Default block size of the index, in bytes
+#define HNIDX_DEFAULT_BLOCK_SIZE ((size_t) 256 << 10)
+
+// Sidecar file suffix
+#define HNIDX_SUFFIX ".hnidx"
+
+/**
+ * Sparse timestamp index of a log file.
+ * The file is split into line-aligned blocks, and the true minimum and maximum
+ * timestamps of each block are recorded, so that a range can be located exactly
+ * (whatever the jitter is) without touching the log file itself.
+ *
+ * On-disk format (native byte order):
+ *   header: magic "HNIDX", version, indexed file size and mtime, block size and count
+ *   blocks: { uint64 offset, int64 min_stamp, int64 max_stamp } * count
+ **/
+class TimestampIndex {
+public:
+  /**
+   * Block of records.
+   **/
+  struct Block {
+    // Offset of the first record of the block
+    uint64_t offset;
+
+    // Lowest valid timestamp of the block (INT64_MAX if none)
+    int64_t min_stamp;
+
+    // Highest valid timestamp of the block (0 if none)
+    int64_t max_stamp;
+  };
+
+  /**
+   * Create an empty index.
+   **/
+  TimestampIndex(): file_size(0), mtime_sec(0), mtime_nsec(0), block_size(HNIDX_DEFAULT_BLOCK_SIZE), error(0)
+  {
+  }
+
+  /**
+   * Build the index of a mapped log file.
+   *
+   * @param records The mapped records
+   * @param st The log file status (size and modification time)
+   * @param size The block size, in bytes
+   **/
+  void build(const MappedRecords<WhyRequest> &records, const struct stat &st,
+             size_t size = HNIDX_DEFAULT_BLOCK_SIZE);
+
+  /**
+   * Load an index sidecar.
+   *
+   * @param filename The sidecar path
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool load(const char *filename);
+
+  /**
+   * Save the index to a sidecar (atomically, through a temporary file).
+   *
+   * @param filename The sidecar path
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool save(const char *filename);
+
+  /**
+   * Does the index match the given log file status ?
+   *
+   * @param st The log file status
+   * @return @c true if the index is up-to-date
+   **/
+  bool is_fresh(const struct stat &st) const;
+
+  /**
+   * Locate the exact byte range holding all records within a time range.
+   *
+   * @param from The range start (seconds since Epoch)
+   * @param to The range end (seconds since Epoch)
+   * @param begin The starting offset (a record frontier)
+   * @param end The ending offset, exclusive (a record frontier); equal to @c begin if the range is empty
+   **/
+  void locate(time_t from, time_t to, size_t &begin, size_t &end) const;
+
+  /**
+   * Return the number of blocks.
+   **/
+  size_t get_blocks() const {
+    return blocks.size();
+  }
+
+  /**
+   * Return the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+  /**
+   * Return the sidecar path of a given log file.
+   *
+   * @param filename The log file path
+   * @return The sidecar path
+   **/
+  static std::string sidecar(const char *filename) {
+    return std::string(filename) + HNIDX_SUFFIX;
+  }
+
+protected:
+  // Indexed file size
+  uint64_t file_size;
+
+  // Indexed file modification time
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+
+  // Block size, in bytes
+  uint64_t block_size;
+
+  // Blocks, in file order
+  std::vector<Block> blocks;
+
+  // Last error
+  int error;
+};
+
+#endif
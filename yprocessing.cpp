@@ -11,61 +11,809 @@
 #include <time.h>
 #include <assert.h>
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <limits>
 #include <iostream>
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 
 #include "yprocessing.hpp"
 #include "chrono.hpp"
 
-void YParser::parse_records() {
-  ChronoTimer timer;
+// Minimum size of a chunk scanned by a worker thread
+#define MIN_CHUNK_SIZE ((size_t) 1 << 20)
 
-  // Fetch approximate position if fast-seek is enabled (otherwise, 0)
-  const bool find_position = fast_seek && from > jitter;
-  const RecordLocation<WhyRequest> position = !find_position
-    ? begin()
-    : locate(WhyRequest(from - jitter));
+// Number of queries inserted at once in the hashtable
+#define INSERT_BATCH 32
 
-  const std::string seek = find_position ? timer.tick() : "n/a";
+void YParser::set_threads(unsigned count) {
+  if (count == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cpus > 0 ? static_cast<unsigned>(cpus) : 1;
+  }
+  threads = count;
+}
 
-  // Statistics
-  size_t read = 0;
-  size_t skipped = 0;
-  size_t invalid = 0;
+void YParser::ScanStatistics::merge(const ScanStatistics &other) {
+  read += other.read;
+  skipped += other.skipped;
+  invalid += other.invalid;
+  if (other.max_stamp > max_stamp) {
+    max_stamp = other.max_stamp;
+  }
+  if (other.max_jitter > max_jitter) {
+    max_jitter = other.max_jitter;
+  }
+  stopped = other.stopped;
+}
 
-  // Jitter information
-  time_t max_stamp = 0;
-  time_t max_jitter = 0;
+/**
+ * Add a batch of records to an aggregator; only time-segmented aggregators
+ * need the timestamps, and only maps storing keys need the copier (sketches
+ * only keep hashes).
+ **/
+template<typename Aggregator, typename Copy>
+static inline void aggregate(Aggregator &map, const RefString *keys, const time_t *, size_t count, Copy) {
+  map.add_batch(keys, count);
+}
+
+template<typename Copy>
+static inline void aggregate(RefStringUnorderedHashMap<unsigned> &map, const RefString *keys, const time_t *,
+                             size_t count, Copy copy) {
+  map.add_batch(keys, count, 1, copy);
+}
+
+template<typename Copy>
+static inline void aggregate(SegmentedMap &map, const RefString *keys, const time_t *stamps, size_t count, Copy) {
+  map.add_batch(keys, stamps, count);
+}
+
+/**
+ * Keys copier of mapped queries: the mapping is stable.
+ **/
+struct MappedCopier {
+  const char* operator()(const RefString &key) const {
+    return key.str;
+  }
+};
+
+/**
+ * Keys copier of canonical queries: queries rewritten in the scratch buffer
+ * are copied into the shared arena, others reference the mapping.
+ **/
+struct CanonicalCopier {
+  CanonicalCopier(KeyArena &arena, std::mutex &lock, const Canonicalizer &canonicalizer):
+    arena(arena), lock(lock), canonicalizer(canonicalizer)
+  {
+  }
+
+  const char* operator()(const RefString &key) const {
+    if (!canonicalizer.is_rewritten(key)) {
+      return key.str;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    return arena.copy(key);
+  }
+
+  KeyArena &arena;
+  std::mutex &lock;
+  const Canonicalizer &canonicalizer;
+};
+
+/**
+ * Keys copier of queries whose pages are dropped behind the cursor: all keys
+ * are copied into the shared arena.
+ **/
+struct ArenaCopier {
+  ArenaCopier(KeyArena &arena, std::mutex &lock): arena(arena), lock(lock)
+  {
+  }
+
+  const char* operator()(const RefString &key) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return arena.copy(key);
+  }
+
+  KeyArena &arena;
+  std::mutex &lock;
+};
+
+template<typename Aggregator>
+void YParser::scan_records(const RecordLocation<WhyRequest> &location,
+                           const ScanRange &range,
+                           Aggregator &map,
+                           ScanStatistics &stats) const {
+  if (read_mode != read_mode_map) {
+    // Records are read into recycled buffers: queries are copied into the
+    // scratch buffer, and into the arena when first counted
+    Canonicalizer canonicalizer(canonical | canonical_transient);
+    const ChunkedRecords<WhyRequest> records(filename.c_str(), location.get_offset(), location.get_end(),
+                                             read_mode == read_mode_direct, get_drop_behind());
+    scan_records(records, range, map, stats, CanonicalCopier(*keyArena, keyArenaLock, canonicalizer), &canonicalizer);
+  } else if (get_drop_behind() != 0) {
+    // Mapped pages are dropped behind the cursor: all queries are copied
+    Canonicalizer canonicalizer(canonical);
+    scan_records(location, range, map, stats, ArenaCopier(*keyArena, keyArenaLock),
+                 canonical != 0 ? &canonicalizer : static_cast<Canonicalizer*>(NULL));
+  } else if (canonical == 0) {
+    scan_records(location, range, map, stats, MappedCopier(), static_cast<Canonicalizer*>(NULL));
+  } else {
+    Canonicalizer canonicalizer(canonical);
+    scan_records(location, range, map, stats, CanonicalCopier(*keyArena, keyArenaLock, canonicalizer), &canonicalizer);
+  }
+}
+
+template<typename Aggregator, typename Copy, typename Location>
+void YParser::scan_records(const Location &location,
+                           const ScanRange &range,
+                           Aggregator &map,
+                           ScanStatistics &stats,
+                           Copy copy,
+                           Canonicalizer *canonicalizer) const {
+  // Queries are inserted by batches (see RefStringUnorderedHashMap::add_batch);
+  // canonical queries rewritten in the scratch buffer are valid until the
+  // batch is inserted
+  RefString batch[INSERT_BATCH];
+  time_t stamps[INSERT_BATCH];
+  size_t batch_size = 0;
+
+  // Memory limit of the hashtable, checked after each batch
+  const MemoryAccount *const guard = memory != NULL && memory->get_limit() != 0 && !approx && !approx_distinct
+    ? memory : NULL;
+  const auto flush = [&]() {
+    aggregate(map, batch, stamps, batch_size, copy);
+    batch_size = 0;
+    if (canonicalizer != NULL) {
+      canonicalizer->reset();
+    }
+  };
 
   // Scan all records, until the ending position
-  for(const auto record : position) {
+  for(const auto record : location) {
     const time_t stamp = record.get_timestamp();
     if (!record.is_valid()) {
-      invalid++;
-    } else if (stamp >= from && stamp <= to) {
-      const RefString query = record.get_raw_query();
-      wordMap[query]++;
-      read++;
+      stats.invalid++;
+    } else if (stamp >= range.from && stamp <= range.to) {
+      if (canonicalizer == NULL) {
+        batch[batch_size] = record.get_raw_query();
+      } else {
+        while(!canonicalizer->get(record.get_raw_query(), batch[batch_size])) {
+          flush();
+        }
+      }
+      stamps[batch_size++] = stamp;
+      if (batch_size == INSERT_BATCH) {
+        flush();
+        if (guard != NULL && guard->is_exceeded()) {
+          stats.stopped = true;
+          break;
+        }
+      }
+      stats.read++;
       
       /* Note max jitter, to evaluate if fast mode makes sense */
-      if (stamp > max_stamp) {
-        max_stamp = stamp;
+      if (stamp > stats.max_stamp) {
+        stats.max_stamp = stamp;
       }
-      if (stamp < max_stamp && max_stamp - stamp > max_jitter) {
-        max_jitter = max_stamp - stamp;
+      if (stamp < stats.max_stamp && stats.max_stamp - stamp > stats.max_jitter) {
+        stats.max_jitter = stats.max_stamp - stamp;
       }
       
-    } else if (fast_seek && stamp > to && stamp - to > jitter) {
+    } else if (fast_seek && !range.exact && stamp > range.to && stamp - range.to > jitter) {
       // Stop if reached ending (letting a jitter margin)
+      stats.stopped = true;
       break;
     } else {
-      skipped++;
+      stats.skipped++;
     }
   }
 
+  flush();
+}
+
+/**
+ * Create the empty aggregators of the chunks of a scan: copies of the empty
+ * result.
+ **/
+template<typename Aggregator>
+static void split_aggregator(Aggregator &result, size_t chunks, std::vector<Aggregator> &aggregators) {
+  aggregators.assign(chunks, result);
+}
+
+/**
+ * Heavy hitters estimators reserve their whole budget: each chunk gets its
+ * share, and the empty result is released until the chunks are merged.
+ **/
+static void split_aggregator(HeavyHitters &result, size_t chunks, std::vector<HeavyHitters> &aggregators) {
+  aggregators.assign(chunks, result.share(chunks));
+  HeavyHitters released;
+  result.swap(released);
+}
+
+template<typename Aggregator>
+size_t YParser::scan_chunks(const RecordLocation<WhyRequest> &position,
+                            const ScanRange &range,
+                            Aggregator &result,
+                            ScanStatistics &stats) const {
+  // Split the location in line-aligned chunks, one per thread
+  const std::vector<RecordLocation<WhyRequest>> chunks = threads > 1
+    ? split(position, threads, MIN_CHUNK_SIZE)
+    : std::vector<RecordLocation<WhyRequest>>();
+
+  if (chunks.size() <= 1) {
+    scan_records(position, range, result, stats);
+    return 1;
+  }
+
+  // Each worker fills its own aggregator
+  std::vector<Aggregator> aggregators;
+  split_aggregator(result, chunks.size(), aggregators);
+  std::vector<ScanStatistics> chunk_stats(chunks.size());
+  std::vector<std::thread> workers;
+  for(size_t i = 0; i < chunks.size(); i++) {
+    workers.push_back(std::thread([this, &chunks, &range, &aggregators, &chunk_stats, i]() {
+          scan_records(chunks[i], range, aggregators[i], chunk_stats[i]);
+        }));
+  }
+  for(auto &worker : workers) {
+    worker.join();
+  }
+
+  // Merge chunks in file order; a chunk which stopped the scan (fast-seek
+  // ending) hides the following ones, as a sequential scan would do
+  if (metrics != NULL) {
+    metrics->phase("merge");
+  }
+  result.swap(aggregators[0]);
+  stats = chunk_stats[0];
+  for(size_t i = 1; i < chunks.size() && !stats.stopped; i++) {
+    result.merge(aggregators[i]);
+    stats.merge(chunk_stats[i]);
+  }
+
+  return chunks.size();
+}
+
+RecordLocation<WhyRequest> YParser::locate_range(ScanRange &range, bool &seeked) const {
+  // Exact position from the index sidecar if any, or approximate position
+  // if fast-seek is enabled (otherwise, 0)
+  range.exact = index_loaded
+    && (range.from != 0 || range.to != std::numeric_limits<time_t>::max());
+  seeked = !range.exact && fast_seek && range.from > jitter;
+  if (range.exact) {
+    size_t index_begin;
+    size_t index_end;
+    timestampIndex.locate(range.from, range.to, index_begin, index_end);
+    return RecordLocation<WhyRequest>(*this, index_begin, index_end);
+  } else if (seeked) {
+    return locate(WhyRequest(range.from - jitter));
+  } else {
+    return begin();
+  }
+}
+
+size_t YParser::scan_range(time_t from, time_t to, RefStringUnorderedHashMap<unsigned> &map) const {
+  ScanRange range = { from, to, false };
+  bool seeked;
+  const RecordLocation<WhyRequest> position = locate_range(range, seeked);
+  ScanStatistics stats;
+  scan_records(position, range, map, stats);
+  return stats.read;
+}
+
+template<typename Aggregator>
+void YParser::scan_span(time_t span_from, time_t span_to, const Aggregator &empty, Aggregator &result, ScanStatistics &stats) const {
+  ScanRange range = { span_from, span_to, false };
+  bool seeked;
+  const RecordLocation<WhyRequest> position = locate_range(range, seeked);
+  Aggregator aggregator(empty);
+  ScanStatistics span_stats;
+  scan_chunks(position, range, aggregator, span_stats);
+  result.merge(aggregator);
+  span_stats.stopped = false;
+  stats.merge(span_stats);
+}
+
+void YParser::parse_rollup(time_t covered_from, time_t covered_to) {
+  ChronoTimer timer;
+  if (metrics != NULL) {
+    metrics->phase("rollup");
+  }
+
+  // Whole buckets
+  size_t records;
+  if (approx_distinct) {
+    records = rollup.add_sketches(covered_from, covered_to, distinctSketch);
+  } else {
+    records = rollup.add_counts(covered_from, covered_to, wordMap);
+  }
+  const std::string combine = timer.tick();
+
+  // Edges
+  ScanStatistics stats;
+  if (from < covered_from || covered_to < to) {
+    const HyperLogLog emptySketch(distinctSketch.get_precision());
+    const RefStringUnorderedHashMap<unsigned> emptyMap(memory);
+    if (from < covered_from) {
+      if (metrics != NULL) {
+        metrics->phase("scan");
+      }
+      if (approx_distinct) {
+        scan_span(from, covered_from - 1, emptySketch, distinctSketch, stats);
+      } else {
+        scan_span(from, covered_from - 1, emptyMap, wordMap, stats);
+      }
+    }
+    if (covered_to < to) {
+      if (metrics != NULL) {
+        metrics->phase("scan");
+      }
+      if (approx_distinct) {
+        scan_span(covered_to + 1, to, emptySketch, distinctSketch, stats);
+      } else {
+        scan_span(covered_to + 1, to, emptyMap, wordMap, stats);
+      }
+    }
+  }
   const std::string scan = timer.tick();
 
-  std::cerr << read << " records read in " << scan << " (seek: " << seek << ")" << ", " << skipped << " records skipped, " << invalid << " records invalid, jitter=" << max_jitter << "\n";
+  if (metrics != NULL) {
+    metrics->end();
+    metrics->set("rollup_records", records);
+    add_scan_metrics(stats, 1);
+    return;
+  }
+  std::cerr << stats.read << " records read in " << scan << " (rollup: " << records << " records in " << combine << ")"
+            << ", " << stats.skipped << " records skipped, " << stats.invalid << " records invalid\n";
+}
+
+void YParser::add_scan_metrics(const ScanStatistics &stats, size_t chunks) const {
+  const uint64_t ns = metrics->get_phase_ns("scan") + metrics->get_phase_ns("merge");
+  metrics->set("records", stats.read);
+  metrics->set("records_per_s", ns != 0 ? stats.read / (ns / 1e9) : 0);
+  metrics->set("skipped", stats.skipped);
+  metrics->set("invalid", stats.invalid);
+  metrics->set("max_jitter", stats.max_jitter);
+  metrics->set("threads", chunks);
+}
+
+bool YParser::degrade() {
+  if (!is_memory_exceeded() || fallback == memory_fallback_fail) {
+    return false;
+  }
+  if (metrics == NULL) {
+    std::cerr << "memory limit of " << (memory->get_limit() >> 10) << "K exceeded after " << wordMap.size()
+              << " distinct queries, counting approximately\n";
+  }
+  wordMap.clear();
+  if (fallback == memory_fallback_top) {
+    set_approx(memory->get_limit(), false);
+  } else {
+    set_approx_distinct(HLL_DEFAULT_PRECISION);
+  }
+  degraded = true;
+  return true;
+}
+
+void YParser::add_table_metrics() const {
+  if (memory != NULL) {
+    metrics->set("memory_bytes", memory->get_bytes());
+    metrics->set("memory_peak", memory->get_peak());
+    metrics->set("memory_blocks", memory->get_blocks());
+    metrics->set("memory_allocations", memory->get_allocations());
+    if (memory->get_limit() != 0) {
+      metrics->set("memory_limit", memory->get_limit());
+      metrics->set("memory_degraded", degraded);
+    }
+  }
+  if (keyArena) {
+    metrics->set("key_arena_bytes", keyArena->get_size());
+  }
+  if (approx) {
+    metrics->set("approx_counters", heavyHitters.get_capacity());
+  } else if (approx_distinct) {
+    metrics->set("approx_precision", distinctSketch.get_precision());
+  } else {
+    std::vector<size_t> histogram;
+    wordMap.get_probe_histogram(histogram);
+    metrics->set("table_size", wordMap.size());
+    metrics->set("table_buckets", wordMap.bucket_count());
+    metrics->set("table_load", wordMap.bucket_count() != 0 ? static_cast<double>(wordMap.size()) / wordMap.bucket_count() : 0);
+    metrics->set("table_bytes", wordMap.get_memory());
+    metrics->set("table_bytes_per_query", wordMap.size() != 0 ? static_cast<double>(wordMap.get_memory()) / wordMap.size() : 0);
+    metrics->set("table_fragmentation", wordMap.get_memory() != 0
+                 ? 1 - static_cast<double>(wordMap.get_used_memory()) / wordMap.get_memory() : 0);
+    metrics->set_histogram("table_probe_histogram", histogram);
+  }
+}
+
+bool YParser::load_rollup() {
+  const std::string sidecar = Rollup::sidecar(filename.c_str());
+  struct stat st;
+  if (!use_rollup || !get_stat(st)) {
+    return false;
+  } else if (rollup.is_loaded()) {
+    return true;
+  } else if (!rollup.load(sidecar.c_str()) && rollup.get_error() != EINVAL) {
+    return false;
+  }
+
+  // Stale or invalid sidecar: rebuild it, with the same settings
+  if (!rollup.is_fresh(st)) {
+    std::cerr << "rebuilding " << (rollup.is_loaded() ? "stale" : "invalid") << " rollup " << sidecar << "\n";
+    if (!build_rollup(rollup.get_bucket_size(), rollup.get_precision())) {
+      std::cerr << "could not write rollup: " << strerror(rollup.get_error()) << "\n";
+      rollup.unload();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool YParser::build_rollup(time_t bucket_size, unsigned precision) {
+  struct stat st;
+  if (!get_stat(st)) {
+    return false;
+  }
+  return rollup.build(*this, st, Rollup::sidecar(filename.c_str()).c_str(), bucket_size, precision);
+}
+
+void YParser::parse_records() {
+  ChronoTimer timer;
+  if (metrics != NULL) {
+    metrics->phase("locate");
+  }
+
+  // Load the index sidecar, only needed to locate a range
+  if (!index_loaded && (from != 0 || to != std::numeric_limits<time_t>::max())) {
+    load_index();
+  }
+
+  // Answer whole buckets using the rollup sidecar, if any (but not approximate top queries)
+  time_t covered_from;
+  time_t covered_to;
+  if (!approx
+      && load_rollup()
+      && rollup.cover(from, to, covered_from, covered_to)
+      && (!approx_distinct || rollup.get_precision() == distinctSketch.get_precision())) {
+    parse_rollup(covered_from, covered_to);
+    if (degrade()) {
+      parse_records();
+    }
+    return;
+  }
+
+  ScanRange range = { from, to, false };
+  bool seeked;
+  const RecordLocation<WhyRequest> located = locate_range(range, seeked);
+
+  // In follow mode, stop at the last complete line, to be resumed by refresh()
+  const RecordLocation<WhyRequest> position = follow
+    ? RecordLocation<WhyRequest>(*this, located.get_offset(), get_complete_end(located.get_offset()))
+    : located;
+  parsed = position.get_end();
+
+  const std::string seek = range.exact ? timer.tick() + " indexed"
+    : seeked ? timer.tick() : "n/a";
+
+  // Statistics
+  ScanStatistics stats;
+  if (metrics != NULL) {
+    metrics->phase("scan");
+  }
+
+  // Scan (and merge) chunks
+  if (approx) {
+    HeavyHitters summary(approx_memory, approx_count_min);
+    heavyHitters.swap(summary);
+  }
+  counted = true;
+  const size_t chunks = approx
+    ? scan_chunks(position, range, heavyHitters, stats)
+    : approx_distinct
+    ? scan_chunks(position, range, distinctSketch, stats)
+    : scan_chunks(position, range, wordMap, stats);
+
+  const std::string scan = timer.tick();
+
+  // Memory limit exceeded: parse again, approximately, if allowed
+  if (degrade()) {
+    parse_records();
+    return;
+  }
+
+  // Structured statistics, instead of the statistics line
+  if (metrics != NULL) {
+    metrics->end();
+    metrics->set("bytes", position.get_end() - position.get_offset());
+    metrics->set("seeked", seeked || range.exact);
+    add_scan_metrics(stats, chunks);
+    return;
+  }
+
+  // Single write, as several files may be parsed concurrently
+  std::ostringstream message;
+  message << stats.read << " records read in " << scan << " (seek: " << seek << ")" << ", " << stats.skipped << " records skipped, " << stats.invalid << " records invalid, jitter=" << stats.max_jitter;
+  if (chunks > 1) {
+    message << ", threads=" << chunks;
+  }
+  if (approx) {
+    message << ", approx counters=" << heavyHitters.get_capacity();
+  }
+  if (approx_distinct) {
+    message << ", approx precision=" << distinctSketch.get_precision();
+  }
+  if (read_mode != read_mode_map) {
+    message << ", read=" << ChunkedReader::get_read_mode_name(read_mode);
+  }
+  if (get_drop_behind() != 0) {
+    message << ", drop=" << (get_drop_behind() >> 10) << "K, peak rss=" << (Metrics::get_peak_rss() >> 10) << "K";
+  }
+  if (memory != NULL && memory->get_limit() != 0) {
+    message << ", memory=" << (memory->get_peak() >> 10) << "K/" << (memory->get_limit() >> 10) << "K";
+  }
+  message << "\n";
+  std::cerr << message.str();
+}
+
+bool YParser::get_span(time_t &first, time_t &last) const {
+  // First valid record
+  bool found = false;
+  for(const auto &record : begin()) {
+    if (record.is_valid()) {
+      first = record.get_timestamp();
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  // Last valid record, reading lines backward
+  for(size_t offset = size; offset != 0; ) {
+    const size_t start = begin(offset - 1);
+    size_t position = start;
+    WhyRequest record;
+    get_record(record, position);
+    if (record.is_valid()) {
+      last = record.get_timestamp();
+      return true;
+    }
+    offset = start;
+  }
+  return false;
+}
+
+bool YParser::overlaps_range() const {
+  time_t first;
+  time_t last;
+  return !get_span(first, last)
+    || !((last < from && from - last > jitter) || (first > to && first - to > jitter));
+}
+
+void YParser::merge(YParser &other) {
+  // Results without counts (a skipped file) are replaced
+  if (!counted) {
+    heavyHitters.swap(other.heavyHitters);
+    distinctSketch.swap(other.distinctSketch);
+    wordMap.swap(other.wordMap);
+    counted = true;
+  } else if (approx) {
+    heavyHitters.merge(other.heavyHitters);
+  } else if (approx_distinct) {
+    distinctSketch.merge(other.distinctSketch);
+  } else {
+    wordMap.merge(other.wordMap);
+  }
+
+  // Release the other results
+  HeavyHitters released;
+  other.heavyHitters.swap(released);
+  other.wordMap.clear();
+  other.counted = false;
+}
+
+size_t YParser::parse_files(const std::vector<YParser*> &parsers, unsigned workers) {
+  assert(!parsers.empty());
+
+  // Skip files entirely outside their range
+  std::vector<YParser*> selected;
+  for(YParser *const parser : parsers) {
+    if (parser->overlaps_range()) {
+      selected.push_back(parser);
+    } else {
+      std::cerr << "skipping " << parser->filename << ": outside of range\n";
+    }
+  }
+
+  // Each worker parses the next pending file, as long as at most one file
+  // per worker is parsed or waiting to be merged; the first parser holds the
+  // merged results
+  if (workers == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? static_cast<unsigned>(cpus) : 1;
+  }
+  const size_t count = std::min<size_t>(workers, selected.size());
+  for(YParser *const parser : parsers) {
+    parser->approx_memory /= count + 1;
+  }
+  std::mutex lock;
+  std::condition_variable merged_cond;
+  std::vector<bool> done(selected.size(), false);
+  size_t next = 0;
+  size_t merged = 0;
+  std::vector<std::thread> pool;
+  for(size_t i = 0; i < count; i++) {
+    pool.push_back(std::thread([&]() {
+          for(;;) {
+            size_t j;
+            {
+              std::unique_lock<std::mutex> guard(lock);
+              merged_cond.wait(guard, [&]() {
+                  return next == selected.size() || next < merged + count;
+                });
+              if (next == selected.size()) {
+                break;
+              }
+              j = next++;
+            }
+            selected[j]->parse_records();
+
+            // Merge the parsed files, in order
+            std::unique_lock<std::mutex> guard(lock);
+            done[j] = true;
+            for(; merged < selected.size() && done[merged]; merged++) {
+              if (selected[merged] != parsers[0]) {
+                parsers[0]->merge(*selected[merged]);
+              }
+            }
+            merged_cond.notify_all();
+          }
+        }));
+  }
+  for(auto &worker : pool) {
+    worker.join();
+  }
+
+  return parsers.size() - selected.size();
+}
+
+size_t YParser::get_complete_end(size_t offset) const {
+  assert(offset <= size);
+  const void *const newline = memrchr(data + offset, '\n', size - offset);
+  return newline != NULL ? reinterpret_cast<const unsigned char*>(newline) - data + 1 : offset;
+}
+
+size_t YParser::parse_appended() {
+  const size_t end = get_complete_end(parsed);
+  if (end == parsed) {
+    return 0;
+  }
+
+  // Appended lines are counted as is: there is nothing to seek
+  const ScanRange range = { from, to, true };
+  const RecordLocation<WhyRequest> location(*this, parsed, end);
+  ScanStatistics stats;
+  if (approx) {
+    scan_records(location, range, heavyHitters, stats);
+  } else if (approx_distinct) {
+    scan_records(location, range, distinctSketch, stats);
+  } else {
+    scan_records(location, range, wordMap, stats);
+  }
+  parsed = end;
+  return stats.read;
+}
+
+size_t YParser::refresh() {
+  assert(follow);
+
+  // Lines appended to the current file
+  grow();
+  size_t records = parse_appended();
+
+  // Rotated file: follow the new one, once not empty (the previous regions
+  // remain mapped, as the aggregators reference them)
+  if (is_replaced(filename.c_str()) && reopen(filename.c_str())) {
+    std::cerr << "following rotated file " << filename << "\n";
+    parsed = 0;
+    records += parse_appended();
+  }
+
+  return records;
+}
+
+void YParser::parse_batch(const std::vector<YQuery> &queries, std::vector<YQueryResult> &results) {
+  assert(!queries.empty());
+  ChronoTimer timer;
+
+  // The union span of all ranges
+  ScanRange range = { std::numeric_limits<time_t>::max(), 0, false };
+  for(const YQuery &query : queries) {
+    range.from = std::min(range.from, query.from);
+    range.to = std::max(range.to, query.to);
+  }
+
+  if (!index_loaded) {
+    load_index();
+  }
+  bool seeked;
+  const RecordLocation<WhyRequest> position = locate_range(range, seeked);
+
+  // Scan once, counting each record in its time segment
+  SegmentedMap segments(queries);
+  ScanStatistics stats;
+  const size_t chunks = scan_chunks(position, range, segments, stats);
+  const std::string scan = timer.tick();
+
+  // Each range is the union of its segments
+  results.clear();
+  results.resize(queries.size());
+  for(size_t i = 0; i < queries.size(); i++) {
+    const YQuery &query = queries[i];
+    RefStringUnorderedHashMap<unsigned> merged;
+    const RefStringUnorderedHashMap<unsigned> &map = segments.get_range(query.from, query.to, merged);
+    results[i].distinct = map.size();
+    if (query.top) {
+      results[i].top = get_top_queries(map, query.count);
+    }
+  }
+
+  std::cerr << queries.size() << " queries, " << segments.get_segments() << " segments, "
+            << stats.read << " records read in " << scan << " (merge: " << timer.tick() << ")"
+            << ", " << stats.skipped << " records skipped, " << stats.invalid << " records invalid";
+  if (chunks > 1) {
+    std::cerr << ", threads=" << chunks;
+  }
+  std::cerr << "\n";
+}
+
+bool YParser::build_index(TimestampIndex &index) const {
+  struct stat st;
+  if (!get_stat(st)) {
+    return false;
+  }
+  index.build(*this, st);
+  return index.save(TimestampIndex::sidecar(filename.c_str()).c_str());
+}
+
+bool YParser::load_index() {
+  const std::string sidecar = TimestampIndex::sidecar(filename.c_str());
+  struct stat st;
+  if (!use_index || !get_stat(st)) {
+    return false;
+  }
+  const bool loaded = timestampIndex.load(sidecar.c_str());
+  if (!loaded && timestampIndex.get_error() != EINVAL) {
+    return false;
+  }
+
+  // Stale or invalid sidecar: rebuild it
+  if (!loaded || !timestampIndex.is_fresh(st)) {
+    std::cerr << "rebuilding " << (loaded ? "stale" : "invalid") << " index " << sidecar << "\n";
+    if (!build_index(timestampIndex)) {
+      std::cerr << "could not write index: " << strerror(timestampIndex.get_error()) << "\n";
+    }
+  }
+
+  index_loaded = true;
+  return true;
+}
+
+void YParser::get_approx_top_queries(size_t top_queries, std::vector<HeavyHitters::Entry> &list) const {
+  heavyHitters.get_top(top_queries, list);
+}
+
+uint64_t YParser::get_approx_distinct_queries(double &standard_error) const {
+  standard_error = distinctSketch.get_standard_error();
+  return distinctSketch.estimate();
 }
 
 size_t YParser::get_distinct_queries() const {
@@ -73,15 +821,21 @@ size_t YParser::get_distinct_queries() const {
 }
 
 std::vector<std::pair<RefString, unsigned>> YParser::get_top_queries(size_t top_queries) const {
-  // Insert maximums into a min-priority queue
-  RefStringPriorityQueue min_heap;
-  for (const auto element : wordMap) {
+  return get_top_queries(wordMap, top_queries);
+}
+
+std::vector<std::pair<RefString, unsigned>> YParser::get_top_queries(const RefStringUnorderedHashMap<unsigned> &map, size_t top_queries) {
+  // Insert maximums into a min-priority queue, allocated once, and accounted with the map
+  RefStringPriorityVector heap(AccountingAllocator<RefStringPriorityPair>(map.get_account()));
+  heap.reserve(std::min(top_queries, map.size()));
+  RefStringPriorityQueue min_heap(RefStringPriorityPairCompare(), std::move(heap));
+  for (const auto element : map) {
     // Not enough elements yet: add element
     if (min_heap.size() < top_queries) {
       min_heap.push(element);
     }
     // New maximum: remove minimum and add element
-    else if (element.second >= min_heap.top().second) {
+    else if (RefStringPriorityPairCompare()(element, min_heap.top())) {
       min_heap.pop();
       min_heap.push(element);
     }
@@ -99,7 +853,6 @@ std::vector<std::pair<RefString, unsigned>> YParser::get_top_queries(size_t top_
   for(auto it = list.rbegin(); it != list.rend(); ++it) {
     const auto element = *it;
     ordered_list.push_back(element);
-    min_heap.pop();
   }
 
   return ordered_list;
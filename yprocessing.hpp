@@ -16,9 +16,37 @@
 
 #include <limits>
 #include <iostream>
+#include <memory>
+#include <mutex>
 
 #include "yrequest.hpp"
+#include "yindex.hpp"
 #include "refstringmap.hpp"
+#include "heavyhitters.hpp"
+#include "hyperloglog.hpp"
+#include "ybatch.hpp"
+#include "yrollup.hpp"
+#include "ycompiled.hpp"
+#include "keyarena.hpp"
+#include "canonical.hpp"
+#include "metrics.hpp"
+#include "memaccount.hpp"
+#include "chunkreader.hpp"
+
+/**
+ * What to do once the memory limit of the aggregation structures is exceeded
+ * (see @c YParser::set_memory_account).
+ **/
+enum memory_fallback {
+  // Stop the scan, the results being invalid
+  memory_fallback_fail,
+
+  // Rescan, counting approximate top queries within the limit
+  memory_fallback_top,
+
+  // Rescan, counting approximate distinct queries
+  memory_fallback_distinct,
+};
 
 /**
  * Specialization of mapped records parser to extract hacker news logs stats
@@ -32,11 +60,35 @@ public:
    **/
   YParser(const char* filename):
     MappedRecords<WhyRequest>(filename),
+    filename(filename),
     wordMap(),
+    heavyHitters(),
+    distinctSketch(),
     from(0),
     to(std::numeric_limits<time_t>::max()),
     fast_seek(true),
-    jitter(900)
+    jitter(900),
+    threads(1),
+    use_index(true),
+    timestampIndex(),
+    index_loaded(false),
+    rollup(),
+    use_rollup(true),
+    approx(false),
+    approx_memory(0),
+    approx_count_min(false),
+    approx_distinct(false),
+    follow(false),
+    parsed(0),
+    canonical(0),
+    read_mode(read_mode_map),
+    keyArena(),
+    keyArenaLock(),
+    metrics(NULL),
+    memory(NULL),
+    fallback(memory_fallback_fail),
+    degraded(false),
+    counted(false)
   {
   }
 
@@ -68,6 +120,261 @@ public:
     jitter = jitter_s;
   }
 
+  /**
+   * Set the number of threads used to scan records.
+   * The located range is split into line-aligned chunks, each one scanned by
+   * a worker into its own hashtable, and then merged.
+   *
+   * @param count The number of threads (0 means one per online CPU)
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_threads(unsigned count);
+
+  /**
+   * Enable bounded-memory approximate top queries (see @c HeavyHitters):
+   * queries are counted in a Space-Saving summary rather than in the
+   * hashtable, and only @c get_approx_top_queries is meaningful. The
+   * summary is allocated when parsing starts.
+   *
+   * @param memory The memory budget, in bytes
+   * @param count_min If @c true, use half of the budget for a Count-Min sketch tightening upper bounds
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_approx(size_t memory, bool count_min) {
+    approx = true;
+    approx_memory = memory;
+    approx_count_min = count_min;
+  }
+
+  /**
+   * Enable approximate distinct queries counting (see @c HyperLogLog):
+   * query hashes are added to a sketch rather than queries to the hashtable,
+   * and only @c get_approx_distinct_queries is meaningful.
+   *
+   * @param precision The sketch precision (HLL_MIN_PRECISION to HLL_MAX_PRECISION)
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_approx_distinct(unsigned precision) {
+    approx_distinct = true;
+    distinctSketch = HyperLogLog(precision);
+  }
+
+  /**
+   * Enable or disable the use of the timestamp index sidecar (see @c TimestampIndex)
+   * to locate the range. A stale sidecar is rebuilt.
+   *
+   * @param enabled If @c true, use the sidecar if it exists
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_index(bool enabled) {
+    use_index = enabled;
+  }
+
+  /**
+   * Load the timestamp index sidecar of the file, if enabled and present,
+   * rebuilding it if stale. Subsequent range lookups use the loaded index.
+   *
+   * @return @c true if the index was loaded
+   **/
+  bool load_index();
+
+  /**
+   * Enable or disable the use of the rollup sidecar (see @c Rollup) to
+   * answer the whole buckets of a range. A stale sidecar is rebuilt.
+   *
+   * @param enabled If @c true, use the sidecar if it exists
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_rollup(bool enabled) {
+    use_rollup = enabled;
+  }
+
+  /**
+   * Enable follow mode: the file is expected to grow (see @c refresh), and
+   * only complete lines are parsed. Sidecars are not used.
+   *
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_follow() {
+    follow = true;
+    use_index = false;
+    use_rollup = false;
+  }
+
+  /**
+   * Set the mapping policy of the file (see @c map_policy).
+   *
+   * @param policy The policy
+   * @param window The read-ahead window of the willneed and prefetch policies
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   * @comment This function can only be called before @c parse_records
+   **/
+  bool set_map_policy(enum map_policy policy, size_t window) {
+    return set_policy(policy, window);
+  }
+
+  /**
+   * Aggregate the canonical form of queries (see @c canonicalize); rewritten
+   * queries are copied into a key arena when first counted. The rollup
+   * sidecar, holding raw queries, is not used.
+   *
+   * @param flags The canonicalization flags (see @c canonical_flags)
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_canonical(unsigned flags) {
+    canonical = flags;
+    if (flags != 0) {
+      use_rollup = false;
+      if (!keyArena) {
+        keyArena.reset(new KeyArena());
+      }
+    }
+  }
+
+  /**
+   * Set how the scanned records are read (see @c read_mode): from the
+   * mapping, or with large reads into a ring of buffers, so that the memory
+   * footprint is bounded; counted queries are then copied into a key arena.
+   * The mapping is still used to locate ranges.
+   *
+   * @param mode The read mode
+   * @return @c true upon success; otherwise (O_DIRECT not supported), errno
+   *         is set, and pread is used
+   * @comment This function can only be called before @c parse_records
+   **/
+  bool set_read_mode(enum read_mode mode) {
+    read_mode = mode;
+    if (mode == read_mode_map) {
+      return true;
+    }
+    if (!keyArena) {
+      keyArena.reset(new KeyArena());
+    }
+    if (mode == read_mode_direct && !ChunkedReader::is_direct_supported(filename.c_str())) {
+      read_mode = read_mode_pread;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Set the drop-behind window of scans (see @c ReadOnlyMemoryMap::set_drop_behind);
+   * counted queries are then copied into a key arena, so that dropped pages
+   * are not faulted in again by lookups.
+   *
+   * @param drop The drop-behind window (0: disabled)
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_drop_behind(size_t drop) {
+    MappedRecords<WhyRequest>::set_drop_behind(drop);
+    if (drop != 0 && !keyArena) {
+      keyArena.reset(new KeyArena());
+    }
+  }
+
+  /**
+   * Collect the metrics of @c parse_records phases (locate, rollup, scan,
+   * merge) and of the scan, instead of printing a statistics line.
+   *
+   * @param target The metrics, or @c NULL
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_metrics(Metrics *target) {
+    metrics = target;
+  }
+
+  /**
+   * Add the aggregation structure metrics (hashtable size, buckets and probe
+   * lengths, or approximate structure size) to the metrics.
+   *
+   * @comment This function can only be called after @c parse_records, with metrics set
+   **/
+  void add_table_metrics() const;
+
+  /**
+   * Account the memory of the aggregation structures (the queries hashtable,
+   * and the top queries heap); the account may be shared by several parsers.
+   * If its limit is exceeded, the scan stops, and either fails (see
+   * @c is_memory_exceeded), or is done again with approximate counting.
+   *
+   * @param account The memory account, or @c NULL
+   * @param on_limit What to do once the account limit is exceeded
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_memory_account(MemoryAccount *account, enum memory_fallback on_limit = memory_fallback_fail) {
+    memory = account;
+    fallback = on_limit;
+    wordMap = RefStringUnorderedHashMap<unsigned>(account);
+  }
+
+  /**
+   * Was the memory limit exceeded by exact counting, the results being invalid ?
+   **/
+  bool is_memory_exceeded() const {
+    return memory != NULL && memory->is_exceeded() && !approx && !approx_distinct;
+  }
+
+  /**
+   * Did counting fall back to approximate counting (see @c set_memory_account) ?
+   * Only @c get_approx_top_queries or @c get_approx_distinct_queries are then meaningful.
+   **/
+  bool is_degraded() const {
+    return degraded;
+  }
+
+  /**
+   * Parse the complete lines appended since the last parse (follow mode),
+   * into the existing aggregators; the mapping is extended as needed. If the
+   * file was rotated, the remaining lines of the previous file are parsed,
+   * and the new file is followed from its beginning.
+   *
+   * @return The number of records read
+   * @comment This function can only be called after @c parse_records
+   **/
+  size_t refresh();
+
+  /**
+   * Build (or rebuild) the rollup sidecar of the file.
+   *
+   * @param bucket_size The bucket size, in seconds
+   * @param precision The HyperLogLog sketches precision
+   * @return @c true upon success; the error is available through @c get_rollup_error() otherwise
+   **/
+  bool build_rollup(time_t bucket_size, unsigned precision);
+
+  /**
+   * Get the last rollup sidecar error.
+   **/
+  int get_rollup_error() const {
+    return rollup.get_error();
+  }
+
+  /**
+   * Return the number of buckets of the rollup sidecar, if loaded.
+   **/
+  size_t get_rollup_buckets() const {
+    return rollup.get_buckets();
+  }
+
+  /**
+   * Write the compiled form of the file (see @c CompiledLog).
+   *
+   * @param compiled The compiled log to be filled
+   * @param output The compiled file path
+   * @return @c true upon success; the error is available through @c compiled.get_error() otherwise
+   **/
+  bool compile(CompiledLog &compiled, const char *output) const {
+    return compiled.build(*this, output);
+  }
+
+  /**
+   * Build (or rebuild) the timestamp index sidecar of the file.
+   *
+   * @param index The index to be filled
+   * @return @c true upon success; the error is available through @c index.get_error() otherwise
+   **/
+  bool build_index(TimestampIndex &index) const;
+
   /**
    * Set the range start
    *
@@ -94,6 +401,61 @@ public:
    **/
   void parse_records();
 
+  /**
+   * Parse the records of several files concurrently, each one with its own
+   * parser (configured alike), and merge their results into the first
+   * parser, in files order, as soon as they are parsed. Files whose
+   * timestamp span is entirely outside the range are skipped. The memory
+   * budget of approximate top queries is shared by the files parsed, or
+   * waiting to be merged, at once, and by the merged results.
+   *
+   * @param parsers The parsers, one per file (at least one)
+   * @param workers The maximum number of files parsed at once (0 means one per online CPU)
+   * @return The number of skipped files
+   **/
+  static size_t parse_files(const std::vector<YParser*> &parsers, unsigned workers);
+
+  /**
+   * Get the timestamps of the first and last valid records of the file.
+   *
+   * @param first The first timestamp
+   * @param last The last timestamp
+   * @return @c true if the file holds at least one valid record
+   **/
+  bool get_span(time_t &first, time_t &last) const;
+
+  /**
+   * Answer a batch of queries in a single scan of the union of their ranges:
+   * each record is counted once, in its time segment (see @c SegmentedMap),
+   * and the results of a range are merged from its segments.
+   * The @c set_start and @c set_end ranges are ignored.
+   *
+   * @param queries The queries (at least one)
+   * @param results The results, one per query
+   **/
+  void parse_batch(const std::vector<YQuery> &queries, std::vector<YQueryResult> &results);
+
+  /**
+   * Count the queries of a range into a map, independently of the range and
+   * aggregators of @c parse_records. The scan is single-threaded; this
+   * function may be called concurrently.
+   *
+   * @param from The start range (seconds since Epoch)
+   * @param to The ending range (seconds since Epoch)
+   * @param map The map to be filled
+   * @return The number of records read
+   **/
+  size_t scan_range(time_t from, time_t to, RefStringUnorderedHashMap<unsigned> &map) const;
+
+  /**
+   * Get the top queries of a map.
+   *
+   * @param map The map filled by @c scan_range
+   * @param top_queries The maximum number of top queries to retreive
+   * @return The list of top queries, sorted in descending order
+   **/
+  static std::vector<std::pair<RefString, unsigned>> get_top_queries(const RefStringUnorderedHashMap<unsigned> &map, size_t top_queries);
+
   /**
    * Get the number of distinct queries.
    *
@@ -101,6 +463,15 @@ public:
    **/
   size_t get_distinct_queries() const;
 
+  /**
+   * Get the approximate number of distinct queries (see @c set_approx_distinct).
+   *
+   * @param standard_error The relative standard error of the estimate
+   * @return The estimated number of distinct queries
+   * @comment This function can only be called after @c parse_records
+   **/
+  uint64_t get_approx_distinct_queries(double &standard_error) const;
+
   /**
    * Get the top queries.
    *
@@ -110,11 +481,207 @@ public:
    **/
   std::vector<std::pair<RefString, unsigned>> get_top_queries(size_t top_queries = 10) const;
 
+  /**
+   * Get the approximate top queries, with their error bounds (see @c set_approx).
+   *
+   * @param top_queries The maximum number of top queries to retreive
+   * @param list The list of top queries to be filled, sorted in descending order
+   * @comment This function can only be called after @c parse_records
+   **/
+  void get_approx_top_queries(size_t top_queries, std::vector<HeavyHitters::Entry> &list) const;
+
 protected:
+  /**
+   * A range to be scanned.
+   **/
+  struct ScanRange {
+    // Start timestamp
+    time_t from;
+
+    // End timestamp
+    time_t to;
+
+    // The located range is exact (no jitter margin needed to stop)
+    bool exact;
+  };
+
+  /**
+   * Scan statistics, gathered per chunk.
+   **/
+  struct ScanStatistics {
+    ScanStatistics(): read(0), skipped(0), invalid(0), max_stamp(0), max_jitter(0), stopped(false)
+    {
+    }
+
+    /**
+     * Merge statistics of a following chunk.
+     **/
+    void merge(const ScanStatistics &other);
+
+    // Number of records read
+    size_t read;
+
+    // Number of records outside the range
+    size_t skipped;
+
+    // Number of invalid records
+    size_t invalid;
+
+    // Highest timestamp seen
+    time_t max_stamp;
+
+    // Highest jitter seen
+    time_t max_jitter;
+
+    // Did the scan stop before the end of the location (fast-seek) ?
+    bool stopped;
+  };
+
+  /**
+   * Scan the records of a location, counting queries within range.
+   *
+   * @param location The location to be scanned
+   * @param range The range of timestamps to be counted
+   * @param map The aggregator to be filled (implementing add_batch())
+   * @param stats The statistics to be filled
+   **/
+  template<typename Aggregator>
+  void scan_records(const RecordLocation<WhyRequest> &location,
+                    const ScanRange &range,
+                    Aggregator &map,
+                    ScanStatistics &stats) const;
+
+  /**
+   * Scan the records of a location, counting queries within range.
+   *
+   * @param location The location (or chunked records) to be scanned
+   * @param range The range of timestamps to be counted
+   * @param map The aggregator to be filled (implementing add_batch())
+   * @param stats The statistics to be filled
+   * @param copy The copier of new keys (see RefStringUnorderedHashMap::insert)
+   * @param canonicalizer The queries canonicalizer, or @c NULL
+   **/
+  template<typename Aggregator, typename Copy, typename Location>
+  void scan_records(const Location &location,
+                    const ScanRange &range,
+                    Aggregator &map,
+                    ScanStatistics &stats,
+                    Copy copy,
+                    Canonicalizer *canonicalizer) const;
+
+  /**
+   * Scan the records of a location, split in chunks scanned by worker
+   * threads, each one filling a copy of the (empty) aggregator, merged at the end.
+   *
+   * @param position The location to be scanned
+   * @param range The range of timestamps to be counted
+   * @param result The aggregator to be filled (implementing add_batch(), swap() and merge())
+   * @param stats The statistics to be filled
+   * @return The number of chunks
+   **/
+  template<typename Aggregator>
+  size_t scan_chunks(const RecordLocation<WhyRequest> &position,
+                     const ScanRange &range,
+                     Aggregator &result,
+                     ScanStatistics &stats) const;
+
+  /**
+   * Scan the records of a span, into an aggregator merged into @c result.
+   *
+   * @param from The start of the span
+   * @param to The end of the span (inclusive)
+   * @param empty An empty aggregator, of the @c result configuration
+   * @param result The aggregator to be filled (implementing merge())
+   * @param stats The statistics to be filled
+   **/
+  template<typename Aggregator>
+  void scan_span(time_t from, time_t to, const Aggregator &empty, Aggregator &result, ScanStatistics &stats) const;
+
+  /**
+   * Load the rollup sidecar of the file, if enabled and present, rebuilding it if stale.
+   *
+   * @return @c true if the rollup was loaded
+   **/
+  bool load_rollup();
+
+  /**
+   * Parse the records of the range using the rollup sidecar: whole buckets
+   * are combined, and only the edges of the range are scanned.
+   *
+   * @param covered_from The start of the whole buckets span
+   * @param covered_to The end of the whole buckets span (inclusive)
+   **/
+  void parse_rollup(time_t covered_from, time_t covered_to);
+
+  /**
+   * Add the statistics of a scan to the metrics.
+   *
+   * @param stats The scan statistics
+   * @param chunks The number of scanned chunks
+   **/
+  void add_scan_metrics(const ScanStatistics &stats, size_t chunks) const;
+
+  /**
+   * Fall back to approximate counting once the memory limit was exceeded:
+   * the hashtable is released, and the approximate aggregator enabled.
+   *
+   * @return @c true if the records are to be parsed again
+   **/
+  bool degrade();
+
+  /**
+   * Locate the records of a range: exactly using the loaded timestamp index,
+   * or approximately using fast-seek, or from the beginning of the file.
+   *
+   * @param range The range; its @c exact flag is set
+   * @param seeked Set if a fast-seek binary search was done
+   * @return The location to be scanned
+   **/
+  RecordLocation<WhyRequest> locate_range(ScanRange &range, bool &seeked) const;
+
+  /**
+   * May the file hold records within the range ? Records being loosely
+   * sorted, the file span is widened by the jitter.
+   *
+   * @return @c false if the file can be skipped
+   **/
+  bool overlaps_range() const;
+
+  /**
+   * Merge the results of another parser, of the same configuration, and
+   * release them. The other parser mapping must outlive this one results.
+   **/
+  void merge(YParser &other);
+
+  /**
+   * Return the end of the last complete line (follow mode).
+   *
+   * @param offset The offset to search from
+   * @return The offset following the last newline, or @c offset if none
+   **/
+  size_t get_complete_end(size_t offset) const;
+
+  /**
+   * Parse the complete lines following the last parsed one (follow mode).
+   *
+   * @return The number of records read
+   **/
+  size_t parse_appended();
+
+protected:
+  // Path of the records file
+  const std::string filename;
+
   // hashmap (unordered map) of RefString (ie. small string objects
   // referencing mapped memory bytes) to count unique queries
   RefStringUnorderedHashMap<unsigned> wordMap;
 
+  // Approximate top queries estimator (see @c set_approx)
+  HeavyHitters heavyHitters;
+
+  // Approximate distinct queries sketch (see @c set_approx_distinct)
+  HyperLogLog distinctSketch;
+
   // Start timestamp
   time_t from;
 
@@ -126,6 +693,62 @@ protected:
 
   // Jitter for loosely ordered file
   time_t jitter;
+
+  // Number of scanning threads
+  unsigned threads;
+
+  // Use the timestamp index sidecar
+  bool use_index;
+
+  // Timestamp index sidecar, if loaded
+  TimestampIndex timestampIndex;
+
+  // Was the index sidecar loaded ?
+  bool index_loaded;
+
+  // Rollup sidecar, if loaded
+  Rollup rollup;
+
+  // Use the rollup sidecar
+  bool use_rollup;
+
+  // Approximate top queries, their memory budget, and Count-Min sketch usage
+  bool approx;
+  size_t approx_memory;
+  bool approx_count_min;
+
+  // Approximate distinct queries
+  bool approx_distinct;
+
+  // Follow mode
+  bool follow;
+
+  // End of the parsed lines (follow mode)
+  size_t parsed;
+
+  // Canonicalization flags (see @c set_canonical)
+  unsigned canonical;
+
+  // Records read mode (see @c set_read_mode)
+  enum read_mode read_mode;
+
+  // Copies of the map keys which can not point into the mapped file, shared
+  // by scanning threads: rewritten canonical queries, queries read with
+  // --read=pread/direct, and queries of pages dropped by --drop-behind
+  std::unique_ptr<KeyArena> keyArena;
+  mutable std::mutex keyArenaLock;
+
+  // Phases metrics, if collected (see @c set_metrics)
+  Metrics *metrics;
+
+  // Memory account of the aggregation structures, the limit fallback, and
+  // was it used (see @c set_memory_account)
+  MemoryAccount *memory;
+  enum memory_fallback fallback;
+  bool degraded;
+
+  // Do the results hold counts (parsed, or merged) ?
+  bool counted;
 };
 
 #endif
@@ -6,7 +6,13 @@
  * License: http://opensource.org/licenses/BSD-2-Clause
  **/
 
+#include <type_traits>
+
 #include "yrequest.hpp"
+#include "simdscan.hpp"
+
+static_assert(std::is_same<DefaultHashPolicy, RxHashPolicy>::value,
+              "the tokenizer computes query hashes with rxhash, which must be the default hash policy");
 
 /**
  * Is the given character a space character (SP or TAB) ?
@@ -51,8 +57,13 @@ bool WhyRequest::get_record(unsigned char *data, size_t size, size_t &offset) {
   /* Skip separator(s) */
   for(; offset < size && is_space(data[offset]) ; offset++) ;
 
-  /* Query */
-  for(query_size = 0, query = &data[offset]; offset < size && data[offset] != '\n'; offset++, query_size++) ;
+  /* Query (vectorized lookup of the line ending; timestamps are too short to benefit from it).
+     The query hash is computed along the way, so that query bytes are only read once. */
+  uint64_t hash;
+  query = &data[offset];
+  offset = simd_find_byte_rxhash(query, &data[size], '\n', hash) - data;
+  query_size = &data[offset] - query;
+  query_hash = static_cast<size_t>(hash);
 
   /* Ending line (offset must be placed at the beginning of next record) */
   if (offset < size) {
@@ -126,7 +137,7 @@ size_t WhyRequest::begin(unsigned char *data, size_t size, size_t offset) {
 
 size_t WhyRequest::end(unsigned char *data, size_t size, size_t offset) {
   assert(offset <= size);
-  for(; offset < size && (offset == 0 || data[offset - 1] != '\n'); offset++) ;
+  offset = simd_find_byte(&data[offset], &data[size], '\n') - data;
   /* Skip \n */
   if (offset < size) {
     offset++;
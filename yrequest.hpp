@@ -24,14 +24,14 @@ public:
    *
    * @comment Use @c get_record to fill this object
    **/
-  WhyRequest(): timestamp(0), query(NULL), query_size(0)
+  WhyRequest(): valid(false), timestamp(0), query(NULL), query_size(0), query_hash(0)
   {
   }
 
   /**
    * Specialized constructor, to obtain an object suitable for comparisons.
    **/
-  WhyRequest(time_t start): timestamp(start), query(NULL), query_size(0)
+  WhyRequest(time_t start): valid(false), timestamp(start), query(NULL), query_size(0), query_hash(0)
   {
   }
 
@@ -56,10 +56,10 @@ public:
   /**
    * Get the query (raw form)
    *
-   * @return The RefString reference string of the query (not URI-decoded)
+   * @return The RefString reference string of the query (not URI-decoded), with its hash
   **/
   RefString get_raw_query() const {
-    return RefString(reinterpret_cast<const char*>(query), query_size);
+    return RefString(reinterpret_cast<const char*>(query), query_size, query_hash);
   }
 
   /**
@@ -109,6 +109,7 @@ protected:
     timestamp = 0;
     query = NULL;
     query_size = 0;
+    query_hash = 0;
     valid = false;
   }
 
@@ -124,6 +125,9 @@ protected:
 
   // The string size
   size_t query_size;
+
+  // The string hash (default hash policy), computed while tokenizing
+  size_t query_hash;
 };
 
 #endif
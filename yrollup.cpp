@@ -0,0 +1,352 @@
+/**
+ * YCombinator Logs Rollup Store.
+ * Pre-aggregated per-bucket query counts and HyperLogLog sketches of a log file, mapped from a sidecar
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+#include "yrollup.hpp"
+
+// Sidecar magic and version
+#define HNROLL_MAGIC "HNROLL\0"
+#define HNROLL_VERSION 1
+
+// String hashed to check that the rollup was built with the current hash policy
+#define HNROLL_HASH_CHECK "hnroll"
+
+/**
+ * Sidecar header.
+ **/
+struct hnroll_header {
+  char magic[8];
+  uint64_t version;
+  uint64_t file_size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t hash_check;
+  int64_t bucket_size;
+  uint64_t bucket_count;
+  uint64_t string_count;
+  uint64_t entry_count;
+  uint64_t precision;
+  uint64_t strings_size;
+};
+
+/**
+ * Dictionary string.
+ **/
+struct hnroll_string {
+  uint64_t offset;
+  uint64_t hash;
+  uint64_t length;
+};
+
+/**
+ * Count of a query within a bucket.
+ **/
+struct hnroll_entry {
+  uint32_t string;
+  uint32_t count;
+};
+
+/**
+ * Bucket being built.
+ **/
+struct RollupBucket {
+  explicit RollupBucket(unsigned precision): records(0), sketch(precision)
+  {
+  }
+
+  // Number of records
+  uint64_t records;
+
+  // Query counts
+  RefStringUnorderedHashMap<unsigned> counts;
+
+  // Queries sketch
+  HyperLogLog sketch;
+};
+
+/**
+ * Write a whole buffer.
+ *
+ * @return @c true upon success
+ **/
+static bool write_fully(FILE *fp, const void *buffer, size_t size) {
+  return size == 0 || fwrite(buffer, size, 1, fp) == 1;
+}
+
+/**
+ * Floor division (timestamps may be negative).
+ **/
+static inline time_t floor_div(time_t a, time_t b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+bool Rollup::build(const MappedRecords<WhyRequest> &records, const struct stat &st, const char *filename,
+                   time_t bucket_size, unsigned precision) {
+  assert(bucket_size > 0);
+
+  // Aggregate records by bucket; records are loosely sorted, so the last
+  // bucket is kept at hand
+  std::map<time_t, RollupBucket> bucket_map;
+  RollupBucket *current = NULL;
+  time_t current_start = 0;
+  for(const auto &record : records.begin()) {
+    if (!record.is_valid()) {
+      continue;
+    }
+    const time_t start = floor_div(record.get_timestamp(), bucket_size)*bucket_size;
+    if (current == NULL || start != current_start) {
+      current = &bucket_map.emplace(start, RollupBucket(precision)).first->second;
+      current_start = start;
+    }
+    const RefString query = record.get_raw_query();
+    current->counts[query]++;
+    current->sketch.add(query.hash());
+    current->records++;
+  }
+
+  // Dictionary of all queries, and per-bucket entries
+  RefStringUnorderedHashMap<uint32_t> ids;
+  std::vector<hnroll_string> dictionary;
+  std::vector<RefString> dictionary_keys;
+  std::vector<Bucket> bucket_list;
+  std::vector<hnroll_entry> entry_list;
+  uint64_t strings_size = 0;
+  for(const auto &element : bucket_map) {
+    Bucket bucket;
+    bucket.start = element.first;
+    bucket.first_entry = entry_list.size();
+    bucket.entry_count = element.second.counts.size();
+    bucket.records = element.second.records;
+    bucket_list.push_back(bucket);
+
+    for(const auto entry : element.second.counts) {
+      const RefString &key = entry.first;
+      uint32_t &id = ids[key];
+      if (id == 0) {
+        hnroll_string string = { strings_size, key.hash(), key.len };
+        dictionary.push_back(string);
+        dictionary_keys.push_back(key);
+        strings_size += key.len;
+        id = static_cast<uint32_t>(dictionary.size());
+      }
+      const hnroll_entry rollup_entry = { id - 1, entry.second };
+      entry_list.push_back(rollup_entry);
+    }
+
+    // Sort by string, for locality when combining buckets
+    std::sort(entry_list.begin() + bucket.first_entry, entry_list.end(),
+              [](const hnroll_entry &a, const hnroll_entry &b) {
+                return a.string < b.string;
+              });
+  }
+
+  hnroll_header file_header;
+  memset(&file_header, 0, sizeof(file_header));
+  memcpy(file_header.magic, HNROLL_MAGIC, sizeof(file_header.magic));
+  file_header.version = HNROLL_VERSION;
+  file_header.file_size = static_cast<uint64_t>(st.st_size);
+  file_header.mtime_sec = st.st_mtim.tv_sec;
+  file_header.mtime_nsec = st.st_mtim.tv_nsec;
+  file_header.hash_check = RefString(HNROLL_HASH_CHECK).hash();
+  file_header.bucket_size = bucket_size;
+  file_header.bucket_count = bucket_list.size();
+  file_header.string_count = dictionary.size();
+  file_header.entry_count = entry_list.size();
+  file_header.precision = precision;
+  file_header.strings_size = strings_size;
+
+  // Write a temporary file, and rename it, so that readers never see a partial rollup
+  const std::string temporary = std::string(filename) + ".tmp." + std::to_string(getpid());
+  FILE *const fp = fopen(temporary.c_str(), "wbe");
+  if (fp == NULL) {
+    error = errno;
+    return false;
+  }
+  bool success = write_fully(fp, &file_header, sizeof(file_header))
+    && write_fully(fp, bucket_list.data(), bucket_list.size()*sizeof(Bucket))
+    && write_fully(fp, dictionary.data(), dictionary.size()*sizeof(hnroll_string))
+    && write_fully(fp, entry_list.data(), entry_list.size()*sizeof(hnroll_entry));
+  std::vector<uint8_t> registers;
+  for(auto it = bucket_map.begin(); success && it != bucket_map.end(); ++it) {
+    it->second.sketch.get_registers(registers);
+    success = write_fully(fp, registers.data(), registers.size());
+  }
+  for(size_t i = 0; success && i < dictionary_keys.size(); i++) {
+    success = write_fully(fp, dictionary_keys[i].str, dictionary_keys[i].len);
+  }
+  if (!success) {
+    error = errno;
+  }
+  if (fclose(fp) != 0 && success) {
+    error = errno;
+    success = false;
+  }
+  if (success && rename(temporary.c_str(), filename) != 0) {
+    error = errno;
+    success = false;
+  }
+  if (!success) {
+    unlink(temporary.c_str());
+    return false;
+  }
+
+  return load(filename);
+}
+
+bool Rollup::load(const char *filename) {
+  unload();
+  map.reset(new ReadOnlyMemoryMap(filename));
+  if (!map->is_valid()) {
+    error = map->get_error();
+    map.reset();
+    return false;
+  }
+
+  // Check the header, and the sections size
+  const size_t size = map->get_size();
+  const unsigned char *const base = map->get_data();
+  const hnroll_header *const candidate = reinterpret_cast<const hnroll_header*>(base);
+  if (size < sizeof(hnroll_header)
+      || memcmp(candidate->magic, HNROLL_MAGIC, sizeof(candidate->magic)) != 0
+      || candidate->version != HNROLL_VERSION
+      || candidate->bucket_size <= 0
+      || candidate->precision < HLL_MIN_PRECISION
+      || candidate->precision > HLL_MAX_PRECISION
+      || candidate->bucket_count > size
+      || candidate->string_count > size
+      || candidate->entry_count > size
+      || candidate->strings_size > size
+      || sizeof(hnroll_header)
+      + candidate->bucket_count*sizeof(Bucket)
+      + candidate->string_count*sizeof(hnroll_string)
+      + candidate->entry_count*sizeof(hnroll_entry)
+      + candidate->bucket_count*(static_cast<uint64_t>(1) << candidate->precision)
+      + candidate->strings_size != size) {
+    error = EINVAL;
+    map.reset();
+    return false;
+  }
+  bucket_size = static_cast<time_t>(candidate->bucket_size);
+  precision = static_cast<unsigned>(candidate->precision);
+
+  // Check the sections: bucket entries, entry strings and string bytes are
+  // within their section
+  const Bucket *const candidate_buckets = reinterpret_cast<const Bucket*>(base + sizeof(hnroll_header));
+  const hnroll_string *const candidate_strings = reinterpret_cast<const hnroll_string*>(candidate_buckets + candidate->bucket_count);
+  const hnroll_entry *const candidate_entries = reinterpret_cast<const hnroll_entry*>(candidate_strings + candidate->string_count);
+  bool valid = true;
+  for(size_t i = 0; i < candidate->bucket_count && valid; i++) {
+    valid = candidate_buckets[i].first_entry <= candidate->entry_count
+      && candidate_buckets[i].entry_count <= candidate->entry_count - candidate_buckets[i].first_entry;
+  }
+  for(size_t i = 0; i < candidate->entry_count && valid; i++) {
+    valid = candidate_entries[i].string < candidate->string_count;
+  }
+  for(size_t i = 0; i < candidate->string_count && valid; i++) {
+    valid = candidate_strings[i].offset <= candidate->strings_size
+      && candidate_strings[i].length <= candidate->strings_size - candidate_strings[i].offset;
+  }
+  if (!valid) {
+    error = EINVAL;
+    map.reset();
+    return false;
+  }
+
+  header = candidate;
+  buckets = candidate_buckets;
+  strings = candidate_strings;
+  entries = candidate_entries;
+  sketches = reinterpret_cast<const uint8_t*>(entries + header->entry_count);
+  data = reinterpret_cast<const char*>(sketches + header->bucket_count*(static_cast<size_t>(1) << header->precision));
+  return true;
+}
+
+bool Rollup::is_fresh(const struct stat &st) const {
+  return is_loaded()
+    && header->file_size == static_cast<uint64_t>(st.st_size)
+    && header->mtime_sec == st.st_mtim.tv_sec
+    && header->mtime_nsec == st.st_mtim.tv_nsec
+    && header->hash_check == RefString(HNROLL_HASH_CHECK).hash();
+}
+
+size_t Rollup::get_buckets() const {
+  return is_loaded() ? static_cast<size_t>(header->bucket_count) : 0;
+}
+
+bool Rollup::cover(time_t from, time_t to, time_t &covered_from, time_t &covered_to) const {
+  if (!is_loaded() || from > to) {
+    return false;
+  }
+
+  // First bucket starting at or after the range start, last bucket ending at
+  // or before the range end
+  const time_t size = get_bucket_size();
+  const time_t first = floor_div(from, size) + (floor_div(from, size)*size != from);
+  const time_t last = to != std::numeric_limits<time_t>::max()
+    ? floor_div(to + 1, size) - 1
+    : floor_div(to, size);
+  if (first > last) {
+    return false;
+  }
+  covered_from = first*size;
+  covered_to = to != std::numeric_limits<time_t>::max() ? (last + 1)*size - 1 : to;
+  return true;
+}
+
+void Rollup::find_buckets(time_t from, time_t to, size_t &first, size_t &last) const {
+  const Bucket *const end = buckets + header->bucket_count;
+  const auto compare = [](const Bucket &bucket, time_t stamp) {
+    return bucket.start < stamp;
+  };
+  first = std::lower_bound(buckets, end, from, compare) - buckets;
+  last = first;
+  for(; last < header->bucket_count && buckets[last].start <= to; last++) ;
+}
+
+size_t Rollup::add_counts(time_t from, time_t to, RefStringUnorderedHashMap<unsigned> &counts) const {
+  size_t first;
+  size_t last;
+  find_buckets(from, to, first, last);
+
+  size_t records = 0;
+  for(size_t i = first; i < last; i++) {
+    const Bucket &bucket = buckets[i];
+    const hnroll_entry *const begin = entries + bucket.first_entry;
+    const hnroll_entry *const end = begin + bucket.entry_count;
+    for(const hnroll_entry *entry = begin; entry != end; entry++) {
+      const hnroll_string &string = strings[entry->string];
+      counts.insert(RefString(data + string.offset, string.length, string.hash), string.hash) += entry->count;
+    }
+    records += bucket.records;
+  }
+  return records;
+}
+
+size_t Rollup::add_sketches(time_t from, time_t to, HyperLogLog &sketch) const {
+  assert(sketch.get_precision() == get_precision());
+  size_t first;
+  size_t last;
+  find_buckets(from, to, first, last);
+
+  const size_t registers = static_cast<size_t>(1) << header->precision;
+  size_t records = 0;
+  for(size_t i = first; i < last; i++) {
+    sketch.merge_registers(sketches + i*registers);
+    records += buckets[i].records;
+  }
+  return records;
+}
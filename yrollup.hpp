@@ -0,0 +1,214 @@
+/**
+ * YCombinator Logs Rollup Store.
+ * Pre-aggregated per-bucket query counts and HyperLogLog sketches of a log file, mapped from a sidecar
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_YROLLUP_HPP
+#define RX_YROLLUP_HPP
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "yrequest.hpp"
+#include "hyperloglog.hpp"
+
+// Default bucket size, in seconds (one hour)
+#define HNROLL_DEFAULT_BUCKET 3600
+
+// Sidecar file suffix
+#define HNROLL_SUFFIX ".hnroll"
+
+/** On-disk structures (see yrollup.cpp) **/
+struct hnroll_header;
+struct hnroll_string;
+struct hnroll_entry;
+
+/**
+ * Rollup of a log file: records are aggregated by time bucket (eg. per
+ * minute or per hour), each bucket holding the count of each query, and a
+ * HyperLogLog sketch of its queries. A range made of whole buckets is
+ * answered by combining them, without touching the log file.
+ *
+ * On-disk format (native byte order, 8-byte aligned sections, mapped as is):
+ *   header: magic "HNROLL", version, indexed file size and mtime, hash check,
+ *           bucket size and count, string count, entry count, sketch precision, strings size
+ *   buckets: { int64 start, uint64 first_entry, uint64 entry_count, uint64 records } * bucket count, sorted
+ *   strings: { uint64 offset, uint64 hash, uint64 length } * string count
+ *   entries: { uint32 string, uint32 count } * entry count, grouped by bucket
+ *   sketches: 2^precision registers * bucket count
+ *   strings data
+ **/
+class Rollup {
+public:
+  /**
+   * Bucket.
+   **/
+  struct Bucket {
+    // Start timestamp (a multiple of the bucket size)
+    int64_t start;
+
+    // First entry of the bucket
+    uint64_t first_entry;
+
+    // Number of entries (distinct queries)
+    uint64_t entry_count;
+
+    // Number of records
+    uint64_t records;
+  };
+
+  /**
+   * Create an empty (unloaded) rollup.
+   **/
+  Rollup(): header(NULL), buckets(NULL), strings(NULL), entries(NULL), sketches(NULL), data(NULL), error(0),
+            bucket_size(HNROLL_DEFAULT_BUCKET), precision(HLL_DEFAULT_PRECISION)
+  {
+  }
+
+  /**
+   * Build the rollup of a mapped log file, write it to a sidecar, and load it.
+   *
+   * @param records The mapped records
+   * @param st The log file status (size and modification time)
+   * @param filename The sidecar path
+   * @param bucket_size The bucket size, in seconds
+   * @param precision The HyperLogLog sketches precision
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool build(const MappedRecords<WhyRequest> &records, const struct stat &st, const char *filename,
+             time_t bucket_size = HNROLL_DEFAULT_BUCKET, unsigned precision = HLL_DEFAULT_PRECISION);
+
+  /**
+   * Load (map) a rollup sidecar. The sections are checked to be consistent;
+   * an invalid sidecar fails with @c EINVAL.
+   *
+   * @param filename The sidecar path
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool load(const char *filename);
+
+  /**
+   * Unload (unmap) the rollup.
+   **/
+  void unload() {
+    header = NULL;
+    map.reset();
+  }
+
+  /**
+   * Is the rollup up-to-date with the log file (and built with the current hash policy) ?
+   *
+   * @param st The log file status
+   * @return @c true if fresh
+   **/
+  bool is_fresh(const struct stat &st) const;
+
+  /**
+   * Get the span of whole buckets within a range.
+   *
+   * @param from The start of the range
+   * @param to The end of the range (inclusive)
+   * @param covered_from The start of the whole buckets span
+   * @param covered_to The end of the whole buckets span (inclusive)
+   * @return @c true if the range holds at least one whole bucket
+   **/
+  bool cover(time_t from, time_t to, time_t &covered_from, time_t &covered_to) const;
+
+  /**
+   * Add the query counts of the buckets of a span to a map.
+   *
+   * @param from The start of the span (a bucket start)
+   * @param to The end of the span (inclusive, a bucket end)
+   * @param counts The map to be filled
+   * @return The number of records of the span
+   **/
+  size_t add_counts(time_t from, time_t to, RefStringUnorderedHashMap<unsigned> &counts) const;
+
+  /**
+   * Merge the sketches of the buckets of a span.
+   *
+   * @param from The start of the span (a bucket start)
+   * @param to The end of the span (inclusive, a bucket end)
+   * @param sketch The sketch to be filled, of the rollup precision
+   * @return The number of records of the span
+   **/
+  size_t add_sketches(time_t from, time_t to, HyperLogLog &sketch) const;
+
+  /**
+   * Is a rollup loaded ?
+   **/
+  bool is_loaded() const {
+    return header != NULL;
+  }
+
+  /**
+   * Return the bucket size, in seconds, of the last sidecar read (even if
+   * invalid, so that it can be rebuilt alike), or the default one.
+   **/
+  time_t get_bucket_size() const {
+    return bucket_size;
+  }
+
+  /**
+   * Return the number of (non-empty) buckets.
+   **/
+  size_t get_buckets() const;
+
+  /**
+   * Return the HyperLogLog sketches precision of the last sidecar read (even
+   * if invalid), or the default one.
+   **/
+  unsigned get_precision() const {
+    return precision;
+  }
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+  /**
+   * Sidecar path of a log file.
+   **/
+  static std::string sidecar(const char *filename) {
+    return std::string(filename) + HNROLL_SUFFIX;
+  }
+
+protected:
+  /** Buckets range [first, last) of a span. **/
+  void find_buckets(time_t from, time_t to, size_t &first, size_t &last) const;
+
+protected:
+  // Mapped sidecar, and its sections
+  std::unique_ptr<ReadOnlyMemoryMap> map;
+  const hnroll_header *header;
+  const Bucket *buckets;
+  const hnroll_string *strings;
+  const hnroll_entry *entries;
+  const uint8_t *sketches;
+  const char *data;
+
+  // Last error
+  int error;
+
+  // Settings of the last sidecar read
+  time_t bucket_size;
+  unsigned precision;
+
+private:
+  /* Forbidden foes */
+  Rollup(const Rollup&) = delete;
+  Rollup& operator=(const Rollup&) = delete;
+};
+
+#endif
@@ -0,0 +1,488 @@
+/**
+ * YCombinator Logs Query Server.
+ * Answer distinct/top queries over a Unix socket, keeping the log file mapped and its index loaded
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+#include "yserver.hpp"
+
+// Receive buffer size
+#define RECV_BUFFER_SIZE 4096
+
+// Wake-up pipe of the serving thread, written upon SIGINT/SIGTERM (-1 if none)
+static volatile sig_atomic_t yserver_wake = -1;
+
+// Was a stop signal received ?
+static volatile sig_atomic_t yserver_stopped = 0;
+
+/**
+ * Stop signal handler: wake up the poll() loop.
+ **/
+static void yserver_signal(int) {
+  yserver_stopped = 1;
+  if (yserver_wake != -1) {
+    const char byte = 0;
+    if (write(yserver_wake, &byte, 1) != 1) {
+      // The pipe is full: the loop is already being woken up
+    }
+  }
+}
+
+/**
+ * Fill a Unix socket address.
+ *
+ * @return @c false if the path is too long
+ **/
+static bool socket_address(const char *path, struct sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+  return true;
+}
+
+/**
+ * Send a whole buffer.
+ *
+ * @return @c true upon success
+ **/
+static bool send_fully(int fd, const std::string &data) {
+  size_t offset = 0;
+  while(offset != data.size()) {
+    const ssize_t n = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    offset += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+/**
+ * Read a line (without its trailing CR/LF), buffering the received bytes.
+ *
+ * @param fd The socket
+ * @param buffer The receive buffer, kept between calls
+ * @param line The line
+ * @return @c false upon end of stream or error
+ **/
+static bool read_line(int fd, std::string &buffer, std::string &line) {
+  for(;;) {
+    const size_t eol = buffer.find('\n');
+    if (eol != std::string::npos) {
+      line.assign(buffer, 0, eol);
+      buffer.erase(0, eol + 1);
+      if (!line.empty() && line[line.size() - 1] == '\r') {
+        line.resize(line.size() - 1);
+      }
+      return true;
+    }
+    char data[RECV_BUFFER_SIZE];
+    const ssize_t n = recv(fd, data, sizeof(data), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    buffer.append(data, static_cast<size_t>(n));
+  }
+}
+
+YServer::YServer(const YParser &parser, const char *path, unsigned threads, size_t cache_size):
+  parser(parser), path(path), threads(threads), cache_size(cache_size), sock(-1), error(0), stopping(false)
+{
+  if (this->threads == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    this->threads = cpus > 0 ? static_cast<unsigned>(cpus) : 1;
+  }
+  if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("could not create pipe");
+    abort();
+  }
+}
+
+YServer::~YServer() {
+  if (sock != -1) {
+    close(sock);
+    unlink(path.c_str());
+  }
+  close(wake[0]);
+  close(wake[1]);
+}
+
+bool YServer::listen() {
+  struct sockaddr_un addr;
+  if (!socket_address(path.c_str(), addr)) {
+    error = errno;
+    return false;
+  }
+
+  // Remove a stale socket (but nothing else)
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    error = errno;
+    return false;
+  }
+  if (bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+      || ::listen(sock, SOMAXCONN) != 0) {
+    error = errno;
+    close(sock);
+    sock = -1;
+    return false;
+  }
+  return true;
+}
+
+void YServer::run() {
+  assert(sock != -1);
+
+  // Stop upon SIGINT/SIGTERM; poll() is woken up by the pipe
+  yserver_stopped = 0;
+  yserver_wake = wake[1];
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = yserver_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  std::vector<std::thread> workers;
+  for(unsigned i = 0; i < threads; i++) {
+    workers.push_back(std::thread([this]() {
+          worker();
+        }));
+  }
+
+  std::vector<struct pollfd> polled;
+  std::vector<std::shared_ptr<Connection>> polled_connections;
+  while(!yserver_stopped) {
+    // Poll the listening socket, the wake-up pipe, and the open connections;
+    // connections ended once their requests were answered are closed
+    polled.clear();
+    polled_connections.clear();
+    polled.push_back({ sock, POLLIN, 0 });
+    polled.push_back({ wake[0], POLLIN, 0 });
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      for(auto it = connections.begin(); it != connections.end(); ) {
+        const std::shared_ptr<Connection> &connection = it->second;
+        if (connection->closed && !connection->busy) {
+          close(connection->fd);
+          it = connections.erase(it);
+        } else {
+          if (!connection->closed) {
+            polled.push_back({ connection->fd, POLLIN, 0 });
+            polled_connections.push_back(connection);
+          }
+          ++it;
+        }
+      }
+    }
+    if (poll(&polled[0], polled.size(), -1) < 0) {
+      if (errno != EINTR) {
+        std::cerr << "poll error: " << strerror(errno) << "\n";
+        break;
+      }
+      continue;
+    }
+
+    // New connection
+    if (polled[0].revents != 0) {
+      const int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+      if (fd != -1) {
+        std::unique_lock<std::mutex> guard(lock);
+        connections[fd] = std::make_shared<Connection>(fd);
+      } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && !yserver_stopped) {
+        std::cerr << "accept error: " << strerror(errno) << "\n";
+        break;
+      }
+    }
+
+    // Wake-up: drain the pipe
+    if (polled[1].revents != 0) {
+      char data[64];
+      while(read(wake[0], data, sizeof(data)) > 0) ;
+    }
+
+    // Requests
+    for(size_t i = 2; i < polled.size(); i++) {
+      if (polled[i].revents != 0) {
+        receive(polled_connections[i - 2]);
+      }
+    }
+  }
+  yserver_wake = -1;
+
+  // Stop workers, interrupting the responses being sent
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    stopping = true;
+    pending.clear();
+    for(const auto &connection : connections) {
+      shutdown(connection.first, SHUT_RDWR);
+    }
+    ready.notify_all();
+  }
+  for(auto &worker : workers) {
+    worker.join();
+  }
+  for(const auto &connection : connections) {
+    close(connection.first);
+  }
+  connections.clear();
+}
+
+void YServer::receive(const std::shared_ptr<Connection> &connection) {
+  char data[RECV_BUFFER_SIZE];
+  const ssize_t n = recv(connection->fd, data, sizeof(data), MSG_DONTWAIT);
+  if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+
+  // Complete lines (without their trailing CR/LF); the previously received
+  // bytes hold no newline, and are not searched again
+  std::vector<std::string> lines;
+  bool too_long = false;
+  if (n > 0) {
+    std::string &buffer = connection->buffer;
+    size_t start = 0;
+    size_t search = buffer.size();
+    buffer.append(data, static_cast<size_t>(n));
+    for(size_t eol; (eol = buffer.find('\n', search)) != std::string::npos; start = search = eol + 1) {
+      size_t end = eol;
+      if (end != start && buffer[end - 1] == '\r') {
+        end--;
+      }
+      if (end - start > YSERVER_MAX_LINE) {
+        too_long = true;
+        break;
+      }
+      if (end != start) {
+        lines.push_back(buffer.substr(start, end - start));
+      }
+    }
+    buffer.erase(0, start);
+    too_long = too_long || buffer.size() > YSERVER_MAX_LINE;
+    if (too_long) {
+      buffer.clear();
+    }
+  }
+
+  // Queue them, the connection waiting for a worker if it was idle; the
+  // requests received before the end of stream (or a too long line) are
+  // still answered
+  std::unique_lock<std::mutex> guard(lock);
+  if (n <= 0 || too_long) {
+    connection->closed = true;
+  }
+  if (too_long) {
+    connection->too_long = true;
+  }
+  connection->requests.insert(connection->requests.end(), lines.begin(), lines.end());
+  if (!connection->busy && (!connection->requests.empty() || connection->too_long)) {
+    connection->busy = true;
+    pending.push_back(connection);
+    ready.notify_one();
+  }
+}
+
+void YServer::worker() {
+  for(;;) {
+    std::shared_ptr<Connection> connection;
+    std::string request;
+    bool has_request;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      ready.wait(guard, [this]() {
+          return stopping || !pending.empty();
+        });
+      if (stopping) {
+        break;
+      }
+      connection = pending.front();
+      pending.pop_front();
+      has_request = !connection->requests.empty();
+      if (has_request) {
+        request = connection->requests.front();
+        connection->requests.pop_front();
+      }
+    }
+
+    // A single request at a time: other connections are served in turn; a
+    // too long line is answered after the requests preceding it
+    const bool sent = send_fully(connection->fd, has_request ? answer(request) : "error: request too long\n\n");
+
+    bool ended;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      if (!has_request) {
+        connection->too_long = false;
+      }
+      if (!sent) {
+        connection->closed = true;
+        connection->requests.clear();
+        connection->too_long = false;
+      }
+      if (!connection->requests.empty() || connection->too_long) {
+        pending.push_back(connection);
+        ready.notify_one();
+      } else {
+        connection->busy = false;
+      }
+      ended = connection->closed && !connection->busy;
+    }
+
+    // Let the serving thread close an ended connection
+    if (ended) {
+      wake_up();
+    }
+  }
+}
+
+void YServer::wake_up() {
+  const char byte = 0;
+  if (write(wake[1], &byte, 1) != 1 && errno != EAGAIN) {
+    perror("unexpected write error");
+    abort();
+  }
+}
+
+std::string YServer::answer(const std::string &request) {
+  YQuery query;
+  if (!query.parse(request)) {
+    return "error: invalid request\n\n";
+  }
+
+  const std::shared_ptr<const RangeResult> result = get_range(query.from, query.to, query.count);
+
+  std::ostringstream response;
+  if (!query.top) {
+    response << result->distinct << "\n";
+  } else {
+    for(size_t i = 0; i < result->top.size() && i < query.count; i++) {
+      response << (std::string) result->top[i].first << " " << result->top[i].second << "\n";
+    }
+  }
+  response << "\n";
+  return response.str();
+}
+
+std::shared_ptr<const YServer::RangeResult> YServer::get_range(time_t from, time_t to, size_t top_count) {
+  const RangeKey key(from, to);
+
+  // Cached result, if it holds enough top queries
+  {
+    std::unique_lock<std::mutex> guard(cache_lock);
+    const auto it = cache_index.find(key);
+    if (it != cache_index.end()) {
+      const std::shared_ptr<const RangeResult> result = it->second->second;
+      if (top_count <= result->top_count || result->top.size() < result->top_count) {
+        cache.splice(cache.begin(), cache, it->second);
+        return result;
+      }
+    }
+  }
+
+  // Scan the range (outside the lock; concurrent scans of the same range are harmless)
+  RefStringUnorderedHashMap<unsigned> map;
+  parser.scan_range(from, to, map);
+  std::shared_ptr<RangeResult> result = std::make_shared<RangeResult>();
+  result->distinct = map.size();
+  result->top_count = std::max<size_t>(top_count, YSERVER_MIN_TOP);
+  result->top = YParser::get_top_queries(map, result->top_count);
+
+  // Insert as the most recently used range, evicting the least recently used one
+  std::unique_lock<std::mutex> guard(cache_lock);
+  const auto it = cache_index.find(key);
+  if (it != cache_index.end()) {
+    cache.erase(it->second);
+  }
+  cache.push_front(std::make_pair(key, std::shared_ptr<const RangeResult>(result)));
+  cache_index[key] = cache.begin();
+  if (cache.size() > cache_size) {
+    cache_index.erase(cache.back().first);
+    cache.pop_back();
+  }
+
+  return result;
+}
+
+bool yclient(const char *path, std::istream &in, std::ostream &out) {
+  struct sockaddr_un addr;
+  if (!socket_address(path, addr)) {
+    std::cerr << "could not connect: " << strerror(errno) << "\n";
+    return false;
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+    std::cerr << "could not connect: " << strerror(errno) << "\n";
+    if (fd != -1) {
+      close(fd);
+    }
+    return false;
+  }
+
+  bool success = true;
+  std::string buffer;
+  std::string request;
+  while(std::getline(in, request)) {
+    if (request.empty()) {
+      continue;
+    }
+    if (!send_fully(fd, request + "\n")) {
+      std::cerr << "could not send request: " << strerror(errno) << "\n";
+      success = false;
+      break;
+    }
+
+    // Response lines, until the empty one
+    std::string line;
+    bool complete = false;
+    while(read_line(fd, buffer, line)) {
+      if (line.empty()) {
+        complete = true;
+        break;
+      }
+      if (line.compare(0, 6, "error:") == 0) {
+        success = false;
+      }
+      out << line << "\n";
+    }
+    if (!complete) {
+      std::cerr << "connection closed\n";
+      success = false;
+      break;
+    }
+  }
+
+  close(fd);
+  return success;
+}
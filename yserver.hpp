@@ -0,0 +1,219 @@
+/**
+ * YCombinator Logs Query Server.
+ * Answer distinct/top queries over a Unix socket, keeping the log file mapped and its index loaded
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_YSERVER_HPP
+#define RX_YSERVER_HPP
+
+#include <sys/types.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "yprocessing.hpp"
+
+// Default number of cached ranges
+#define YSERVER_CACHE_SIZE 256
+
+// Minimum number of top queries computed (and cached) for a range
+#define YSERVER_MIN_TOP 100
+
+// Maximum length of a request line
+#define YSERVER_MAX_LINE 4096
+
+/**
+ * Query server.
+ *
+ * Line protocol: each request is a line, and each response is a set of lines
+ * terminated by an empty line.
+ *   distinct FROM TO   -> the number of distinct queries
+ *   top K FROM TO      -> the top K queries, one "query count" per line
+ * Errors are reported as a single "error: reason" line.
+ *
+ * Connections are polled by the serving thread, and their request lines are
+ * answered by a pool of threads, in order for each connection (an idle
+ * connection never holds a thread); the results of the most recently
+ * requested ranges are cached.
+ **/
+class YServer {
+public:
+  /**
+   * Create a server (not yet listening).
+   *
+   * @param parser The parser, whose file mapping and index are shared by all requests
+   * @param path The Unix socket path
+   * @param threads The number of worker threads (0 means one per online CPU)
+   * @param cache_size The maximum number of cached ranges
+   **/
+  YServer(const YParser &parser, const char *path, unsigned threads,
+          size_t cache_size = YSERVER_CACHE_SIZE);
+
+  /**
+   * Destructor; close the socket and remove it.
+   **/
+  ~YServer();
+
+  /**
+   * Bind the socket, replacing a stale one.
+   *
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool listen();
+
+  /**
+   * Serve connections, until SIGINT or SIGTERM is received.
+   **/
+  void run();
+
+  /**
+   * Answer a single request.
+   *
+   * @param request The request line
+   * @return The response, including the terminating empty line
+   **/
+  std::string answer(const std::string &request);
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return error;
+  }
+
+  /**
+   * Return the number of worker threads.
+   **/
+  unsigned get_threads() const {
+    return threads;
+  }
+
+protected:
+  /**
+   * Aggregated results of a range.
+   **/
+  struct RangeResult {
+    // Number of distinct queries
+    size_t distinct;
+
+    // Top queries (at most @c top_count)
+    std::vector<std::pair<RefString, unsigned>> top;
+
+    // Number of top queries requested when computing the result
+    size_t top_count;
+  };
+
+  /**
+   * A connection, and its requests.
+   **/
+  struct Connection {
+    explicit Connection(int fd): fd(fd), buffer(), requests(), busy(false), closed(false), too_long(false)
+    {
+    }
+
+    // The socket
+    const int fd;
+
+    // Received bytes of the incomplete line (serving thread only)
+    std::string buffer;
+
+    // Complete request lines, waiting to be answered
+    std::deque<std::string> requests;
+
+    // Is the connection pending for, or served by, a worker ?
+    bool busy;
+
+    // Was the end of stream (or an error) reached ?
+    bool closed;
+
+    // Was a request line too long ? It is answered with an error once the
+    // previous requests are answered, and the connection is then closed
+    bool too_long;
+  };
+
+  /**
+   * Receive the available bytes of a connection, and queue its complete lines.
+   *
+   * @param connection The connection
+   **/
+  void receive(const std::shared_ptr<Connection> &connection);
+
+  /** Worker thread loop: answer the next request of pending connections. **/
+  void worker();
+
+  /** Wake up the serving thread. **/
+  void wake_up();
+
+  /**
+   * Get the results of a range, from the cache or by scanning it.
+   *
+   * @param from The start range
+   * @param to The ending range
+   * @param top_count The number of top queries needed
+   * @return The results
+   **/
+  std::shared_ptr<const RangeResult> get_range(time_t from, time_t to, size_t top_count);
+
+protected:
+  // The parser
+  const YParser &parser;
+
+  // The socket path
+  const std::string path;
+
+  // Number of worker threads
+  unsigned threads;
+
+  // Maximum number of cached ranges
+  const size_t cache_size;
+
+  // Listening socket
+  int sock;
+
+  // Last error
+  int error;
+
+  // Wake-up pipe of the serving thread
+  int wake[2];
+
+  // Open connections, connections with requests waiting for a worker, and stop flag
+  std::mutex lock;
+  std::condition_variable ready;
+  std::map<int, std::shared_ptr<Connection>> connections;
+  std::deque<std::shared_ptr<Connection>> pending;
+  bool stopping;
+
+  // Ranges cache, most recently used first
+  typedef std::pair<time_t, time_t> RangeKey;
+  typedef std::list<std::pair<RangeKey, std::shared_ptr<const RangeResult>>> RangeList;
+  std::mutex cache_lock;
+  RangeList cache;
+  std::map<RangeKey, RangeList::iterator> cache_index;
+
+private:
+  /* Forbidden foes */
+  YServer(const YServer&) = delete;
+  YServer& operator=(const YServer&) = delete;
+};
+
+/**
+ * Query client: send request lines read from @c in, and print their responses.
+ *
+ * @param path The Unix socket path
+ * @param in The requests stream
+ * @param out The responses stream (without the terminating empty lines)
+ * @return @c true upon success
+ **/
+bool yclient(const char *path, std::istream &in, std::ostream &out);
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * YCombinator Logs Stream Parser.
+ * Pipelined parsing of a sequential (eg. compressed) log stream
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#include <string.h>
+#include <assert.h>
+
+#include <iostream>
+#include <thread>
+
+#include "ystream.hpp"
+#include "yrequest.hpp"
+#include "chrono.hpp"
+
+YStreamParser::YStreamParser(const char *filename, size_t buffers, size_t buffer_size):
+  reader(filename),
+  keys(),
+  counts(),
+  distinctSketch(),
+  from(0),
+  to(std::numeric_limits<time_t>::max()),
+  fast_seek(true),
+  jitter(900),
+  approx_distinct(false),
+  canonical(0),
+  canonicalizer(0, 0),
+  buffers(buffers < 2 ? 2 : buffers, std::vector<unsigned char>(buffer_size)),
+  lengths(this->buffers.size(), 0),
+  free_buffers(),
+  filled_buffers(),
+  finished(false),
+  stopped(false),
+  read(0),
+  skipped(0),
+  invalid(0),
+  max_stamp(0),
+  max_jitter(0)
+{
+  for(size_t i = 0; i < this->buffers.size(); i++) {
+    free_buffers.push_back(i);
+  }
+}
+
+bool YStreamParser::acquire_free(size_t &index) {
+  std::unique_lock<std::mutex> guard(lock);
+  cond.wait(guard, [this]() {
+      return !free_buffers.empty() || stopped;
+    });
+  if (stopped) {
+    return false;
+  }
+  index = free_buffers.front();
+  free_buffers.pop_front();
+  return true;
+}
+
+void YStreamParser::publish(size_t index, size_t length) {
+  std::unique_lock<std::mutex> guard(lock);
+  lengths[index] = length;
+  filled_buffers.push_back(index);
+  cond.notify_all();
+}
+
+void YStreamParser::read_buffers() {
+  size_t current;
+  size_t used = 0;
+  if (!acquire_free(current)) {
+    return;
+  }
+
+  for(;;) {
+    // Fill the current buffer
+    std::vector<unsigned char> &buffer = buffers[current];
+    const ssize_t length = reader.read(&buffer[used], buffer.size() - used);
+    if (length > 0) {
+      used += static_cast<size_t>(length);
+      if (used < buffer.size()) {
+        continue;
+      }
+    }
+
+    // End of stream (or error): the last line may lack its line feed
+    if (length <= 0) {
+      if (used != 0) {
+        publish(current, used);
+      }
+      break;
+    }
+
+    // A line longer than the buffer: grow it
+    const unsigned char *const newline = static_cast<const unsigned char*>(memrchr(&buffer[0], '\n', used));
+    if (newline == NULL) {
+      buffer.resize(buffer.size()*2);
+      continue;
+    }
+
+    // Carry the trailing partial line over to the next buffer
+    const size_t complete = newline - &buffer[0] + 1;
+    size_t next;
+    if (!acquire_free(next)) {
+      return;
+    }
+    if (buffers[next].size() < used - complete) {
+      buffers[next].resize(buffer.size());
+    }
+    memcpy(&buffers[next][0], &buffer[complete], used - complete);
+    publish(current, complete);
+    used -= complete;
+    current = next;
+  }
+
+  std::unique_lock<std::mutex> guard(lock);
+  finished = true;
+  cond.notify_all();
+}
+
+void YStreamParser::add_batch(const RefString *batch, size_t batch_size) {
+  if (approx_distinct) {
+    distinctSketch.add_batch(batch, batch_size);
+    return;
+  }
+
+  // New identifiers are consecutive
+  uint32_t ids[KeyInterner::BATCH_MAX];
+  keys.intern_batch(batch, batch_size, ids);
+  for(size_t i = 0; i < batch_size; i++) {
+    if (ids[i] == counts.size()) {
+      counts.push_back(0);
+    }
+    counts[ids[i]]++;
+  }
+}
+
+bool YStreamParser::parse_buffer(unsigned char *data, size_t length) {
+  // Queries are interned by batches (see KeyInterner::intern_batch), and
+  // counted by identifier; canonical queries rewritten in the scratch buffer
+  // are valid until the batch is interned
+  RefString batch[KeyInterner::BATCH_MAX];
+  size_t batch_size = 0;
+  const auto flush = [&]() {
+    add_batch(batch, batch_size);
+    batch_size = 0;
+    canonicalizer.reset();
+  };
+  bool in_range = true;
+
+  WhyRequest record;
+  for(size_t offset = 0; offset < length && record.get_record(data, length, offset); ) {
+    const time_t stamp = record.get_timestamp();
+    if (!record.is_valid()) {
+      invalid++;
+    } else if (stamp >= from && stamp <= to) {
+      if (canonical == 0) {
+        batch[batch_size] = record.get_raw_query();
+      } else {
+        while(!canonicalizer.get(record.get_raw_query(), batch[batch_size])) {
+          flush();
+        }
+      }
+      if (++batch_size == KeyInterner::BATCH_MAX) {
+        flush();
+      }
+      read++;
+
+      /* Note max jitter */
+      if (stamp > max_stamp) {
+        max_stamp = stamp;
+      }
+      if (stamp < max_stamp && max_stamp - stamp > max_jitter) {
+        max_jitter = max_stamp - stamp;
+      }
+    } else if (fast_seek && stamp > to && stamp - to > jitter) {
+      // Stop if reached ending (letting a jitter margin)
+      in_range = false;
+      break;
+    } else {
+      skipped++;
+    }
+  }
+
+  flush();
+  return in_range;
+}
+
+bool YStreamParser::parse_records() {
+  ChronoTimer timer;
+
+  std::thread worker([this]() {
+      read_buffers();
+    });
+
+  // Parse filled buffers in stream order, and give them back
+  for(;;) {
+    size_t index;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      cond.wait(guard, [this]() {
+          return !filled_buffers.empty() || finished;
+        });
+      if (filled_buffers.empty()) {
+        break;
+      }
+      index = filled_buffers.front();
+      filled_buffers.pop_front();
+    }
+
+    const bool in_range = parse_buffer(&buffers[index][0], lengths[index]);
+
+    std::unique_lock<std::mutex> guard(lock);
+    free_buffers.push_back(index);
+    if (!in_range) {
+      stopped = true;
+    }
+    cond.notify_all();
+    if (stopped) {
+      break;
+    }
+  }
+
+  worker.join();
+
+  std::cerr << read << " records read in " << timer.tick() << " (stream: " << StreamReader::get_format_name(reader.get_format())
+            << ", buffers=" << buffers.size() << "x" << (buffers[0].size() >> 20) << "MiB)"
+            << ", " << skipped << " records skipped, " << invalid << " records invalid, jitter=" << max_jitter;
+  if (approx_distinct) {
+    std::cerr << ", approx precision=" << distinctSketch.get_precision();
+  } else {
+    std::cerr << ", keys=" << keys.get_size() << " bytes";
+  }
+  std::cerr << "\n";
+
+  return reader.is_valid();
+}
+
+std::vector<std::pair<RefString, unsigned>> YStreamParser::get_top_queries(size_t top_queries) const {
+  return get_top_counts(counts, top_queries, [this](uint32_t id) {
+      return keys.get(id);
+    });
+}
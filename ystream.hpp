@@ -0,0 +1,224 @@
+/**
+ * YCombinator Logs Stream Parser.
+ * Pipelined parsing of a sequential (eg. compressed) log stream
+ * Copyright (C) 2018 Xavier Roche (http://www.httrack.com/)
+ * All rights reserved.
+ * License: http://opensource.org/licenses/BSD-2-Clause
+ **/
+
+#ifndef RX_YSTREAM_HPP
+#define RX_YSTREAM_HPP
+
+#include <time.h>
+
+#include <limits>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include "streamreader.hpp"
+#include "keyarena.hpp"
+#include "refstringmap.hpp"
+#include "hyperloglog.hpp"
+#include "canonical.hpp"
+
+// Default number of buffers of the ring, and their size
+#define YSTREAM_BUFFERS 4
+#define YSTREAM_BUFFER_SIZE ((size_t) 8 << 20)
+
+/**
+ * Parser of a log stream which can not be mapped (such as a compressed
+ * file): a reader thread decompresses the stream into a ring of large
+ * buffers, while the parser consumes the complete lines of filled buffers.
+ * A line spanning a buffer boundary is carried over to the next buffer.
+ * Buffers being recycled, counted queries are interned into a key arena,
+ * and counted by identifier.
+ **/
+class YStreamParser {
+public:
+  /**
+   * Constructor.
+   *
+   * @param filename The path of the stream to open
+   * @param buffers The number of buffers of the ring (at least 2)
+   * @param buffer_size The size of each buffer (grown for longer lines)
+   **/
+  explicit YStreamParser(const char *filename, size_t buffers = YSTREAM_BUFFERS, size_t buffer_size = YSTREAM_BUFFER_SIZE);
+
+  /**
+   * Was the stream correctly opened ?
+   **/
+  bool is_valid() const {
+    return reader.is_valid();
+  }
+
+  /**
+   * Get the last error number.
+   **/
+  int get_error() const {
+    return reader.get_error();
+  }
+
+  /**
+   * Enable or disable the early end of the scan, once records are beyond
+   * the range end (letting a jitter margin). The stream can not be seeked.
+   *
+   * @param enabled If @c true, stop the scan early
+   * @param jitter_s The jitter time, in seconds
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_fast_seek(bool enabled, time_t jitter_s = 900) {
+    fast_seek = enabled;
+    jitter = jitter_s;
+  }
+
+  /**
+   * Enable approximate distinct queries counting (see @c HyperLogLog).
+   *
+   * @param precision The sketch precision
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_approx_distinct(unsigned precision) {
+    approx_distinct = true;
+    distinctSketch = HyperLogLog(precision);
+  }
+
+  /**
+   * Aggregate the canonical form of queries (see @c canonicalize).
+   *
+   * @param flags The canonicalization flags (see @c canonical_flags)
+   * @comment This function can only be called before @c parse_records
+   **/
+  void set_canonical(unsigned flags) {
+    canonical = flags;
+    canonicalizer = Canonicalizer(flags);
+  }
+
+  /**
+   * Set the range start
+   *
+   * @param timestamp The start range (seconds since Epoch)
+   **/
+  void set_start(time_t timestamp) {
+    from = timestamp;
+  }
+
+  /**
+   * Set the range end
+   *
+   * @param timestamp The ending range (seconds since Epoch)
+   **/
+  void set_end(time_t timestamp) {
+    to = timestamp;
+  }
+
+  /**
+   * Parse all requested records.
+   *
+   * @return @c true upon success; the error is available through @c get_error otherwise
+   **/
+  bool parse_records();
+
+  /**
+   * Get the number of distinct queries.
+   **/
+  size_t get_distinct_queries() const {
+    return keys.size();
+  }
+
+  /**
+   * Get the approximate number of distinct queries (see @c set_approx_distinct).
+   *
+   * @param standard_error The relative standard error of the estimate
+   * @return The estimated number of distinct queries
+   **/
+  uint64_t get_approx_distinct_queries(double &standard_error) const {
+    standard_error = distinctSketch.get_standard_error();
+    return distinctSketch.estimate();
+  }
+
+  /**
+   * Get the top queries.
+   *
+   * @param top_queries The maximum number of top queries to retreive
+   * @return The list of top queries, sorted in descending order
+   **/
+  std::vector<std::pair<RefString, unsigned>> get_top_queries(size_t top_queries = 10) const;
+
+protected:
+  /** Reader thread: fill buffers with complete lines. **/
+  void read_buffers();
+
+  /** Get a free buffer (reader side); returns @c false if the scan was stopped. **/
+  bool acquire_free(size_t &index);
+
+  /** Publish a filled buffer (reader side). **/
+  void publish(size_t index, size_t length);
+
+  /** Count (or sketch) a batch of queries. **/
+  void add_batch(const RefString *batch, size_t batch_size);
+
+  /**
+   * Parse the lines of a buffer.
+   *
+   * @return @c false if the end of the range was reached
+   **/
+  bool parse_buffer(unsigned char *data, size_t length);
+
+protected:
+  // The stream
+  StreamReader reader;
+
+  // Interned queries, and the count of each identifier
+  KeyInterner keys;
+  std::vector<unsigned> counts;
+
+  // Approximate distinct queries sketch
+  HyperLogLog distinctSketch;
+
+  // Range
+  time_t from;
+  time_t to;
+
+  // Early end of scan, and jitter
+  bool fast_seek;
+  time_t jitter;
+
+  // Approximate distinct queries
+  bool approx_distinct;
+
+  // Canonicalization flags, and the canonicalizer of batches
+  unsigned canonical;
+  Canonicalizer canonicalizer;
+
+  // Ring buffers, and the length of their complete lines
+  std::vector<std::vector<unsigned char>> buffers;
+  std::vector<size_t> lengths;
+
+  // Free, and filled buffers (in stream order)
+  std::deque<size_t> free_buffers;
+  std::deque<size_t> filled_buffers;
+
+  // Reader thread synchronization
+  std::mutex lock;
+  std::condition_variable cond;
+
+  // Reader end of stream, and consumer end of scan
+  bool finished;
+  bool stopped;
+
+  // Statistics
+  size_t read;
+  size_t skipped;
+  size_t invalid;
+  time_t max_stamp;
+  time_t max_jitter;
+
+private:
+  /* Forbidden foes */
+  YStreamParser(const YStreamParser&) = delete;
+  YStreamParser& operator=(const YStreamParser&) = delete;
+};
+
+#endif